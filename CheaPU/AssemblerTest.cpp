@@ -0,0 +1,188 @@
+#include "pch.h"
+
+#include "Assembler.h"
+#include "CPU.h"
+#include "MemoryChip.h"
+#include "TestPrograms.h"
+
+#include <sstream>
+
+namespace CheaPU {
+
+	static const char* quiz_source =
+		"; The quiz from the README.\n"
+		"STEP = 1\n"
+		"loop:   LD sum\n"
+		"        ADD counter\n"
+		"        ST sum\n"
+		"        LD counter\n"
+		"        SUB one\n"
+		"        ST counter\n"
+		"        JZE done\n"
+		"        JMP loop\n"
+		"done:   LD sum\n"
+		"        HALT\n"
+		"one:     .byte STEP\n"
+		"counter: .byte 4\n"
+		"sum:     .byte 0\n";
+
+	TEST(Assembler, quiz) {
+		Assembler assembler;
+		MemoryChip m;
+		assembler.assemble(quiz_source, m);
+
+		EXPECT_EQ(quiz_program().storage, m.storage);
+		EXPECT_EQ(22, assembler.end());
+	}
+
+	TEST(Assembler, counter) {
+		Assembler assembler;
+		MemoryChip m;
+		assembler.assemble("start: add ONE_ADDRESS\n jmp start\n ONE_ADDRESS = 4\n .org ONE_ADDRESS\n .byte 1", m);
+
+		EXPECT_EQ(counter_program().storage, m.storage);
+	}
+
+	TEST(Assembler, symbol_map) {
+		Assembler assembler;
+		MemoryChip m;
+		assembler.assemble(quiz_source, m);
+		const SymbolMap symbols = assembler.symbol_map();
+
+		EXPECT_EQ(0x00, symbols.labels.at("loop"));
+		EXPECT_EQ(0x10, symbols.labels.at("done"));
+		EXPECT_EQ(0x15, symbols.labels.at("sum"));
+		EXPECT_EQ(1, symbols.constants.at("STEP"));
+		EXPECT_EQ("done", symbols.label_at(0x10));
+		EXPECT_EQ("", symbols.label_at(0x11));
+
+		std::stringstream file;
+		symbols.write(file);
+		const SymbolMap read = SymbolMap::read(file);
+		EXPECT_EQ(symbols.labels, read.labels);
+		EXPECT_EQ(symbols.constants, read.constants);
+	}
+
+	TEST(Assembler, next_program) {
+		Assembler assembler;
+		MemoryChip m;
+		assembler.assemble(quiz_source, m);
+
+		// Nothing left of the quiz: fewer symbols, one with the name of another label.
+		MemoryChip next;
+		assembler.assemble("done: jmp done", next);
+		const SymbolMap symbols = assembler.symbol_map();
+		EXPECT_EQ(1, symbols.labels.size());
+		EXPECT_EQ(0x00, symbols.labels.at("done"));
+		EXPECT_TRUE(symbols.constants.empty());
+		EXPECT_EQ(2, assembler.end());
+
+		MemoryChip undefined;
+		EXPECT_THROW(assembler.assemble("jmp loop", undefined), AssemblyError);
+	}
+
+	TEST(Assembler, bad_symbol_map) {
+		std::stringstream file("label loop 0x10\nfunction main 0x00\n");
+		EXPECT_THROW(SymbolMap::read(file), std::runtime_error);
+	}
+
+	TEST(Assembler, expressions) {
+		Assembler assembler;
+		MemoryChip m;
+		assembler.assemble(
+			"BASE = 0x10\n"
+			"LD BASE + 2 - 1\n"
+			"LD table + 0b11\n"
+			"LD table - 1 + 2\n"
+			".byte -1, 255, BASE-16\n"
+			"table:\n", m);
+
+		const uint8_t expected[] = { 1, 0x11, 1, 12, 1, 10, 0xFF, 0xFF, 0 };
+		for (size_t i = 0; i < sizeof(expected); ++i)
+			EXPECT_EQ(expected[i], m[i]) << "at " << i;
+	}
+
+	TEST(Assembler, negative_symbols) {
+		Assembler assembler;
+		MemoryChip m;
+		assembler.assemble(
+			"NEG = -1\n"
+			"LD table + NEG\n"
+			"ADD NEG + 3\n"
+			".byte NEG, NEG - 127\n"
+			"table:\n", m);
+
+		const uint8_t expected[] = { 1, 5, 3, 2, 0xFF, 0x80 };
+		for (size_t i = 0; i < sizeof(expected); ++i)
+			EXPECT_EQ(expected[i], m[i]) << "at " << i;
+
+		const SymbolMap symbols = assembler.symbol_map();
+		EXPECT_EQ(-1, symbols.constants.at("NEG"));
+		std::stringstream file;
+		symbols.write(file);
+		EXPECT_EQ(symbols.constants, SymbolMap::read(file).constants);
+
+		// Operands can't be negative: the error tells the real value.
+		try {
+			assembler.assemble("NEG = -1\nLD NEG\n", m);
+			FAIL();
+		}
+		catch (const AssemblyError& e) {
+			EXPECT_NE(std::string::npos, std::string(e.what()).find("-1"));
+		}
+	}
+
+	TEST(Assembler, labels_on_the_same_line) {
+		Assembler assembler;
+		MemoryChip m;
+		assembler.assemble("a: b: NOP\nc:\n  d : halt ; stop\n", m);
+		const SymbolMap symbols = assembler.symbol_map();
+
+		EXPECT_EQ(0, symbols.labels.at("a"));
+		EXPECT_EQ(0, symbols.labels.at("b"));
+		EXPECT_EQ(1, symbols.labels.at("c"));
+		EXPECT_EQ(1, symbols.labels.at("d"));
+		EXPECT_EQ(to_word(Opcode::HALT), m[1]);
+	}
+
+	TEST(Assembler, runs) {
+		Assembler assembler;
+		MemoryChip m;
+		assembler.assemble(quiz_source, m);
+
+		CPU c;
+		c.run_until_halt(m);
+		EXPECT_EQ(10, c.accumulator);
+	}
+
+	static size_t error_line(const char* source) {
+		Assembler assembler;
+		MemoryChip m;
+		try {
+			assembler.assemble(source, m);
+		}
+		catch (const AssemblyError& e) {
+			return e.line;
+		}
+		return 0;
+	}
+
+	TEST(Assembler, errors) {
+		EXPECT_EQ(2, error_line("NOP\nMOV 1\n"));               // Unknown instruction.
+		EXPECT_EQ(1, error_line("LD\n"));                       // Missing operand.
+		EXPECT_EQ(1, error_line("HALT 1\n"));                   // Operand too many.
+		EXPECT_EQ(2, error_line("NOP\nJMP nowhere\nNOP\n"));    // Undefined.
+		EXPECT_EQ(3, error_line("a: NOP\nNOP\na: NOP\n"));      // Twice.
+		EXPECT_EQ(1, error_line("LD 256\n"));                   // Too big.
+		EXPECT_EQ(1, error_line("LD -1\n"));                    // Negative address.
+		EXPECT_EQ(1, error_line(".byte -129\n"));
+		EXPECT_EQ(1, error_line("JMP far\n.org 0x100\nfar: NOP\n"));  // Fixup out of range: reported where it is used.
+		EXPECT_EQ(1, error_line("X = later\nlater: NOP\n"));
+		EXPECT_EQ(1, error_line(".org 0x2000\n"));
+		EXPECT_EQ(2, error_line(".org 0x1FFF\nLD 1\n"));        // Past the end of the memory.
+		EXPECT_EQ(1, error_line("LD 0xZZ\n"));
+		EXPECT_EQ(1, error_line("LD 1 2\n"));
+		EXPECT_EQ(1, error_line("LD a + b\nb: a: NOP\n"));      // Two symbols not defined yet.
+		EXPECT_EQ(0, error_line("a: b: NOP\nLD a + b\n"));      // Fine, if they are.
+	}
+}
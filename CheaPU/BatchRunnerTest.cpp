@@ -0,0 +1,87 @@
+#include "pch.h"
+
+#include "BatchRunner.h"
+#include "CPU.h"
+#include "MemoryChip.h"
+#include "TestPrograms.h"
+
+#include <vector>
+
+namespace CheaPU {
+
+	static std::vector<BatchJob> random_jobs(const size_t count) {
+		std::vector<BatchJob> jobs;
+		for (uint32_t seed = 0; seed < count; ++seed)
+			jobs.push_back({ random_program(seed), 100 + 37 * seed });
+		return jobs;
+	}
+
+	TEST(BatchRunner, same_as_one_cpu_at_a_time) {
+		const std::vector<BatchJob> jobs = random_jobs(100);
+
+		BatchRunner runner(4);
+		const std::vector<BatchResult> results = runner.run(jobs);
+
+		ASSERT_EQ(jobs.size(), results.size());
+		for (size_t i = 0; i < jobs.size(); ++i) {
+			CPU c;
+			MemoryChip m = jobs[i].memory;
+			const uint64_t cycles = c.run_cycles(m, jobs[i].max_cycles);
+
+			EXPECT_EQ(cycles, results[i].cycles) << "job " << i;
+			EXPECT_EQ(c.accumulator, results[i].accumulator) << "job " << i;
+			EXPECT_EQ(c.program_counter, results[i].program_counter) << "job " << i;
+			EXPECT_EQ(c.error, results[i].error) << "job " << i;
+			EXPECT_EQ(c.overflow(), results[i].overflow) << "job " << i;
+			EXPECT_EQ(c.zero(), results[i].zero) << "job " << i;
+			EXPECT_EQ(m.digest(), results[i].memory_digest) << "job " << i;
+		}
+	}
+
+	TEST(BatchRunner, any_number_of_threads) {
+		const std::vector<BatchJob> jobs = random_jobs(50);
+		const std::vector<BatchResult> expected = BatchRunner(1).run(jobs);
+
+		for (const unsigned threads : { 2, 3, 8, 64 }) {
+			const std::vector<BatchResult> results = BatchRunner(threads).run(jobs);
+			for (size_t i = 0; i < jobs.size(); ++i) {
+				EXPECT_EQ(expected[i].cycles, results[i].cycles);
+				EXPECT_EQ(expected[i].memory_digest, results[i].memory_digest);
+			}
+		}
+	}
+
+	TEST(BatchRunner, uneven_jobs_are_stolen) {
+		// The first thread gets all the long ones. Long enough that the other thread
+		// gets to run before they are over, even with a single core.
+		std::vector<BatchJob> jobs;
+		for (int i = 0; i < 8; ++i)
+			jobs.push_back({ counter_program(), i < 4 ? 20000000u : 1u });
+
+		BatchRunner runner(2);
+		const std::vector<BatchResult> results = runner.run(jobs);
+
+		EXPECT_LT(0, runner.steals);
+		EXPECT_EQ(20000000, results[0].cycles);
+		EXPECT_EQ(1, results[7].cycles);
+	}
+
+	TEST(BatchRunner, detect_loops) {
+		std::vector<BatchJob> jobs = { { counter_program(), 1000000 }, { quiz_program(), 1000000 } };
+
+		BatchRunner runner(2);
+		runner.detect_loops = true;
+		const std::vector<BatchResult> results = runner.run(jobs);
+
+		EXPECT_EQ(2 * 256, results[0].loop_period);
+		EXPECT_GT(1000000u, results[0].cycles);
+		EXPECT_EQ(0, results[1].loop_period);
+		EXPECT_EQ(95, results[1].cycles);
+	}
+
+	TEST(BatchRunner, no_jobs) {
+		BatchRunner runner;
+		EXPECT_LT(0, runner.threads());
+		EXPECT_TRUE(runner.run({}).empty());
+	}
+}
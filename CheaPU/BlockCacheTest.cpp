@@ -0,0 +1,97 @@
+#include "pch.h"
+
+#include "BlockCache.h"
+#include "CPU.h"
+#include "MemoryChip.h"
+#include "TestPrograms.h"
+
+namespace CheaPU {
+
+	/** Runs the program with the CPU alone and trough the cache, then compares everything. */
+	static void expect_same_as_cpu(const MemoryChip& program, const uint64_t instructions) {
+		CPU plain;
+		MemoryChip plain_memory = program;
+		const uint64_t plain_cycles = plain.run(plain_memory, instructions);
+
+		CPU cached;
+		MemoryChip cached_memory = program;
+		BlockCache cache;
+		const uint64_t cached_cycles = cache.run(cached, cached_memory, instructions);
+
+		EXPECT_EQ(plain_cycles, cached_cycles);
+		EXPECT_EQ(plain.accumulator, cached.accumulator);
+		EXPECT_EQ(plain.program_counter, cached.program_counter);
+		EXPECT_EQ(plain.error, cached.error);
+		EXPECT_EQ(plain.overflow(), cached.overflow());
+		EXPECT_EQ(plain.zero(), cached.zero());
+		EXPECT_EQ(plain_memory.storage, cached_memory.storage);
+	}
+
+	TEST(BlockCache, counter) {
+		for (const uint64_t instructions : { 0, 1, 2, 3, 1000, 1001 })
+			expect_same_as_cpu(counter_program(), instructions);
+	}
+
+	TEST(BlockCache, quiz) {
+		for (uint64_t instructions = 0; instructions < 50; ++instructions)
+			expect_same_as_cpu(quiz_program(), instructions);
+	}
+
+	TEST(BlockCache, random_programs) {
+		for (uint32_t seed = 0; seed < 200; ++seed)
+			expect_same_as_cpu(random_program(seed), 5000);
+	}
+
+	TEST(BlockCache, code_rewrites_its_own_block) {
+		MemoryChip m;
+		m[0x00] = to_word(Opcode::LD);
+		m[0x01] = 0x20;
+		m[0x02] = to_word(Opcode::ST);
+		m[0x03] = 0x04;
+		m[0x04] = to_word(Opcode::NOP);  // Becomes a HALT.
+		m[0x05] = to_word(Opcode::JMP);
+		m[0x06] = 0x00;
+		m[0x20] = to_word(Opcode::HALT);
+
+		expect_same_as_cpu(m, 100);
+	}
+
+	TEST(BlockCache, code_rewrites_a_block_already_run) {
+		MemoryChip m;
+		m[0x00] = to_word(Opcode::NOP);  // Becomes a HALT.
+		m[0x01] = to_word(Opcode::LD);
+		m[0x02] = 0x20;
+		m[0x03] = to_word(Opcode::ST);
+		m[0x04] = 0x00;
+		m[0x05] = to_word(Opcode::JMP);
+		m[0x06] = 0x00;
+		m[0x20] = to_word(Opcode::HALT);
+
+		expect_same_as_cpu(m, 100);
+	}
+
+	TEST(BlockCache, front_panel_changes_the_code) {
+		CPU c;
+		MemoryChip m = counter_program();
+		BlockCache cache;
+
+		cache.run(c, m, 10);
+		m[0x00] = to_word(Opcode::HALT);
+		cache.run(c, m, 10);
+
+		EXPECT_EQ(1, c.error);
+		EXPECT_EQ(5, c.accumulator);
+	}
+
+	TEST(BlockCache, completes_instruction_in_progress) {
+		CPU c;
+		MemoryChip m = quiz_program();
+		BlockCache cache;
+		c.cycle(m);
+
+		const uint64_t cycles = cache.run(c, m, 1);
+
+		EXPECT_EQ(2, cycles);
+		EXPECT_EQ(0x02, c.program_counter);
+	}
+}
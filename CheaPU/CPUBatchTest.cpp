@@ -0,0 +1,163 @@
+#include "pch.h"
+
+#include "CPUBatch.h"
+#include "CPU.h"
+#include "MemoryChip.h"
+#include "TestPrograms.h"
+
+#include <vector>
+
+namespace CheaPU {
+
+	/** Loads every program in a lane, runs the batch and then each program alone on a CPU. */
+	static void expect_same_as_cpu(const std::vector<MemoryChip>& programs, const uint64_t instructions) {
+		CPUBatch batch(programs.size());
+		for (size_t lane = 0; lane < programs.size(); ++lane)
+			batch.load(lane, programs[lane]);
+
+		batch.run(instructions);
+
+		for (size_t lane = 0; lane < programs.size(); ++lane) {
+			CPU c;
+			MemoryChip m = programs[lane];
+			const uint64_t cycles = c.run(m, instructions);
+
+			EXPECT_EQ(cycles, batch.cycles[lane]) << "lane " << lane;
+			EXPECT_EQ(c.accumulator, batch.accumulator[lane]) << "lane " << lane;
+			EXPECT_EQ(c.program_counter, batch.program_counter[lane]) << "lane " << lane;
+			EXPECT_EQ(c.error, batch.error[lane]) << "lane " << lane;
+			EXPECT_EQ(c.overflow(), batch.overflow[lane]) << "lane " << lane;
+			EXPECT_EQ(c.zero(), batch.zero[lane]) << "lane " << lane;
+			EXPECT_EQ(m.storage, batch.memory(lane).storage) << "lane " << lane;
+		}
+	}
+
+	TEST(CPUBatch, padding_lanes_do_not_run) {
+		CPUBatch batch(3);
+		EXPECT_EQ(3, batch.lanes());
+		EXPECT_EQ(0, batch.error[2]);
+		for (size_t lane = 3; lane < batch.error.size(); ++lane)
+			EXPECT_EQ(1, batch.error[lane]);
+	}
+
+	TEST(CPUBatch, quiz_with_different_counters) {
+		std::vector<MemoryChip> programs;
+		for (int counter = 0; counter < 40; ++counter) {
+			MemoryChip m = quiz_program();
+			m[0x14] = static_cast<uint8_t>(counter);
+			programs.push_back(m);
+		}
+
+		for (const uint64_t instructions : { 0, 1, 7, 50, 2000 })
+			expect_same_as_cpu(programs, instructions);
+	}
+
+	TEST(CPUBatch, random_programs) {
+		std::vector<MemoryChip> programs;
+		for (uint32_t seed = 0; seed < 70; ++seed)
+			programs.push_back(random_program(seed));
+
+		for (const uint64_t instructions : { 1, 100, 5000 })
+			expect_same_as_cpu(programs, instructions);
+	}
+
+	TEST(CPUBatch, flags) {
+		// The counter, counting by a different step in every lane: some carry, some land on 0.
+		std::vector<MemoryChip> programs;
+		for (int step = 0; step < 256; step += 5) {
+			MemoryChip m = counter_program();
+			m[0x04] = static_cast<uint8_t>(step);
+			programs.push_back(m);
+		}
+
+		for (const uint64_t instructions : { 1, 2, 99, 100, 513 })
+			expect_same_as_cpu(programs, instructions);
+	}
+
+	TEST(CPUBatch, lanes_that_loop_do_not_starve_the_others) {
+		// Lane 0 spins at the lowest address, lane 1 halts after a few instructions. Lane 2 has a longer
+		// loop at the same address, lane 3 has something else there (its own memory) and halts.
+		MemoryChip spinning;
+		spinning[0x00] = to_word(Opcode::JMP);
+		spinning[0x01] = 0x00;
+
+		MemoryChip halting;
+		halting[0x00] = to_word(Opcode::JMP);
+		halting[0x01] = 0x10;
+		halting[0x10] = to_word(Opcode::ADD);
+		halting[0x11] = 0x20;
+		halting[0x12] = to_word(Opcode::HALT);
+		halting[0x20] = 5;
+
+		MemoryChip looping;
+		looping[0x00] = to_word(Opcode::NOP);
+		looping[0x01] = to_word(Opcode::JMP);
+		looping[0x02] = 0x00;
+
+		MemoryChip different = halting;
+		different[0x00] = to_word(Opcode::LD);
+		different[0x01] = 0x20;
+		different[0x02] = to_word(Opcode::HALT);
+
+		for (const uint64_t instructions : { 1, 2, 3, 1000 })
+			expect_same_as_cpu({ spinning, halting, looping, different }, instructions);
+
+#ifndef CHEAPU_PERFORMANCE_COUNTERS  // The CPU would really run forever.
+		// No limit: it ends when the only lanes still running are in a jump to itself.
+		expect_same_as_cpu({ spinning, halting, different, spinning }, UINT64_MAX);
+#endif
+	}
+
+	TEST(CPUBatch, idle_loops) {
+		// "LD 0x10, JZE 0x00": waits for 0x10 to be non zero.
+		MemoryChip waiting;
+		waiting[0x00] = to_word(Opcode::LD);
+		waiting[0x01] = 0x10;
+		waiting[0x02] = to_word(Opcode::JZE);
+		waiting[0x03] = 0x00;
+		waiting[0x04] = to_word(Opcode::HALT);
+
+		MemoryChip released = waiting;
+		released[0x10] = 1;
+
+		// "SUB 0x10, LD 0x11, JMP 0x00": the SUB borrows every time around.
+		MemoryChip borrowing;
+		borrowing[0x00] = to_word(Opcode::SUB);
+		borrowing[0x01] = 0x10;
+		borrowing[0x02] = to_word(Opcode::LD);
+		borrowing[0x03] = 0x11;
+		borrowing[0x04] = to_word(Opcode::JMP);
+		borrowing[0x05] = 0x00;
+		borrowing[0x10] = 1;
+
+		// Not idle: it stores.
+		MemoryChip storing;
+		storing[0x00] = to_word(Opcode::ADD);
+		storing[0x01] = 0x10;
+		storing[0x02] = to_word(Opcode::ST);
+		storing[0x03] = 0x11;
+		storing[0x04] = to_word(Opcode::JMP);
+		storing[0x05] = 0x00;
+		storing[0x10] = 1;
+
+		for (const uint64_t instructions : { 1, 2, 3, 4, 5, 6, 7, 1000, 1000001 })
+			expect_same_as_cpu({ waiting, released, borrowing, storing, quiz_program() }, instructions);
+
+#ifndef CHEAPU_PERFORMANCE_COUNTERS  // The CPU would really run forever.
+		expect_same_as_cpu({ waiting, released, borrowing, quiz_program() }, UINT64_MAX);
+#endif
+	}
+
+	TEST(CPUBatch, run_continues) {
+		CPUBatch batch(1);
+		batch.load(0, counter_program());
+		batch.run(10);
+		batch.run(11);
+
+		CPU c;
+		MemoryChip m = counter_program();
+		c.run(m, 10);
+		EXPECT_EQ(c.run(m, 11), batch.cycles[0]);
+		EXPECT_EQ(c.accumulator, batch.accumulator[0]);
+	}
+}
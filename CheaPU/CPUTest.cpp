@@ -2,6 +2,7 @@
 
 #include "CPU.h"
 #include "MemoryChip.h"
+#include "TestPrograms.h"
 
 #include <functional>
 #include <iostream>
@@ -14,8 +15,8 @@ namespace CheaPU {
 		EXPECT_EQ(0, c.accumulator);
 		EXPECT_EQ(0, c.program_counter);
 		EXPECT_EQ(0, c.error);
-		EXPECT_EQ(0, c.overflow);
-		EXPECT_EQ(0, c.zero);
+		EXPECT_EQ(0, c.overflow());
+		EXPECT_EQ(0, c.zero());
 	}
 
 
@@ -31,8 +32,8 @@ namespace CheaPU {
 		EXPECT_EQ(0, c.accumulator);
 		EXPECT_EQ(1, c.program_counter);
 		EXPECT_EQ(0, c.error);
-		EXPECT_EQ(0, c.overflow);
-		EXPECT_EQ(0, c.zero);
+		EXPECT_EQ(0, c.overflow());
+		EXPECT_EQ(0, c.zero());
 	}
 	
 	TEST(CPU, load) {
@@ -51,8 +52,8 @@ namespace CheaPU {
 		EXPECT_EQ(42, c.accumulator);
 		EXPECT_EQ(0x02, c.program_counter);
 		EXPECT_EQ(0, c.error);
-		EXPECT_EQ(0, c.overflow);
-		EXPECT_EQ(0, c.zero);
+		EXPECT_EQ(0, c.overflow());
+		EXPECT_EQ(0, c.zero());
 	}
 
 	TEST(CPU, store) {
@@ -71,8 +72,8 @@ namespace CheaPU {
 		EXPECT_EQ(12, m[0x02]);
 		EXPECT_EQ(0x02, c.program_counter);
 		EXPECT_EQ(0, c.error);
-		EXPECT_EQ(0, c.overflow);
-		EXPECT_EQ(0, c.zero);
+		EXPECT_EQ(0, c.overflow());
+		EXPECT_EQ(0, c.zero());
 	}
 
 	TEST(CPU, add) {
@@ -97,8 +98,8 @@ namespace CheaPU {
 		EXPECT_EQ(84, c.accumulator);
 		EXPECT_EQ(0x04, c.program_counter);
 		EXPECT_EQ(0, c.error);
-		EXPECT_EQ(0, c.overflow);
-		EXPECT_EQ(0, c.zero);
+		EXPECT_EQ(0, c.overflow());
+		EXPECT_EQ(0, c.zero());
 	}
 
 	TEST(CPU, jmp) {
@@ -116,8 +117,8 @@ namespace CheaPU {
 		EXPECT_EQ(0, c.accumulator);
 		EXPECT_EQ(0x30, c.program_counter);
 		EXPECT_EQ(0, c.error);
-		EXPECT_EQ(0, c.overflow);
-		EXPECT_EQ(0, c.zero);
+		EXPECT_EQ(0, c.overflow());
+		EXPECT_EQ(0, c.zero());
 	}
 
 	TEST(CPU, jze_zero) {
@@ -135,8 +136,8 @@ namespace CheaPU {
 		EXPECT_EQ(0, c.accumulator);
 		EXPECT_EQ(0x30, c.program_counter);
 		EXPECT_EQ(0, c.error);
-		EXPECT_EQ(0, c.overflow);
-		EXPECT_EQ(0, c.zero);
+		EXPECT_EQ(0, c.overflow());
+		EXPECT_EQ(0, c.zero());
 	}
 
 	TEST(CPU, jze_not_zero) {
@@ -154,8 +155,8 @@ namespace CheaPU {
 		EXPECT_EQ(54, c.accumulator);
 		EXPECT_EQ(0x02, c.program_counter);
 		EXPECT_EQ(0, c.error);
-		EXPECT_EQ(0, c.overflow);
-		EXPECT_EQ(0, c.zero);
+		EXPECT_EQ(0, c.overflow());
+		EXPECT_EQ(0, c.zero());
 	}
 
 	TEST(CPU, sub) {
@@ -180,7 +181,412 @@ namespace CheaPU {
 		EXPECT_EQ(0, c.accumulator);
 		EXPECT_EQ(0x04, c.program_counter);
 		EXPECT_EQ(0, c.error);
-		EXPECT_EQ(0, c.overflow);
-		EXPECT_EQ(0, c.zero);
+		EXPECT_EQ(0, c.overflow());
+		EXPECT_EQ(1, c.zero());
+	}
+
+	/** Runs "LD 0x30, op 0x31" with the values in 0x30 and 0x31, with both engines and with run(). */
+	static void expect_flags(const Opcode op, const uint8_t accumulator, const uint8_t value,
+		                     const uint8_t result, const bool overflow, const bool zero) {
+		for (const Engine engine : { Engine::microcode, Engine::coroutines }) {
+			MemoryChip m;
+			m[0x00] = to_word(Opcode::LD);
+			m[0x01] = 0x30;
+			m[0x02] = to_word(op);
+			m[0x03] = 0x31;
+			m[0x30] = accumulator;
+			m[0x31] = value;
+
+			CPU slow(engine);
+			MemoryChip slow_memory = m;
+			for (int i = 0; i < 6; ++i)
+				slow.cycle(slow_memory);
+
+			CPU fast(engine);
+			MemoryChip fast_memory = m;
+			fast.run(fast_memory, 2);
+
+			for (const CPU* c : { &slow, &fast }) {
+				EXPECT_EQ(result, c->accumulator) << +accumulator << ", " << +value;
+				EXPECT_EQ(overflow, c->overflow()) << +accumulator << ", " << +value;
+				EXPECT_EQ(zero, c->zero()) << +accumulator << ", " << +value;
+			}
+		}
+	}
+
+	TEST(CPU, flags) {
+		expect_flags(Opcode::ADD, 200, 55, 255, false, false);
+		expect_flags(Opcode::ADD, 200, 56, 0, true, true);
+		expect_flags(Opcode::ADD, 200, 57, 1, true, false);
+		expect_flags(Opcode::ADD, 0, 0, 0, false, true);
+		expect_flags(Opcode::SUB, 5, 3, 2, false, false);
+		expect_flags(Opcode::SUB, 5, 5, 0, false, true);
+		expect_flags(Opcode::SUB, 5, 6, 255, true, false);
+		expect_flags(Opcode::SUB, 0, 255, 1, true, false);
+	}
+
+	TEST(CPU, flags_stay_until_the_next_alu_operation) {
+		CPU c;
+		MemoryChip m;
+		m[0x00] = to_word(Opcode::ADD);  // 0 + 0: zero.
+		m[0x01] = 0x30;
+		m[0x02] = to_word(Opcode::LD);   // The accumulator is not 0 anymore, the flag stays.
+		m[0x03] = 0x31;
+		m[0x31] = 7;
+
+		c.run(m, 2);
+		EXPECT_EQ(7, c.accumulator);
+		EXPECT_EQ(1, c.zero());
+
+		const CPUState state = c.save_state();
+		EXPECT_EQ(1, state.zero);
+		EXPECT_EQ(0, state.overflow);
+
+		CPU copy;
+		for (const uint8_t overflow : { 0, 1 })
+			for (const uint8_t zero : { 0, 1 }) {
+				CPUState flags = state;
+				flags.overflow = overflow;
+				flags.zero = zero;
+				copy.restore_state(flags);
+				EXPECT_EQ(flags, copy.save_state());
+			}
+
+		c.reset();
+		EXPECT_EQ(0, c.zero());
+	}
+
+	/** Runs the same program with both engines, checking that they agree after every cycle. */
+	static void expect_engines_agree(const MemoryChip& program, const int cycles) {
+		CPU coroutines(Engine::coroutines);
+		CPU microcode(Engine::microcode);
+		MemoryChip coroutines_memory = program;
+		MemoryChip microcode_memory = program;
+
+		for (int i = 0; i < cycles; ++i) {
+			coroutines.cycle(coroutines_memory);
+			microcode.cycle(microcode_memory);
+
+			ASSERT_EQ(coroutines.accumulator, microcode.accumulator) << "cycle " << i;
+			ASSERT_EQ(coroutines.program_counter, microcode.program_counter) << "cycle " << i;
+			ASSERT_EQ(coroutines.error, microcode.error) << "cycle " << i;
+			ASSERT_EQ(coroutines.overflow(), microcode.overflow()) << "cycle " << i;
+			ASSERT_EQ(coroutines.zero(), microcode.zero()) << "cycle " << i;
+			ASSERT_EQ(coroutines_memory.storage, microcode_memory.storage) << "cycle " << i;
+		}
+	}
+
+	TEST(CPU, engines_agree_on_counter) {
+		expect_engines_agree(counter_program(), 2000);
+	}
+
+	TEST(CPU, engines_agree_on_quiz) {
+		expect_engines_agree(quiz_program(), 200);
+	}
+
+	TEST(CPU, engines_agree_on_illegal_opcode) {
+		MemoryChip m;
+		m[0x00] = to_word(Opcode::NOP);
+		m[0x01] = 0xFF;
+		expect_engines_agree(m, 5);
+	}
+
+	TEST(CPU, engines_agree_on_every_byte) {
+		for (int byte = 0; byte < 256; ++byte) {
+			MemoryChip m;
+			m[0x00] = static_cast<uint8_t>(byte);
+			m[0x01] = 0x02;
+			m[0x02] = 42;
+			expect_engines_agree(m, 4);
+		}
+	}
+
+	TEST(CPU, illegal_opcode_stops_at_fetch) {
+		CPU c;
+		MemoryChip m;
+		m[0x00] = 0x08;
+
+		c.cycle(m);
+
+		EXPECT_EQ(1, c.error);
+		EXPECT_EQ(0, c.program_counter);
+	}
+
+	TEST(CPU, quiz) {
+		CPU c;
+		MemoryChip m = quiz_program();
+
+		for (int i = 0; i < 200; ++i)
+			c.cycle(m);
+
+		EXPECT_EQ(10, c.accumulator);
+		EXPECT_EQ(10, m[0x15]);
+		EXPECT_EQ(1, c.error);
+	}
+
+	/** Checks that run() leaves the CPU exactly as cycle() would after the same number of cycles. */
+	static void expect_run_matches_cycles(const MemoryChip& program, const uint64_t instructions, const Engine engine) {
+		CPU fast(engine);
+		MemoryChip fast_memory = program;
+		const uint64_t cycles = fast.run(fast_memory, instructions);
+
+		CPU slow(engine);
+		MemoryChip slow_memory = program;
+		for (uint64_t i = 0; i < cycles; ++i)
+			slow.cycle(slow_memory);
+
+		EXPECT_EQ(slow.accumulator, fast.accumulator);
+		EXPECT_EQ(slow.program_counter, fast.program_counter);
+		EXPECT_EQ(slow.error, fast.error);
+		EXPECT_EQ(slow_memory.storage, fast_memory.storage);
+
+		// One more cycle must start the same instruction on both.
+		fast.cycle(fast_memory);
+		slow.cycle(slow_memory);
+		EXPECT_EQ(slow.program_counter, fast.program_counter);
+		EXPECT_EQ(slow.error, fast.error);
+	}
+
+	TEST(CPU, run_counter) {
+		for (const Engine engine : { Engine::microcode, Engine::coroutines })
+			for (const uint64_t instructions : { 0, 1, 2, 7, 512, 1001 })
+				expect_run_matches_cycles(counter_program(), instructions, engine);
+	}
+
+	TEST(CPU, run_quiz) {
+		for (const Engine engine : { Engine::microcode, Engine::coroutines })
+			for (uint64_t instructions = 0; instructions < 50; ++instructions)
+				expect_run_matches_cycles(quiz_program(), instructions, engine);
+	}
+
+	TEST(CPU, run_until_halt) {
+		CPU c;
+		MemoryChip m = quiz_program();
+
+		const uint64_t cycles = c.run_until_halt(m);
+
+		CPU slow;
+		MemoryChip slow_memory = quiz_program();
+		uint64_t slow_cycles = 0;
+		while (!slow.error) {
+			slow.cycle(slow_memory);
+			++slow_cycles;
+		}
+
+		EXPECT_EQ(slow_cycles, cycles);
+		EXPECT_EQ(10, c.accumulator);
+		EXPECT_EQ(1, c.error);
+	}
+
+	TEST(CPU, run_completes_instruction_in_progress) {
+		CPU c;
+		MemoryChip m = quiz_program();
+		c.cycle(m);  // Fetch LD, the load is still to do.
+
+		const uint64_t cycles = c.run(m, 1);
+
+		EXPECT_EQ(2, cycles);
+		EXPECT_EQ(0x02, c.program_counter);
+	}
+
+	TEST(CPU, run_stops_on_illegal_opcode) {
+		CPU c;
+		MemoryChip m;
+		m[0x00] = to_word(Opcode::NOP);
+		m[0x01] = 0xFF;
+
+		const uint64_t cycles = c.run(m, 100);
+
+		EXPECT_EQ(3, cycles);
+		EXPECT_EQ(1, c.error);
+		EXPECT_EQ(0x01, c.program_counter);
+	}
+
+	/** "ADD 0x10, JZE 0x02" (waits for the accumulator to be 0: never, if 0x10 holds 0), then a second loop
+	    "LD 0x11, JMP 0x04" that does the same thing over and over. */
+	static MemoryChip idle_program(const uint8_t step) {
+		MemoryChip m;
+		m[0x00] = to_word(Opcode::ADD);
+		m[0x01] = 0x10;
+		m[0x02] = to_word(Opcode::JZE);
+		m[0x03] = 0x02;
+		m[0x04] = to_word(Opcode::LD);
+		m[0x05] = 0x11;
+		m[0x06] = to_word(Opcode::JMP);
+		m[0x07] = 0x04;
+		m[0x10] = step;
+		m[0x11] = 7;
+		return m;
+	}
+
+	TEST(CPU, run_skips_idle_loops) {
+		for (const uint8_t step : { 0, 1 })
+			for (const uint64_t instructions : { 1, 2, 3, 4, 5, 6, 7, 100, 1001 })
+				expect_run_matches_cycles(idle_program(step), instructions, Engine::microcode);
+
+#ifndef CHEAPU_PERFORMANCE_COUNTERS
+		CPU c;
+		MemoryChip m = idle_program(0);  // Stuck in the JZE to itself.
+		EXPECT_EQ(3 + 3 * (1000000000000 - 1), c.run(m, 1000000000000));
+		EXPECT_TRUE(c.idle());
+		EXPECT_EQ(0x02, c.program_counter);
+
+		m[0x10] = 1;  // Out of the 1st loop, into the second.
+		c.reset();
+		EXPECT_EQ(3 + 2 + 6 * 500000000000, c.run(m, 1000000000002));
+		EXPECT_TRUE(c.idle());
+
+		c.reset();
+		EXPECT_FALSE(c.idle());
+#endif
+	}
+
+	TEST(CPU, loops_that_store_are_not_idle) {
+		CPU c;
+		MemoryChip m;
+		m[0x00] = to_word(Opcode::ST);  // Always the same value, but it does store.
+		m[0x01] = 0x10;
+		m[0x02] = to_word(Opcode::JMP);
+		m[0x03] = 0x00;
+
+		c.run(m, 1000);
+		EXPECT_FALSE(c.idle());
+
+		c.reset();
+		MemoryChip counter = counter_program();
+		c.run(counter, 1000);
+		EXPECT_FALSE(c.idle());
+	}
+
+#ifndef CHEAPU_PERFORMANCE_COUNTERS  // It would really run forever.
+	TEST(CPU, run_until_halt_returns_from_idle_loops) {
+		CPU c;
+		MemoryChip m;
+		m[0x00] = to_word(Opcode::JMP);
+		m[0x01] = 0x00;
+
+		const uint64_t cycles = c.run_until_halt(m);
+		EXPECT_TRUE(c.idle());
+		EXPECT_EQ(0, c.error);
+		EXPECT_EQ(6, cycles);  // Twice around, to be sure.
+	}
+
+	TEST(CPU, step_instruction) {
+		CPU c;
+		MemoryChip m = counter_program();
+		EXPECT_EQ(3, c.step_instruction(m, 100));  // The ADD.
+		EXPECT_EQ(0x02, c.program_counter);
+
+		EXPECT_EQ(2, c.step_instruction(m, 2));    // Not enough for the JMP: stops half-way...
+		EXPECT_FALSE(c.instruction_completed());
+		EXPECT_EQ(1, c.step_instruction(m, 100));  // ...and finishes it.
+		EXPECT_TRUE(c.instruction_completed());
+		EXPECT_EQ(0x00, c.program_counter);
+	}
+
+	TEST(CPU, idle_across_short_runs) {
+		// "SUB 0x10 (borrows), LD 0x11, JMP 0x00": idle, with the high bits of the ALU result set.
+		CPU c;
+		MemoryChip m;
+		m[0x00] = to_word(Opcode::SUB);
+		m[0x01] = 0x10;
+		m[0x02] = to_word(Opcode::LD);
+		m[0x03] = 0x11;
+		m[0x04] = to_word(Opcode::JMP);
+		m[0x05] = 0x00;
+		m[0x10] = 1;
+
+		c.run(m, 99);
+		ASSERT_TRUE(c.idle());
+
+		// One instruction per run, as the UI does with a slow clock: every JMP sees it is the same loop.
+		for (int loop = 0; loop < 3; ++loop) {
+			c.run(m, 1);
+			c.run(m, 1);
+			EXPECT_FALSE(c.idle());
+			c.run(m, 1);
+			EXPECT_TRUE(c.idle()) << loop;
+		}
+
+		// Same with cycles in between, as long as they don't store.
+		c.run_cycles(m, 4);
+		c.run_cycles(m, 5);
+		EXPECT_TRUE(c.idle());
+	}
+
+	TEST(CPU, idle_loops_are_left_when_the_memory_changes) {
+		CPU c;
+		MemoryChip m;
+		m[0x00] = to_word(Opcode::JMP);
+		m[0x01] = 0x00;
+		m[0x05] = to_word(Opcode::JMP);
+		m[0x06] = 0x05;
+
+		c.run(m, 10);
+		ASSERT_TRUE(c.idle());
+
+		// The front panel points the jump forward: no backward jump, not idle anymore.
+		m[0x01] = 0x03;
+		c.run(m, 1);
+		EXPECT_FALSE(c.idle());
+		for (int i = 0; i < 10; ++i)
+			c.cycle(m);
+		EXPECT_FALSE(c.idle());
+
+		// Same, one cycle at a time: it stays idle while it is in the loop...
+		c.reset();
+		m[0x01] = 0x00;
+		c.run(m, 10);
+		ASSERT_TRUE(c.idle());
+		m[0x01] = 0x03;
+		c.cycle(m);
+		EXPECT_TRUE(c.idle());
+
+		// ...but not once it fetches outside of it.
+		c.cycle(m);
+		c.cycle(m);
+		ASSERT_EQ(0x03, c.program_counter);
+		c.cycle(m);
+		EXPECT_FALSE(c.idle());
+
+		// The same loop, but it stores now.
+		c.reset();
+		m[0x01] = 0x00;
+		c.run(m, 10);
+		m[0x00] = to_word(Opcode::ST);
+		m[0x01] = 0x10;
+		c.cycle(m);
+		EXPECT_FALSE(c.idle());
+	}
+#endif
+
+	/** Checks that run_cycles() leaves the CPU exactly as cycle() called max_cycles times. */
+	static void expect_run_cycles_matches_cycles(const MemoryChip& program, const uint64_t max_cycles) {
+		CPU fast;
+		MemoryChip fast_memory = program;
+		const uint64_t cycles = fast.run_cycles(fast_memory, max_cycles);
+
+		CPU slow;
+		MemoryChip slow_memory = program;
+		uint64_t slow_cycles = 0;
+		for (; slow_cycles < max_cycles && !slow.error; ++slow_cycles)
+			slow.cycle(slow_memory);
+
+		EXPECT_EQ(slow_cycles, cycles);
+		EXPECT_EQ(slow.accumulator, fast.accumulator);
+		EXPECT_EQ(slow.program_counter, fast.program_counter);
+		EXPECT_EQ(slow.error, fast.error);
+		EXPECT_EQ(slow.instruction_completed(), fast.instruction_completed());
+		EXPECT_EQ(slow_memory.storage, fast_memory.storage);
+	}
+
+	TEST(CPU, run_cycles_quiz) {
+		for (uint64_t max_cycles = 0; max_cycles < 150; ++max_cycles)
+			expect_run_cycles_matches_cycles(quiz_program(), max_cycles);
+	}
+
+	TEST(CPU, run_cycles_counter) {
+		for (const uint64_t max_cycles : { 1, 2, 1000, 1001, 1002 })
+			expect_run_cycles_matches_cycles(counter_program(), max_cycles);
 	}
 }
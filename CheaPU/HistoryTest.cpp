@@ -0,0 +1,158 @@
+#include "pch.h"
+
+#include "History.h"
+#include "CPU.h"
+#include "MemoryChip.h"
+#include "TestPrograms.h"
+
+#include <stdexcept>
+#include <vector>
+
+namespace CheaPU {
+
+	struct Moment {
+		CPUState cpu;
+		uint64_t memory;
+	};
+
+	/** The state after every cycle, cycle 0 included. */
+	static std::vector<Moment> reference_run(const MemoryChip& program, const uint64_t cycles) {
+		CPU c;
+		MemoryChip m = program;
+		std::vector<Moment> moments{ { c.save_state(), m.digest() } };
+		for (uint64_t i = 0; i < cycles && !c.error; ++i) {
+			c.cycle(m);
+			moments.push_back({ c.save_state(), m.digest() });
+		}
+		return moments;
+	}
+
+	static void expect_at(const std::vector<Moment>& reference, CPU& c, const MemoryChip& m, const History& history) {
+		ASSERT_LT(history.now(), reference.size());
+		EXPECT_EQ(reference[history.now()].cpu, c.save_state()) << "cycle " << history.now();
+		EXPECT_EQ(reference[history.now()].memory, m.digest()) << "cycle " << history.now();
+	}
+
+	TEST(History, step_back_one_at_a_time) {
+		const std::vector<Moment> reference = reference_run(quiz_program(), 1000);
+
+		CPU c;
+		MemoryChip m = quiz_program();
+		History history(c, m, 1024 * 1024, 10);
+		history.run(1000);
+		EXPECT_EQ(reference.size() - 1, history.now());
+		EXPECT_TRUE(c.error);
+
+		while (history.now() > 0) {
+			ASSERT_TRUE(history.step_back());
+			expect_at(reference, c, m, history);
+		}
+		EXPECT_FALSE(history.step_back());
+	}
+
+	TEST(History, jump_back_and_forth) {
+		for (uint32_t seed = 0; seed < 20; ++seed) {
+			const std::vector<Moment> reference = reference_run(random_program(seed), 500);
+
+			CPU c;
+			MemoryChip m = random_program(seed);
+			History history(c, m, 1024 * 1024, 16);
+
+			for (const uint64_t back : { 7, 100, 1, 33, 250 }) {
+				history.run(150);
+				if (history.step_back(std::min(back, history.now())))
+					expect_at(reference, c, m, history);
+			}
+		}
+	}
+
+	TEST(History, running_again_gives_the_same) {
+		CPU c;
+		MemoryChip m = counter_program();
+		History history(c, m, 1024 * 1024, 64);
+		history.run(1000);
+		const CPUState state = c.save_state();
+		const uint64_t digest = m.digest();
+
+		history.step_back(999);
+		history.run(999);
+		EXPECT_EQ(state, c.save_state());
+		EXPECT_EQ(digest, m.digest());
+	}
+
+	TEST(History, restores_the_stores) {
+		CPU c;
+		MemoryChip m = quiz_program();
+		History history(c, m);
+		history.run(1000);
+		EXPECT_EQ(10, m[0x15]);
+
+		history.step_back(history.now());
+		EXPECT_EQ(0, m[0x15]);
+		EXPECT_EQ(4, m[0x14]);
+	}
+
+	TEST(History, bounded_memory) {
+		constexpr size_t budget = 64 * 1024;
+		CPU c;
+		MemoryChip m = counter_program();
+		History history(c, m, budget, 256);
+		history.run(100000);
+
+		EXPECT_GE(budget, history.memory_used());
+		EXPECT_LT(0, history.oldest());
+		EXPECT_FALSE(history.step_back(history.now() - history.oldest() + 1));
+		EXPECT_TRUE(history.step_back(history.now() - history.oldest()));
+		EXPECT_EQ(history.oldest(), history.now());
+	}
+
+	TEST(History, the_undo_log_has_only_the_stores) {
+		// A cycle that stores nothing costs nothing: a long interval fits in a small budget.
+		const std::vector<Moment> reference = reference_run(quiz_program(), 1000);
+		CPU c;
+		MemoryChip m = quiz_program();
+		History history(c, m, 1024 * 1024, 1000000);
+		EXPECT_GE(1024 * 1024, history.memory_used());
+
+		history.run(1000);
+		for (const uint64_t back : { 1, 20, 3 }) {
+			ASSERT_TRUE(history.step_back(back));
+			expect_at(reference, c, m, history);
+		}
+		EXPECT_EQ(0, history.oldest());
+	}
+
+	TEST(History, only_microcode) {
+		CPU c(Engine::coroutines);
+		MemoryChip m;
+		EXPECT_THROW(History(c, m), std::invalid_argument);
+	}
+
+	TEST(History, changed_behind_its_back) {
+		CPU c;
+		MemoryChip m = counter_program();
+		History history(c, m, 1024 * 1024, 64);
+		history.run(100);
+
+		// Running forward from the checkpoint at 64, it halts instead of jumping back.
+		m[0x02] = to_word(Opcode::HALT);
+		EXPECT_FALSE(history.step_back(10));
+		EXPECT_GT(90, history.now());
+		EXPECT_TRUE(c.error);
+	}
+
+	TEST(History, budget_too_small) {
+		CPU c;
+		MemoryChip m;
+		EXPECT_THROW(History(c, m, 1024), std::invalid_argument);
+	}
+
+	TEST(History, stopped_cpu) {
+		CPU c;
+		MemoryChip m;
+		m[0] = to_word(Opcode::HALT);
+		History history(c, m);
+		EXPECT_EQ(2, history.run(100));
+		EXPECT_FALSE(history.step());
+	}
+}
@@ -0,0 +1,189 @@
+#include "pch.h"
+
+#include "ImageLoader.h"
+#include "MemoryChip.h"
+#include "TestPrograms.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace CheaPU {
+
+	/** A file in the temp directory, deleted at the end of the test. */
+	struct TempFile {
+		std::string path;
+
+		TempFile(const std::string& name, const std::string& content) :
+			path((std::filesystem::temp_directory_path() / name).string())
+		{
+			std::ofstream(path, std::ios::binary) << content;
+		}
+
+		~TempFile() {
+			std::remove(path.c_str());
+		}
+	};
+
+	TEST(ImageLoader, raw) {
+		const MemoryChip quiz = quiz_program();
+		const TempFile file("cheapu_test_raw.bin", std::string(quiz.storage.begin(), quiz.storage.begin() + 22));
+
+		MemoryChip m;
+		EXPECT_EQ(22, load_image(file.path, m));
+		EXPECT_EQ(quiz.storage, m.storage);
+	}
+
+	TEST(ImageLoader, raw_at_base) {
+		const TempFile file("cheapu_test_base.bin", "\x01\x02\x03");
+
+		MemoryChip m;
+		m[0x100] = 0xFF;
+		EXPECT_EQ(3, load_image(file.path, m, 0x101));
+		EXPECT_EQ(0xFF, m[0x100]);
+		EXPECT_EQ(1, m[0x101]);
+		EXPECT_EQ(3, m[0x103]);
+	}
+
+	TEST(ImageLoader, raw_too_big) {
+		const TempFile file("cheapu_test_big.bin", std::string(MemoryChip::size + 1, '\0'));
+
+		MemoryChip m;
+		EXPECT_THROW(load_image(file.path, m), std::runtime_error);
+		EXPECT_THROW(load_image(file.path, m, MemoryChip::size), std::runtime_error);
+	}
+
+	TEST(ImageLoader, empty_raw) {
+		const TempFile file("cheapu_test_empty.bin", "");
+		MemoryChip m;
+		EXPECT_EQ(0, load_image(file.path, m));
+	}
+
+	TEST(ImageLoader, missing_file) {
+		MemoryChip m;
+		EXPECT_THROW(load_image("there_is_no_such_file.bin", m), std::runtime_error);
+	}
+
+	TEST(ImageLoader, intel_hex) {
+		MemoryChip m;
+		const std::string text =
+			":03000000011503E4\r\n"
+			":02001000DEAD63\n"
+			":00000001FF\n"
+			":01002000FFE0\n";  // After the end: ignored.
+
+		EXPECT_EQ(5, parse_image(text, m, 0x100, ImageFormat::intel_hex));
+		EXPECT_EQ(0x01, m[0x100]);
+		EXPECT_EQ(0x15, m[0x101]);
+		EXPECT_EQ(0x03, m[0x102]);
+		EXPECT_EQ(0xDE, m[0x110]);
+		EXPECT_EQ(0xAD, m[0x111]);
+		EXPECT_EQ(0, m[0x120]);
+	}
+
+	TEST(ImageLoader, intel_hex_extended_address) {
+		MemoryChip m;
+		const std::string text =
+			":020000020100FB\n"  // Segment 0x100: 0x1000.
+			":0100050042B8\n";
+		EXPECT_EQ(1, parse_image(text, m, 0, ImageFormat::intel_hex));
+		EXPECT_EQ(0x42, m[0x1005]);
+
+		const std::string too_far =
+			":020000040001F9\n"  // 64K up.
+			":0100050042B8\n";
+		EXPECT_THROW(parse_image(too_far, m, 0, ImageFormat::intel_hex), std::runtime_error);
+	}
+
+	TEST(ImageLoader, intel_hex_broken) {
+		MemoryChip m;
+		EXPECT_THROW(parse_image(":0300000001150307\n", m, 0, ImageFormat::intel_hex), std::runtime_error);  // Checksum.
+		EXPECT_THROW(parse_image(":03000000011503\n", m, 0, ImageFormat::intel_hex), std::runtime_error);    // Short.
+		EXPECT_THROW(parse_image("0300000001150306\n", m, 0, ImageFormat::intel_hex), std::runtime_error);   // No ':'.
+		EXPECT_THROW(parse_image(":03000000011G0306\n", m, 0, ImageFormat::intel_hex), std::runtime_error);  // Not hex.
+		EXPECT_THROW(parse_image(":00000002FE\n", m, 0, ImageFormat::intel_hex), std::runtime_error);        // Segment without the address.
+		EXPECT_THROW(parse_image(":00000004FC\n", m, 0, ImageFormat::intel_hex), std::runtime_error);        // Same, linear.
+	}
+
+	TEST(ImageLoader, intel_hex_all_or_nothing) {
+		MemoryChip m;
+		const std::string text =
+			":03000000011503E4\n"
+			":0300000001150307\n";  // Bad checksum, after a good record.
+		EXPECT_THROW(parse_image(text, m, 0, ImageFormat::intel_hex), std::runtime_error);
+		EXPECT_EQ(0, m[0x00]);
+		EXPECT_EQ(0, m[0x01]);
+	}
+
+	TEST(ImageLoader, hex_text) {
+		MemoryChip m;
+		const std::string text =
+			"; The counter from the README.\n"
+			"03 04   # ADD 0x04\n"
+			"0x05 0  # JMP 0x00\n"
+			"1\n";
+
+		EXPECT_EQ(5, parse_image(text, m, 0, ImageFormat::hex_text));
+		EXPECT_EQ(counter_program().storage, m.storage);
+
+		EXPECT_THROW(parse_image("123", m, 0, ImageFormat::hex_text), std::runtime_error);
+		EXPECT_THROW(parse_image("zz", m, 0, ImageFormat::hex_text), std::runtime_error);
+	}
+
+	TEST(ImageLoader, guess_from_extension) {
+		const TempFile hex("cheapu_test.HEX", ":0100000003FC\n");
+		const TempFile text("cheapu_test.txt", "07");
+
+		MemoryChip m;
+		EXPECT_EQ(1, load_image(hex.path, m));
+		EXPECT_EQ(3, m[0]);
+		EXPECT_EQ(1, load_image(text.path, m));
+		EXPECT_EQ(7, m[0]);
+		EXPECT_EQ(2, load_image(text.path, m, 0, ImageFormat::raw));
+		EXPECT_EQ('0', m[0]);
+	}
+
+	TEST(ImageLoader, loading_code_changes_it) {
+		MemoryChip m;
+		m.watch_code(0, 4);
+		const uint32_t version = m.code_version;
+
+		parse_image("01", m, 8, ImageFormat::hex_text);
+		EXPECT_EQ(version, m.code_version);
+		parse_image("01", m, 3, ImageFormat::hex_text);
+		EXPECT_NE(version, m.code_version);
+	}
+
+	TEST(ImageLoader, write_and_read_back) {
+		MemoryChip original = quiz_program();
+		original[0x30] = 0xAB;  // More than one record.
+
+		for (const ImageFormat format : { ImageFormat::raw, ImageFormat::intel_hex, ImageFormat::hex_text }) {
+			std::stringstream image;
+			write_image(image, original, 0, 0x31, format);
+
+			MemoryChip copy;
+			if (format == ImageFormat::raw) {
+				const std::string bytes = image.str();
+				ASSERT_EQ(0x31, bytes.size());
+				copy.load(0, reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size());
+			}
+			else
+				EXPECT_EQ(0x31, parse_image(image.str(), copy, 0, format));
+			EXPECT_EQ(original.storage, copy.storage);
+		}
+	}
+
+	TEST(ImageLoader, write_intel_hex) {
+		const MemoryChip m = counter_program();
+		std::stringstream image;
+		write_image(image, m, 0, 5, ImageFormat::intel_hex);
+		EXPECT_EQ(":050000000304050001EE\n:00000001FF\n", image.str());
+
+		EXPECT_THROW(write_image(image, m, 0, MemoryChip::size + 1, ImageFormat::raw), std::invalid_argument);
+		EXPECT_THROW(write_image(image, m, 0, 5, ImageFormat::guess), std::invalid_argument);
+	}
+}
@@ -0,0 +1,119 @@
+#include "pch.h"
+
+#include "InfiniteLoopDetector.h"
+#include "CPU.h"
+#include "MemoryChip.h"
+#include "TestPrograms.h"
+
+namespace CheaPU {
+
+	TEST(StateHash, follows_the_writes) {
+		MemoryChip m = random_program(1);
+		StateHash hash(m);
+
+		for (const size_t address : { 0, 7, 200, 255, 8000 }) {
+			const uint8_t old_value = m[address];
+			m[address] = old_value + 1;
+			hash.write(address, old_value, m[address]);
+			EXPECT_EQ(StateHash(m).memory(), hash.memory());
+		}
+
+		// The zeroes hash to nothing.
+		EXPECT_EQ(0, StateHash(MemoryChip()).memory());
+	}
+
+	TEST(StateHash, cpu_counts) {
+		const MemoryChip m = quiz_program();
+		const StateHash hash(m);
+
+		CPU c;
+		const uint64_t start = hash.of(c.save_state());
+		c.accumulator = 1;
+		EXPECT_NE(start, hash.of(c.save_state()));
+		EXPECT_NE(hash.memory(), start);
+	}
+
+	TEST(InfiniteLoopDetector, counter) {
+		CPU c;
+		MemoryChip m = counter_program();
+		InfiniteLoopDetector detector;
+		const uint64_t cycles = detector.run(c, m, 1000000);
+
+		// ADD and JMP, for all the 256 values of the accumulator.
+		EXPECT_TRUE(detector.looping());
+		EXPECT_EQ(2 * 256, detector.period_instructions);
+		EXPECT_EQ(6 * 256, detector.period_cycles);
+		EXPECT_GT(1000000u, cycles);
+	}
+
+	TEST(InfiniteLoopDetector, loops_that_store) {
+		// The counter, with the accumulator stored in 0x10 every time around: no idle loop for CPU::run(),
+		// but the memory comes back to the same content.
+		CPU c;
+		MemoryChip m;
+		const uint8_t code[] = {
+			to_word(Opcode::ADD), 0x06,
+			to_word(Opcode::ST), 0x10,
+			to_word(Opcode::JMP), 0x00,
+			1
+		};
+		for (uint8_t i = 0; i < sizeof(code); ++i)
+			m[i] = code[i];
+
+		InfiniteLoopDetector detector;
+		detector.run(c, m, 1000000);
+
+		EXPECT_TRUE(detector.looping());
+		EXPECT_EQ(3 * 256, detector.period_instructions);
+	}
+
+	TEST(InfiniteLoopDetector, programs_that_halt) {
+		CPU c;
+		MemoryChip m = quiz_program();
+		InfiniteLoopDetector detector;
+
+		EXPECT_EQ(95, detector.run(c, m, 1000));
+		EXPECT_FALSE(detector.looping());
+		EXPECT_EQ(0, detector.period_cycles);
+		EXPECT_EQ(10, m[0x15]);
+	}
+
+	TEST(InfiniteLoopDetector, same_as_run_cycles) {
+		for (uint32_t seed = 0; seed < 50; ++seed) {
+			for (const uint64_t max_cycles : { 1, 2, 100, 1001, 100000 }) {
+				CPU detected;
+				MemoryChip detected_memory = random_program(seed);
+				InfiniteLoopDetector detector;
+				const uint64_t cycles = detector.run(detected, detected_memory, max_cycles);
+
+				// Up to where it stopped, it is the same as any other run.
+				CPU plain;
+				MemoryChip plain_memory = random_program(seed);
+				EXPECT_EQ(plain.run_cycles(plain_memory, cycles), cycles);
+				EXPECT_EQ(plain.save_state(), detected.save_state());
+				EXPECT_EQ(plain_memory.storage, detected_memory.storage);
+
+				if (detector.looping()) {
+					// Once around the loop and it is back in the same place.
+					EXPECT_GT(max_cycles, cycles);
+					plain.run(plain_memory, detector.period_instructions);
+					EXPECT_EQ(detected.save_state(), plain.save_state());
+					EXPECT_EQ(detected_memory.storage, plain_memory.storage);
+				}
+				else
+					EXPECT_TRUE(cycles == max_cycles || detected.error);
+			}
+		}
+	}
+
+	TEST(InfiniteLoopDetector, starts_in_the_middle_of_an_instruction) {
+		CPU c;
+		MemoryChip m = counter_program();
+		c.run_cycles(m, 1);
+
+		InfiniteLoopDetector detector;
+		detector.run(c, m, 1000000);
+		EXPECT_EQ(2 * 256, detector.period_instructions);
+	}
+
+}
@@ -0,0 +1,91 @@
+#include "pch.h"
+
+#include "CPU.h"
+#include "JitCompiler.h"
+#include "MemoryChip.h"
+#include "TestPrograms.h"
+
+namespace CheaPU {
+
+	/** Runs the program with the CPU alone and with the native code, then compares everything. */
+	static void expect_same_as_cpu(JitCompiler& jit, const MemoryChip& program, const uint64_t instructions) {
+		CPU plain;
+		MemoryChip plain_memory = program;
+		const uint64_t plain_cycles = plain.run(plain_memory, instructions);
+
+		CPU native;
+		MemoryChip native_memory = program;
+		const uint64_t native_cycles = jit.run(native, native_memory, instructions);
+
+		EXPECT_EQ(plain_cycles, native_cycles);
+		EXPECT_EQ(plain.accumulator, native.accumulator);
+		EXPECT_EQ(plain.program_counter, native.program_counter);
+		EXPECT_EQ(plain.error, native.error);
+		EXPECT_EQ(plain.overflow(), native.overflow());
+		EXPECT_EQ(plain.zero(), native.zero());
+		EXPECT_EQ(plain_memory.storage, native_memory.storage);
+	}
+
+	TEST(JitCompiler, counter) {
+		JitCompiler jit;
+		for (const uint64_t instructions : { 0, 1, 2, 3, 1000, 1001, 1000000 })
+			expect_same_as_cpu(jit, counter_program(), instructions);
+	}
+
+	TEST(JitCompiler, quiz) {
+		JitCompiler jit;
+		for (uint64_t instructions = 0; instructions < 50; ++instructions)
+			expect_same_as_cpu(jit, quiz_program(), instructions);
+	}
+
+	TEST(JitCompiler, random_programs) {
+		JitCompiler jit;
+		for (uint32_t seed = 0; seed < 500; ++seed)
+			for (const uint64_t instructions : { 7, 5000 })
+				expect_same_as_cpu(jit, random_program(seed), instructions);
+	}
+
+	TEST(JitCompiler, code_rewrites_its_own_block) {
+		MemoryChip m;
+		m[0x00] = to_word(Opcode::LD);
+		m[0x01] = 0x20;
+		m[0x02] = to_word(Opcode::ST);
+		m[0x03] = 0x04;
+		m[0x04] = to_word(Opcode::NOP);  // Becomes a HALT.
+		m[0x05] = to_word(Opcode::JMP);
+		m[0x06] = 0x00;
+		m[0x20] = to_word(Opcode::HALT);
+
+		JitCompiler jit;
+		expect_same_as_cpu(jit, m, 100);
+	}
+
+	TEST(JitCompiler, code_rewrites_a_linked_block) {
+		MemoryChip m;
+		m[0x00] = to_word(Opcode::ADD);   // Counts the loops in the accumulator.
+		m[0x01] = 0x21;
+		m[0x02] = to_word(Opcode::JMP);
+		m[0x03] = 0x04;
+		m[0x04] = to_word(Opcode::ST);    // After 3 loops, it writes 3 over the JMP 0x04: a HALT.
+		m[0x05] = 0x02;
+		m[0x06] = to_word(Opcode::JMP);
+		m[0x07] = 0x00;
+		m[0x21] = 1;
+
+		JitCompiler jit;
+		expect_same_as_cpu(jit, m, 100);
+	}
+
+	TEST(JitCompiler, front_panel_changes_the_code) {
+		CPU c;
+		MemoryChip m = counter_program();
+		JitCompiler jit;
+
+		jit.run(c, m, 10);
+		m[0x00] = to_word(Opcode::HALT);
+		jit.run(c, m, 10);
+
+		EXPECT_EQ(1, c.error);
+		EXPECT_EQ(5, c.accumulator);
+	}
+}
@@ -14,5 +14,35 @@ namespace CheaPU {
 		m[0x45] = 45;
 		EXPECT_EQ(45, m[0x45]);
 	}
-}
 
+	TEST(CPU, write_to_code) {
+		MemoryChip m;
+		m.watch_code(0x10, 0x12);
+		const uint32_t version = m.code_version;
+
+		m.write(0x12, 1);
+		EXPECT_EQ(version, m.code_version);
+
+		m.write(0x11, 1);
+		EXPECT_NE(version, m.code_version);
+	}
+
+	TEST(CPU, forget_code) {
+		MemoryChip m;
+		m.watch_code(0x10, 0x12);
+		m.forget_code();
+		const uint32_t version = m.code_version;
+
+		m[0x10] = 1;
+		EXPECT_EQ(version, m.code_version);
+	}
+
+	TEST(CPU, digest) {
+		MemoryChip a;
+		MemoryChip b;
+		EXPECT_EQ(a.digest(), b.digest());
+
+		b[MemoryChip::size - 1] = 1;
+		EXPECT_NE(a.digest(), b.digest());
+	}
+}
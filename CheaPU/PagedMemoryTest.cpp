@@ -0,0 +1,88 @@
+#include "pch.h"
+
+#include "PagedMemoryChip.h"
+#include "CPU.h"
+#include "MemoryChip.h"
+#include "TestPrograms.h"
+
+namespace CheaPU {
+
+	TEST(PagedMemory, creation) {
+		PagedMemoryChip m;
+		EXPECT_EQ(0, m.read(0));
+		EXPECT_EQ(0, m.read(PagedMemoryChip::size - 1));
+		EXPECT_EQ(0, m.private_pages());
+		EXPECT_EQ(MemoryChip().digest(), m.digest());
+	}
+
+	TEST(PagedMemory, read_and_write) {
+		PagedMemoryChip m;
+		m[0x45] = 45;
+		m.write(0x1234, 12);
+		EXPECT_EQ(45, m.read(0x45));
+		EXPECT_EQ(12, m[0x1234]);
+		EXPECT_EQ(2, m.private_pages());
+	}
+
+	TEST(PagedMemory, fork_shares_until_written) {
+		PagedMemoryChip original(quiz_program());
+		EXPECT_EQ(PagedMemoryChip::page_count, original.private_pages());
+
+		PagedMemoryChip fork = original;
+		EXPECT_EQ(0, original.private_pages());
+		EXPECT_EQ(0, fork.private_pages());
+
+		fork.write(0x15, 99);
+		EXPECT_EQ(1, fork.private_pages());
+		EXPECT_EQ(1, original.private_pages());  // The only one left with the old page.
+		EXPECT_EQ(99, fork.read(0x15));
+		EXPECT_EQ(0, original.read(0x15));
+	}
+
+	TEST(PagedMemory, copy_to) {
+		const MemoryChip program = random_program(3);
+		MemoryChip copy;
+		copy.watch_code(0, 1);
+		const uint32_t version = copy.code_version;
+
+		PagedMemoryChip(program).copy_to(copy);
+		EXPECT_EQ(program.storage, copy.storage);
+		EXPECT_NE(version, copy.code_version);
+	}
+
+	TEST(PagedMemory, cpu_runs_the_same) {
+		for (uint32_t seed = 0; seed < 50; ++seed)
+			for (const Engine engine : { Engine::microcode, Engine::coroutines }) {
+				CPU flat(engine);
+				MemoryChip flat_memory = random_program(seed);
+				CPU paged(engine);
+				PagedMemoryChip paged_memory(flat_memory);
+
+				for (int i = 0; i < 100; ++i) {
+					flat.cycle(flat_memory);
+					paged.cycle(paged_memory);
+				}
+				EXPECT_EQ(flat.run_cycles(flat_memory, 1000), paged.run_cycles(paged_memory, 1000));
+
+				EXPECT_EQ(flat.save_state(), paged.save_state());
+				EXPECT_EQ(flat_memory.digest(), paged_memory.digest());
+			}
+	}
+
+	TEST(PagedMemory, forks_run_apart) {
+		CPU c;
+		PagedMemoryChip memory{ counter_program() };
+		c.run_cycles(memory, 30);
+
+		CPU forked_cpu;
+		forked_cpu.restore_state(c.save_state());
+		PagedMemoryChip forked_memory = memory;
+		forked_memory.write(0x04, 2);  // Counts by 2.
+
+		c.run(memory, 10);
+		forked_cpu.run(forked_memory, 10);
+		EXPECT_EQ(10, c.accumulator);
+		EXPECT_EQ(15, forked_cpu.accumulator);
+		EXPECT_EQ(1, memory.read(0x04));
+	}
+}
@@ -0,0 +1,72 @@
+#include "pch.h"
+
+#include "CPU.h"
+#include "MemoryChip.h"
+#include "TestPrograms.h"
+
+// The counters exist only in the builds that ask for them.
+#ifdef CHEAPU_PERFORMANCE_COUNTERS
+
+namespace CheaPU {
+
+	TEST(PerformanceCounters, quiz) {
+		CPU c;
+		MemoryChip m = quiz_program();
+		const uint64_t cycles = c.run_until_halt(m);
+
+		const PerformanceCounters& counters = c.counters;
+		EXPECT_EQ(cycles, counters.cycles);
+		EXPECT_EQ(33, counters.instructions);
+		EXPECT_EQ(9, counters.opcodes[to_word(Opcode::LD)]);
+		EXPECT_EQ(8, counters.opcodes[to_word(Opcode::ST)]);
+		EXPECT_EQ(4, counters.opcodes[to_word(Opcode::ADD)]);
+		EXPECT_EQ(4, counters.opcodes[to_word(Opcode::SUB)]);
+		EXPECT_EQ(4, counters.opcodes[to_word(Opcode::JZE)]);
+		EXPECT_EQ(3, counters.opcodes[to_word(Opcode::JMP)]);
+		EXPECT_EQ(1, counters.opcodes[to_word(Opcode::HALT)]);
+		EXPECT_EQ(0, counters.opcodes[to_word(Opcode::NOP)]);
+		EXPECT_EQ(0, counters.illegal_opcodes);
+		EXPECT_EQ(1, counters.jze_taken);
+		EXPECT_EQ(3, counters.jze_not_taken);
+		EXPECT_EQ(79, counters.memory_reads);
+		EXPECT_EQ(8, counters.memory_writes);
+		EXPECT_EQ(cycles - counters.instructions, counters.stall_cycles);
+	}
+
+	TEST(PerformanceCounters, cycle_and_run_agree) {
+		for (const Engine engine : { Engine::microcode, Engine::coroutines }) {
+			for (uint32_t seed = 0; seed < 50; ++seed) {
+				CPU fast(engine);
+				MemoryChip fast_memory = random_program(seed);
+				fast.cycle(fast_memory);  // Leave something half-done for run().
+				const uint64_t cycles = fast.run(fast_memory, 500) + 1;
+
+				CPU slow(engine);
+				MemoryChip slow_memory = random_program(seed);
+				for (uint64_t i = 0; i < cycles; ++i)
+					slow.cycle(slow_memory);
+
+				EXPECT_EQ(slow.counters.cycles, fast.counters.cycles);
+				EXPECT_EQ(slow.counters.instructions, fast.counters.instructions);
+				EXPECT_EQ(slow.counters.opcodes, fast.counters.opcodes);
+				EXPECT_EQ(slow.counters.illegal_opcodes, fast.counters.illegal_opcodes);
+				EXPECT_EQ(slow.counters.jze_taken, fast.counters.jze_taken);
+				EXPECT_EQ(slow.counters.memory_reads, fast.counters.memory_reads);
+				EXPECT_EQ(slow.counters.memory_writes, fast.counters.memory_writes);
+				EXPECT_EQ(slow.counters.stall_cycles, fast.counters.stall_cycles);
+			}
+		}
+	}
+
+	TEST(PerformanceCounters, reset) {
+		CPU c;
+		MemoryChip m = counter_program();
+		c.run(m, 10);
+		c.reset();
+
+		EXPECT_EQ(0, c.counters.cycles);
+		EXPECT_EQ(0, c.counters.instructions);
+	}
+}
+
+#endif
@@ -0,0 +1,100 @@
+#include "pch.h"
+
+#include "Profiler.h"
+#include "CPU.h"
+#include "MemoryChip.h"
+#include "TestPrograms.h"
+
+#include <numeric>
+#include <sstream>
+
+namespace CheaPU {
+
+	TEST(Profiler, same_as_run_cycles) {
+		for (uint32_t seed = 0; seed < 50; ++seed) {
+			for (const uint64_t max_cycles : { 1, 2, 100, 1001 }) {
+				CPU plain;
+				MemoryChip plain_memory = random_program(seed);
+				const uint64_t plain_cycles = plain.run_cycles(plain_memory, max_cycles);
+
+				CPU profiled;
+				MemoryChip profiled_memory = random_program(seed);
+				Profiler profiler;
+				const uint64_t profiled_cycles = profiler.run(profiled, profiled_memory, max_cycles);
+
+				EXPECT_EQ(plain_cycles, profiled_cycles);
+				EXPECT_EQ(plain.program_counter, profiled.program_counter);
+				EXPECT_EQ(plain.accumulator, profiled.accumulator);
+				EXPECT_EQ(plain.error, profiled.error);
+				EXPECT_EQ(plain_memory.storage, profiled_memory.storage);
+				EXPECT_EQ(profiled_cycles, std::accumulate(profiler.cycles.begin(), profiler.cycles.end(), uint64_t(0)));
+			}
+		}
+	}
+
+	TEST(Profiler, quiz) {
+		CPU c;
+		MemoryChip m = quiz_program();
+		Profiler profiler;
+		profiler.run(c, m, 1000);
+
+		EXPECT_EQ(4 * 3, profiler.cycles[0x00]);  // LD, once per loop.
+		EXPECT_EQ(4, profiler.instructions[0x0C]);  // JZE
+		EXPECT_EQ(3 * 2 + 3, profiler.cycles[0x0C]);  // Not taken 3 times, then taken.
+		EXPECT_EQ(2, profiler.cycles[0x12]);  // HALT
+
+		const std::vector<Profiler::Loop> loops = profiler.loops();
+		ASSERT_EQ(1, loops.size());
+		EXPECT_EQ(0x00, loops[0].header);
+		EXPECT_EQ(0x0E, loops[0].back_edge);
+		EXPECT_EQ(3, loops[0].iterations);
+		EXPECT_EQ(95 - 3 - 2, loops[0].cycles);  // All but the final LD and HALT.
+	}
+
+	TEST(Profiler, reports) {
+		CPU c;
+		MemoryChip m = counter_program();
+		Profiler profiler;
+		profiler.run(c, m, 600);
+
+		std::stringstream report;
+		profiler.report(report, m);
+		EXPECT_NE(std::string::npos, report.str().find("ADD 0x04"));
+
+		std::stringstream folded;
+		profiler.folded_stacks(folded, m);
+		EXPECT_EQ("program;loop 0x00-0x02;0x00 ADD 0x04 300\n"
+			      "program;loop 0x00-0x02;0x02 JMP 0x00 300\n", folded.str());
+	}
+
+	TEST(Profiler, reports_with_symbols) {
+		CPU c;
+		MemoryChip m = counter_program();
+		Profiler profiler;
+		profiler.run(c, m, 600);
+
+		SymbolMap symbols;
+		symbols.labels["loop"] = 0x00;
+		symbols.labels["one"] = 0x04;
+
+		std::stringstream report;
+		profiler.report(report, m, symbols);
+		EXPECT_NE(std::string::npos, report.str().find("ADD one"));
+
+		std::stringstream folded;
+		profiler.folded_stacks(folded, m, symbols);
+		EXPECT_EQ("program;loop loop-0x02;0x00 ADD one 300\n"
+			      "program;loop loop-0x02;0x02 JMP loop 300\n", folded.str());
+	}
+
+	TEST(Profiler, clear) {
+		CPU c;
+		MemoryChip m = counter_program();
+		Profiler profiler;
+		profiler.run(c, m, 600);
+		profiler.clear();
+
+		EXPECT_EQ(0, profiler.cycles[0]);
+		EXPECT_TRUE(profiler.loops().empty());
+	}
+}
@@ -0,0 +1,175 @@
+#include "pch.h"
+
+#include "ResultCache.h"
+#include "CPU.h"
+#include "MemoryChip.h"
+#include "TestPrograms.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+namespace CheaPU {
+
+	/** The two files of a cache in the temp directory, deleted at the start and at the end of the test. */
+	struct TempCache {
+		std::string path;
+
+		explicit TempCache(const std::string& name) :
+			path((std::filesystem::temp_directory_path() / name).string())
+		{
+			remove();
+		}
+
+		~TempCache() {
+			remove();
+		}
+
+		void remove() {
+			std::remove((path + ".data").c_str());
+			std::remove((path + ".index").c_str());
+		}
+	};
+
+	TEST(ResultCache, same_as_run_cycles) {
+		const TempCache file("cheapu_test_cache_same");
+		ResultCache cache(file.path);
+
+		for (uint32_t seed = 0; seed < 20; ++seed) {
+			for (const uint64_t max_cycles : { 1, 2, 100, 1001 }) {
+				CPU plain;
+				MemoryChip plain_memory = random_program(seed);
+				const uint64_t plain_cycles = plain.run_cycles(plain_memory, max_cycles);
+
+				for (const bool hit : { false, true }) {
+					CPU cached;
+					MemoryChip cached_memory = random_program(seed);
+					EXPECT_EQ(plain_cycles, cache.run(cached, cached_memory, max_cycles));
+					EXPECT_EQ(hit, cache.last_was_hit);
+					EXPECT_EQ(plain.save_state(), cached.save_state());
+					EXPECT_EQ(plain_memory.storage, cached_memory.storage);
+				}
+			}
+		}
+
+		EXPECT_EQ(80, cache.size());
+		EXPECT_EQ(80, cache.hits());
+		EXPECT_EQ(80, cache.misses());
+		EXPECT_DOUBLE_EQ(0.5, cache.hit_rate());
+	}
+
+	TEST(ResultCache, the_key_is_the_whole_run) {
+		const MemoryChip quiz = quiz_program();
+		const Hash128 reference = ResultCache::key(CPU().save_state(), quiz, 1000);
+		EXPECT_EQ(reference, ResultCache::key(CPU().save_state(), quiz_program(), 1000));
+
+		EXPECT_NE(reference, ResultCache::key(CPU().save_state(), quiz, 1001));
+
+		CPUState state = CPU().save_state();
+		state.accumulator = 1;
+		EXPECT_NE(reference, ResultCache::key(state, quiz, 1000));
+
+		MemoryChip changed = quiz;
+		changed[MemoryChip::size - 1] = 1;  // Even where ST can't go.
+		EXPECT_NE(reference, ResultCache::key(CPU().save_state(), changed, 1000));
+	}
+
+	TEST(ResultCache, survives_the_program) {
+		const TempCache file("cheapu_test_cache_persist");
+		{
+			ResultCache cache(file.path);
+			CPU c;
+			MemoryChip m = quiz_program();
+			cache.run(c, m, 1000);
+		}
+
+		ResultCache cache(file.path);
+		CPU c;
+		MemoryChip m = quiz_program();
+		EXPECT_EQ(95, cache.run(c, m, 1000));
+		EXPECT_TRUE(cache.last_was_hit);
+		EXPECT_EQ(10, m[0x15]);
+		EXPECT_EQ(1, cache.hits());
+		EXPECT_EQ(1, cache.misses());
+	}
+
+	TEST(ResultCache, the_index_is_built_again) {
+		const TempCache file("cheapu_test_cache_index");
+		{
+			ResultCache cache(file.path);
+			CPU c;
+			MemoryChip m = counter_program();
+			cache.run(c, m, 100);
+		}
+
+		std::ofstream(file.path + ".index", std::ios::binary) << "garbage";
+
+		ResultCache cache(file.path);
+		EXPECT_EQ(1, cache.size());
+		CPU c;
+		MemoryChip m = counter_program();
+		cache.run(c, m, 100);
+		EXPECT_TRUE(cache.last_was_hit);
+	}
+
+	TEST(ResultCache, half_records_are_dropped) {
+		const TempCache file("cheapu_test_cache_torn");
+		{
+			ResultCache cache(file.path);
+			CPU c;
+			MemoryChip m = counter_program();
+			cache.run(c, m, 100);
+		}
+
+		std::ofstream(file.path + ".data", std::ios::binary | std::ios::app) << "half a record";
+
+		ResultCache cache(file.path);
+		EXPECT_EQ(1, cache.size());
+		CPU c;
+		MemoryChip m = counter_program();
+		cache.run(c, m, 200);
+		EXPECT_FALSE(cache.last_was_hit);
+		EXPECT_EQ(2, cache.size());
+	}
+
+	TEST(ResultCache, grows) {
+		const TempCache file("cheapu_test_cache_grow");
+		ResultCache cache(file.path);
+
+		// More than half of the initial index.
+		for (const bool hit : { false, true }) {
+			for (uint64_t cycles = 1; cycles <= 1500; ++cycles) {
+				CPU c;
+				MemoryChip m = counter_program();
+				cache.run(c, m, cycles);
+				ASSERT_EQ(hit, cache.last_was_hit) << cycles;
+			}
+		}
+		EXPECT_EQ(1500, cache.size());
+	}
+
+	TEST(ResultCache, coroutines_half_way) {
+		const TempCache file("cheapu_test_cache_coroutines");
+		ResultCache cache(file.path);
+
+		// Stops in the middle of an ADD: can't be saved.
+		CPU c(Engine::coroutines);
+		MemoryChip m = counter_program();
+		EXPECT_EQ(1, cache.run(c, m, 1));
+		EXPECT_EQ(0, cache.size());
+		EXPECT_FALSE(c.instruction_completed());
+
+		// Nor started from there.
+		EXPECT_EQ(100, cache.run(c, m, 100));
+		EXPECT_EQ(0, cache.size());
+	}
+
+	TEST(ResultCache, not_a_cache) {
+		const TempCache file("cheapu_test_cache_bad");
+		std::ofstream(file.path + ".data", std::ios::binary) << "CHEAPUTR not a cache";
+
+		EXPECT_THROW(ResultCache cache(file.path), std::runtime_error);
+	}
+}
@@ -0,0 +1,154 @@
+#include "pch.h"
+
+#include "Snapshot.h"
+#include "CPU.h"
+#include "MemoryChip.h"
+#include "TestPrograms.h"
+
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace CheaPU {
+
+	/** Runs the program cycle by cycle, saves and restores in every possible place
+	    (mid-instruction included), then checks that it ends up where the uninterrupted run does. */
+	static void check_resume_everywhere(const MemoryChip& program, const Engine engine, const uint64_t cycles) {
+		CPU reference(engine);
+		MemoryChip reference_memory = program;
+		reference.run_cycles(reference_memory, cycles);
+
+		for (uint64_t stop = 0; stop < cycles; ++stop) {
+			CPU c(engine);
+			MemoryChip m = program;
+			for (uint64_t i = 0; i < stop; ++i)
+				c.cycle(m);
+
+			if (engine == Engine::coroutines && !c.instruction_completed())
+				continue;  // Can't do it.
+
+			const Snapshot snapshot = take_snapshot(c, m);
+
+			// Trash everything, then go back.
+			c.run_cycles(m, 17);
+			m[0] = 0xFF;
+			restore_snapshot(snapshot, c, m);
+
+			for (uint64_t i = stop; i < cycles; ++i)
+				c.cycle(m);
+
+			ASSERT_EQ(reference.save_state(), c.save_state()) << "stopped at " << stop;
+			ASSERT_EQ(reference_memory.storage, m.storage) << "stopped at " << stop;
+		}
+	}
+
+	TEST(Snapshot, resume_quiz) {
+		check_resume_everywhere(quiz_program(), Engine::microcode, 100);
+	}
+
+	TEST(Snapshot, resume_quiz_coroutines) {
+		check_resume_everywhere(quiz_program(), Engine::coroutines, 100);
+	}
+
+	TEST(Snapshot, resume_random_programs) {
+		for (uint32_t seed = 0; seed < 20; ++seed)
+			check_resume_everywhere(random_program(seed), Engine::microcode, 60);
+	}
+
+	TEST(Snapshot, state_of_instruction_in_progress) {
+		CPU c;
+		MemoryChip m = counter_program();
+		c.cycle(m);  // Fetch the ADD.
+		c.cycle(m);  // Read the operand.
+
+		const CPUState state = c.save_state();
+		EXPECT_EQ(0, state.program_counter);
+		EXPECT_NE(0, state.micro_pc);
+		EXPECT_EQ(0x04, state.operand);
+	}
+
+	TEST(Snapshot, coroutine_in_progress_can_not_be_saved) {
+		CPU c(Engine::coroutines);
+		MemoryChip m = counter_program();
+		c.cycle(m);
+
+		EXPECT_THROW(c.save_state(), std::logic_error);
+	}
+
+	TEST(Snapshot, coroutine_in_progress_can_not_be_restored) {
+		CPU saving;
+		MemoryChip m = counter_program();
+		saving.cycle(m);
+		const CPUState state = saving.save_state();
+
+		CPU restoring(Engine::coroutines);
+		EXPECT_THROW(restoring.restore_state(state), std::logic_error);
+	}
+
+	TEST(Snapshot, not_a_state) {
+		CPU c;
+		CPUState state = c.save_state();
+		state.micro_pc = 0xFF;
+		EXPECT_THROW(c.restore_state(state), std::invalid_argument);
+
+		for (uint8_t CPUState::* const flag : { &CPUState::overflow, &CPUState::zero, &CPUState::error }) {
+			CPUState bad_flag = c.save_state();
+			bad_flag.*flag = 2;
+			EXPECT_THROW(c.restore_state(bad_flag), std::invalid_argument);
+		}
+	}
+
+	TEST(Snapshot, corrupted_flag) {
+		CPU c;
+		MemoryChip m = quiz_program();
+		std::stringstream stream;
+		write_snapshot(stream, take_snapshot(c, m));
+
+		// Magic, version, then program counter, accumulator and overflow.
+		std::string bytes = stream.str();
+		bytes[8 + 1 + 2] = 7;
+		std::stringstream corrupted(bytes);
+		EXPECT_THROW(read_snapshot(corrupted), std::invalid_argument);
+	}
+
+	TEST(Snapshot, restore_changes_the_code) {
+		CPU c;
+		MemoryChip m = counter_program();
+		m.watch_code(0, 4);
+		const Snapshot snapshot = take_snapshot(c, m);
+		const uint32_t version = m.code_version;
+
+		restore_snapshot(snapshot, c, m);
+		EXPECT_NE(version, m.code_version);
+	}
+
+	TEST(Snapshot, stream) {
+		CPU c;
+		MemoryChip m = quiz_program();
+		c.run_cycles(m, 41);  // In the middle of something.
+		const Snapshot saved = take_snapshot(c, m);
+
+		std::stringstream stream;
+		write_snapshot(stream, saved);
+		const Snapshot loaded = read_snapshot(stream);
+
+		EXPECT_EQ(saved.cpu, loaded.cpu);
+		EXPECT_EQ(saved.memory, loaded.memory);
+	}
+
+	TEST(Snapshot, not_a_snapshot) {
+		std::stringstream stream("Hello, world!");
+		EXPECT_THROW(read_snapshot(stream), std::runtime_error);
+	}
+
+	TEST(Snapshot, truncated) {
+		CPU c;
+		std::stringstream stream;
+		write_snapshot(stream, take_snapshot(c, MemoryChip()));
+
+		std::string bytes = stream.str();
+		bytes.pop_back();
+		std::stringstream truncated(bytes);
+		EXPECT_THROW(read_snapshot(truncated), std::runtime_error);
+	}
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "CPU.h"
+#include "ExamplePrograms.h"
+#include "MemoryChip.h"
+
+#include <cstdint>
+#include <random>
+
+namespace CheaPU {
+
+	/** Garbage in the 1st 256 bytes, mostly valid opcodes (and the odd illegal one).
+	    Whatever it does, all the ways to run it must agree. */
+	inline MemoryChip random_program(const uint32_t seed) {
+		std::mt19937 generator(seed);
+		std::uniform_int_distribution<int> opcode(0, 8);
+		std::uniform_int_distribution<int> byte(0, 255);
+
+		MemoryChip m;
+		for (size_t i = 0; i < 256; i += 2) {
+			m[i] = static_cast<uint8_t>(opcode(generator));
+			m[i + 1] = static_cast<uint8_t>(byte(generator));
+		}
+		return m;
+	}
+}
@@ -0,0 +1,117 @@
+#include "pch.h"
+
+#include "Trace.h"
+#include "CPU.h"
+#include "MemoryChip.h"
+#include "TestPrograms.h"
+
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace CheaPU {
+
+	/** What the trace should contain, made the simple way: one instruction at a time. */
+	static std::vector<TraceRecord> expected_trace(const MemoryChip& program, const uint64_t instructions) {
+		std::vector<TraceRecord> trace;
+		CPU c;
+		MemoryChip m = program;
+		for (uint64_t i = 0; i < instructions && !c.error; ++i) {
+			TraceRecord r;
+			r.program_counter = c.program_counter;
+			r.opcode = m[c.program_counter];
+			const bool has_operand = r.opcode != to_word(Opcode::NOP) && r.opcode != to_word(Opcode::HALT) && r.opcode <= to_word(Opcode::SUB);
+			r.operand = has_operand ? m[c.program_counter + 1] : 0;
+			c.run(m, 1);
+			r.accumulator = c.accumulator;
+			r.flags = c.overflow() | (c.zero() << 1) | (c.error << 2);
+			trace.push_back(r);
+		}
+		return trace;
+	}
+
+	static std::vector<TraceRecord> read_trace(std::stringstream& stream) {
+		std::vector<TraceRecord> trace;
+		TraceReader reader(stream);
+		TraceRecord r;
+		while (reader.next(r))
+			trace.push_back(r);
+		return trace;
+	}
+
+	TEST(Trace, quiz) {
+		std::stringstream stream;
+		CPU c;
+		MemoryChip m = quiz_program();
+		{
+			TraceRecorder recorder(stream);
+			recorder.run(c, m, 1000);
+			EXPECT_EQ(33, recorder.records());
+		}
+
+		EXPECT_EQ(expected_trace(quiz_program(), 1000), read_trace(stream));
+	}
+
+	TEST(Trace, random_programs) {
+		for (uint32_t seed = 0; seed < 100; ++seed) {
+			std::stringstream stream;
+			CPU c;
+			MemoryChip m = random_program(seed);
+			TraceRecorder recorder(stream);
+			recorder.run(c, m, 3000);
+			recorder.flush();
+
+			const std::vector<TraceRecord> expected = expected_trace(random_program(seed), recorder.records());
+			EXPECT_EQ(expected, read_trace(stream));
+		}
+	}
+
+	TEST(Trace, instruction_split_between_runs) {
+		std::stringstream stream;
+		CPU c;
+		MemoryChip m = quiz_program();
+		TraceRecorder recorder(stream);
+		recorder.run(c, m, 1);   // Fetch of the LD, not recorded yet.
+		EXPECT_EQ(0, recorder.records());
+		recorder.run(c, m, 1000);
+		recorder.flush();
+
+		EXPECT_EQ(expected_trace(quiz_program(), 1000), read_trace(stream));
+	}
+
+	TEST(Trace, compact_and_streaming) {
+		std::stringstream stream;
+		CPU c;
+		MemoryChip m = counter_program();
+		TraceRecorder recorder(stream);
+		recorder.run(c, m, 3000000);
+		recorder.flush();
+
+		// ADD: header, program counter (after the jump), accumulator and operand. JMP: header and operand.
+		// Every now and then the flags change too.
+		EXPECT_EQ(1000000, recorder.records());
+		EXPECT_GE(9 + 1000000 / 2 * (4 + 2) + 10000, stream.str().size());
+	}
+
+	TEST(Trace, not_a_trace) {
+		std::stringstream stream("Hello, world!");
+		EXPECT_THROW(TraceReader reader(stream), std::runtime_error);
+	}
+
+	TEST(Trace, truncated) {
+		std::stringstream stream;
+		{
+			CPU c;
+			MemoryChip m = counter_program();
+			TraceRecorder recorder(stream);
+			recorder.run(c, m, 3);
+		}
+
+		std::string bytes = stream.str();
+		bytes.pop_back();
+		std::stringstream truncated(bytes);
+		TraceReader reader(truncated);
+		TraceRecord r;
+		EXPECT_THROW(reader.next(r), std::runtime_error);
+	}
+}
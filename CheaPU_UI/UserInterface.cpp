@@ -1,5 +1,9 @@
 #include "UserInterface.h"
 
+#include "ImageLoader.h"
+
+#include <algorithm>
+#include <cmath>
 #include <stdexcept>
 
 #include <sstream>
@@ -17,11 +21,22 @@ namespace CheaPU {
 			throw std::runtime_error(SDL_GetError());
 	}
 
-	UserInterface::UserInterface() :
+	UserInterface::UserInterface(const double clock_hz) :
 		main_window(nullptr),
 		main_window_surface(nullptr),
 		renderer(nullptr),
-		halt_game_loop(true)
+		font(nullptr),
+		panel(nullptr),
+		panel_valid(false),
+		halt_game_loop(true),
+		program_loaded(false),
+		loaded_digest(0),
+		clock_hz(clock_hz),
+		cycle_credit(0),
+		last_clock_update(0),
+		drawing_time(0),
+		frames_timed(0),
+		last_timing_report(0)
 	{
 		// Define all the widgets.
 		reset_button = button_area(25, 200);
@@ -65,6 +80,8 @@ namespace CheaPU {
 
 	UserInterface::~UserInterface()
 	{
+		SDL_DestroyTexture(panel);
+		SDL_DestroyTexture(font);
 		SDL_DestroyRenderer(renderer);
 		SDL_DestroyWindow(main_window);
 		SDL_Quit();
@@ -85,8 +102,62 @@ namespace CheaPU {
 		main_window_surface = SDL_GetWindowSurface(main_window);
 		sdl_null_check(main_window_surface);
 
-		renderer = SDL_CreateRenderer(main_window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+		renderer = SDL_CreateRenderer(main_window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC | SDL_RENDERER_TARGETTEXTURE);
 		sdl_null_check(renderer);
+
+		panel = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET,
+			UserInterface::SCREEN_WIDTH, UserInterface::SCREEN_HEIGHT);
+		sdl_null_check(panel);
+
+		build_font();
+	}
+
+	void UserInterface::build_font()
+	{
+		static constexpr int glyphs = sizeof(petscii) / 8;
+
+		// This comes out of the docs... I don't expect it to ever be needed, but...
+		Uint32 rmask, gmask, bmask, amask;
+		#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+				rmask = 0xff000000;
+				gmask = 0x00ff0000;
+				bmask = 0x0000ff00;
+				amask = 0x000000ff;
+		#else
+				rmask = 0x000000ff;
+				gmask = 0x0000ff00;
+				bmask = 0x00ff0000;
+				amask = 0xff000000;
+		#endif
+
+		SDL_Surface* surface = SDL_CreateRGBSurface(0, glyphs * 8, 8, 32, rmask, gmask, bmask, amask);
+		sdl_null_check(surface);
+
+		const Uint32 color = SDL_MapRGBA(surface->format, 255, 255, 255, 255);
+		const Uint32 transparent = SDL_MapRGBA(surface->format, 0, 0, 0, 0);
+
+		SDL_LockSurface(surface);
+
+		for (int glyph = 0; glyph < glyphs; ++glyph) {
+			for (uint8_t byte = 0; byte < 8; ++byte) {
+				Uint32* cursor = (Uint32*)((Uint8*)surface->pixels + byte * surface->pitch) + glyph * 8;
+				uint8_t line_byte = petscii[glyph * 8 + byte];
+				for (uint8_t bit = 0; bit < 8; ++bit) {
+					*cursor = (0x80 & line_byte) ? color : transparent;
+					line_byte = line_byte << 1;
+					++cursor;
+				}
+			}
+		}
+
+		SDL_UnlockSurface(surface);
+
+		font = SDL_CreateTextureFromSurface(renderer, surface);
+		SDL_FreeSurface(surface);
+		sdl_null_check(font);
+
+		const int rc = SDL_SetTextureBlendMode(font, SDL_BLENDMODE_BLEND);
+		sdl_return_check(rc);
 	}
 
 	void UserInterface::poll_input()
@@ -104,6 +175,16 @@ namespace CheaPU {
 				return;
 			}
 
+			// Some renderers (Direct3D) lose the content of the target textures now and then.
+			else if (user_input.type == SDL_RENDER_TARGETS_RESET || user_input.type == SDL_RENDER_DEVICE_RESET) {
+				panel_valid = false;
+			}
+
+			// Frames are shown only when something changes: if the window was covered, show it again.
+			else if (user_input.type == SDL_WINDOWEVENT && user_input.window.event == SDL_WINDOWEVENT_EXPOSED) {
+				panel_valid = false;
+			}
+
 			else if (user_input.type == SDL_MOUSEBUTTONDOWN) {
 				int mouseX = user_input.motion.x;
 				int mouseY = user_input.motion.y;
@@ -225,53 +306,14 @@ namespace CheaPU {
 
 	void UserInterface::draw_text(const uint16_t top, const uint16_t left, const uint16_t size_px, char c)
 	{
-		SDL_Surface* surface;
-		
-		// This comes out of the docs... I don't expect it to ever be needed, but...
-		Uint32 rmask, gmask, bmask, amask;
-		#if SDL_BYTEORDER == SDL_BIG_ENDIAN
-				rmask = 0xff000000;
-				gmask = 0x00ff0000;
-				bmask = 0x0000ff00;
-				amask = 0x000000ff;
-		#else
-				rmask = 0x000000ff;
-				gmask = 0x0000ff00;
-				bmask = 0x00ff0000;
-				amask = 0xff000000;
-		#endif
-
-		surface = SDL_CreateRGBSurface(0, 8, 8, 32, rmask, gmask, bmask, amask);
-		sdl_null_check(surface);
-
-		SDL_Rect entire_surface;
-		entire_surface.x = 0;
-		entire_surface.y = 0;
-		entire_surface.h = 8;
-		entire_surface.w = 8;
-
-		const Uint32 color = SDL_MapRGB(surface->format, 255, 255, 255);
-		const Uint32 background = SDL_MapRGB(surface->format, 150, 150, 150);
-
 		if (c < 'A' || c > 'Z')
 			c = '@'; // Which is just before 'A';
 
-		SDL_LockSurface(surface);
-
-		SDL_FillRect(surface, &entire_surface, background);
-		
-		Uint32* cursor = (Uint32*)surface->pixels;
-		for (uint8_t byte = 0; byte < 8; ++byte) {
-			uint8_t line_byte = petscii[(c - '@') * 8 + byte];
-			for (uint8_t bit = 0; bit < 8; ++bit) {
-				if (0x80 & line_byte)
-					SDL_memset(cursor, color, sizeof(color));
-				line_byte = line_byte << 1;
-				++cursor;
-			}
-		}
-
-		SDL_UnlockSurface(surface);
+		SDL_Rect glyph;
+		glyph.x = (c - '@') * 8;
+		glyph.y = 0;
+		glyph.h = 8;
+		glyph.w = 8;
 
 		SDL_Rect to;
 		to.x = left;
@@ -279,12 +321,9 @@ namespace CheaPU {
 		to.h = size_px;
 		to.w = size_px;
 
-		SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-		const int rc = SDL_RenderCopy(renderer, texture, &entire_surface, &to);
+		// All the copies come from the same texture, so SDL can batch them together.
+		const int rc = SDL_RenderCopy(renderer, font, &glyph, &to);
 		sdl_return_check(rc);
-
-		SDL_DestroyTexture(texture);
-		SDL_FreeSurface(surface);
 	}
 
 	void UserInterface::draw_text(const uint16_t top, const uint16_t left, const uint16_t size_px, const std::string& text)
@@ -308,18 +347,20 @@ namespace CheaPU {
 		int rc = SDL_RenderFillRect(renderer, &paper);
 		sdl_return_check(rc);
 
-		for (const auto& row : tape_holes) {
+		for (const auto& row : tape_holes)
 			for (const ToggleButton& t : row)
-			{
-				if (t.up)
-					SDL_SetRenderDrawColor(renderer, 220, 220, 220, 255);  // Ones.
-				else
-					SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);        // Zeroes.
-
-				int rc = SDL_RenderFillRect(renderer, &t.area);
-				sdl_return_check(rc);
-			}
-		}
+				draw_hole(t);
+	}
+
+	void UserInterface::draw_hole(const ToggleButton& hole)
+	{
+		if (hole.up)
+			SDL_SetRenderDrawColor(renderer, 220, 220, 220, 255);  // Ones.
+		else
+			SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);        // Zeroes.
+
+		int rc = SDL_RenderFillRect(renderer, &hole.area);
+		sdl_return_check(rc);
 	}
 
 	SDL_Rect UserInterface::button_area(const uint16_t top, const uint16_t left) const
@@ -347,63 +388,242 @@ namespace CheaPU {
 	}
 
 
-	void UserInterface::game_loop()
+	void UserInterface::load_program(const std::string& path, const size_t base)
 	{
-		cpu.reset();
-		memory[0x00] = 86;
+		load_image(path, memory, base);  // The panel picks up the changes at the next frame.
+		program_loaded = true;
+		loaded_digest = memory.digest();
+	}
 
-		halt_game_loop = false;
-		while (!halt_game_loop) {
-			poll_input();
+	void UserInterface::run_clock()
+	{
+		// Don't try to catch up after a long pause (e.g. the window was dragged around):
+		// a quarter of second of cycles, at most.
+		static constexpr double max_catch_up_seconds = 0.25;
+
+		// With no clock limit, the CPU gets most of the frame time, but leaves
+		// some for the drawing (1/60 of a second is 16ms).
+		static constexpr double unthrottled_seconds = 0.012;
+		static constexpr uint64_t unthrottled_batch = 100000;
+
+		const Uint64 now = SDL_GetPerformanceCounter();
+		const double frequency = static_cast<double>(SDL_GetPerformanceFrequency());
+		const double elapsed = (now - last_clock_update) / frequency;
+		last_clock_update = now;
+
+		// A stopped CPU should not "save up" cycles to run in a burst after the reset.
+		if (cpu.error) {
+			cycle_credit = 0;
+			return;
+		}
 
-			if (halt_game_loop)
-				return;
+		if (clock_hz > 0) {
+			cycle_credit = std::min(cycle_credit + elapsed * clock_hz, clock_hz * max_catch_up_seconds + 1);
+			const uint64_t cycles = static_cast<uint64_t>(cycle_credit);
+			cycle_credit -= cycles;
+			cpu.run_cycles(memory, cycles);
+			return;
+		}
+
+		const Uint64 deadline = now + static_cast<Uint64>(unthrottled_seconds * frequency);
+		do
+			cpu.run_cycles(memory, unthrottled_batch);
+		while (!cpu.error && !cpu.idle() && SDL_GetPerformanceCounter() < deadline);
+	}
+
+	int UserInterface::time_to_next_tick() const
+	{
+		// Even with a fast clock, the LEDs can't change more often than the monitor shows them.
+		static constexpr double frame_seconds = 1.0 / 60;
+
+		// A halted CPU has nothing new to show until the user does something. One in an idle loop neither,
+		// but idle() is only as fresh as the last run: look again now and then.
+		if (cpu.error)
+			return -1;
+		if (cpu.idle())
+			return idle_poll_ms;
+
+		// As fast as it can: never sleep.
+		if (clock_hz <= 0)
+			return 0;
+
+		const double elapsed = (SDL_GetPerformanceCounter() - last_clock_update) / static_cast<double>(SDL_GetPerformanceFrequency());
+		const double next_cycle = (1 - cycle_credit) / clock_hz;
+		const double wait = std::max(next_cycle, frame_seconds) - elapsed;
+		if (wait <= 0)
+			return 0;
+
+		return static_cast<int>(std::ceil(wait * 1000));
+	}
+
+	UserInterface::PanelState UserInterface::panel_state() const
+	{
+		PanelState state;
+		state.overflow = cpu.overflow();
+		state.zero = cpu.zero();
+		state.error = cpu.error;
+		state.accumulator = cpu.accumulator;
+
+		for (size_t i = 0; i < 8; ++i) {
+			state.address[i] = address_buttons[i].up;
+			state.value[i] = value_buttons[i].up;
+		}
+
+		for (size_t row = 0; row < tape_holes.size(); ++row)
+			for (size_t i = 0; i < 8; ++i)
+				state.tape[row][i] = tape_holes[row][i].up;
+
+		return state;
+	}
+
+	void UserInterface::draw_panel(const PanelState& state)
+	{
+		draw_background();
+
+		draw_text(10, 10, 20, "COMPUTER");
+
+		draw_text(40, 15, 10, "OVER");
+		draw_text(40, 65, 10, "ZERO");
+		draw_text(40, 115, 10, "ERROR");
 
-			cpu.cycle(memory);  // 1 cycle per frame... not the fastest thing around, but makes the LED blinks at a nice pace.
+		draw_led(55, 15, state.overflow);
+		draw_led(55, 65, state.zero);
+		draw_led(55, 115, state.error);
 
-			draw_background();
+		draw_text(100, 15, 10, "ACCUMULATOR");
+		for (uint8_t bit = 0; bit < 8; ++bit)
+			draw_led(120, 15 + 30 * bit, state.accumulator & (0x80 >> bit));
 
-			draw_text(10, 10, 20, "COMPUTER");
+		draw_text(10, 200, 10, "RESET");
+		draw_button(reset_button, true);
 
-			draw_text(40, 15, 10, "OVER");
-			draw_text(40, 65, 10, "ZERO");
-			draw_text(40, 115, 10, "ERROR");
-			
-			draw_led(55, 15, cpu.overflow);
-			draw_led(55, 65, cpu.zero);
-			draw_led(55, 115, cpu.error);
+		draw_text(55, 200, 10, "HALT");
+		draw_button(halt_button, true);
 
-			draw_text(100, 15, 10, "ACCUMULATOR");
-			draw_led(120, 15, (cpu.accumulator & 0x80));
-			draw_led(120, 45, (cpu.accumulator & 0x40));
-			draw_led(120, 75, (cpu.accumulator & 0x20));
-			draw_led(120, 105, (cpu.accumulator & 0x10));
-			draw_led(120, 135, (cpu.accumulator & 0x08));
-			draw_led(120, 165, (cpu.accumulator & 0x04));
-			draw_led(120, 195, (cpu.accumulator & 0x02));
-			draw_led(120, 225, (cpu.accumulator & 0x01));
+		draw_text(165, 15, 10, "ADDRESS");
+		for (const ToggleButton& t : address_buttons)
+			draw_button(t.area, t.up);
 
-			draw_text(10, 200, 10, "RESET");
-			draw_button(reset_button, true);
+		draw_text(225, 15, 10, "VALUE");
+		for (const ToggleButton& t : value_buttons)
+			draw_button(t.area, t.up);
 
-			draw_text(55, 200, 10, "HALT");
-			draw_button(halt_button, true);
+		draw_text(285, 15, 10, "ENTER");
+		draw_button(enter_button, true);
+
+		draw_text(335, 15, 10, "LOADTAPE");
+		draw_button(tape_button, true);
+
+		draw_tape();
+	}
+
+	bool UserInterface::update_panel()
+	{
+		const PanelState state = panel_state();
+		if (panel_valid && state == shown)
+			return false;
+
+		int rc = SDL_SetRenderTarget(renderer, panel);
+		sdl_return_check(rc);
+
+		// Every widget covers its whole area, it can be drawn on top of the old one
+		// with no need to clean up the background.
+		if (!panel_valid) {
+			draw_panel(state);
+			panel_valid = true;
+		}
+		else {
+			if (state.overflow != shown.overflow)
+				draw_led(55, 15, state.overflow);
+			if (state.zero != shown.zero)
+				draw_led(55, 65, state.zero);
+			if (state.error != shown.error)
+				draw_led(55, 115, state.error);
+
+			const uint8_t changed_bits = state.accumulator ^ shown.accumulator;
+			for (uint8_t bit = 0; bit < 8; ++bit)
+				if (changed_bits & (0x80 >> bit))
+					draw_led(120, 15 + 30 * bit, state.accumulator & (0x80 >> bit));
+
+			for (size_t i = 0; i < 8; ++i) {
+				if (state.address[i] != shown.address[i])
+					draw_button(address_buttons[i].area, state.address[i]);
+				if (state.value[i] != shown.value[i])
+					draw_button(value_buttons[i].area, state.value[i]);
+			}
+
+			for (size_t row = 0; row < tape_holes.size(); ++row)
+				for (size_t i = 0; i < 8; ++i)
+					if (state.tape[row][i] != shown.tape[row][i])
+						draw_hole(tape_holes[row][i]);
+		}
+
+		shown = state;
+
+		rc = SDL_SetRenderTarget(renderer, nullptr);
+		sdl_return_check(rc);
+		return true;
+	}
+
+	void UserInterface::report_frame_time(const Uint64 frame_start, const Uint64 frame_end)
+	{
+		// Does not include the SDL_RenderPresent, that just waits for the vsync.
+		drawing_time += frame_end - frame_start;
+		++frames_timed;
+
+		const Uint64 frequency = SDL_GetPerformanceFrequency();
+		if (frame_end - last_timing_report < frequency)
+			return;
+
+		std::stringstream title;
+		title << "Go download a real emulator... (frame drawn in "
+			  << 1000.0 * drawing_time / frequency / frames_timed << " ms)";
+		SDL_SetWindowTitle(main_window, title.str().c_str());
+
+		drawing_time = 0;
+		frames_timed = 0;
+		last_timing_report = frame_end;
+	}
+
+	void UserInterface::game_loop()
+	{
+		cpu.reset();
+
+		// With nothing loaded, an illegal opcode at 0 keeps the CPU halted (ERROR LED on) until
+		// a program is clicked in and RESET. A loaded program must start as it was loaded.
+		if (!program_loaded)
+			memory[0x00] = 86;
+		else if (memory.digest() != loaded_digest)
+			throw std::logic_error("The loaded program changed before the game loop started.");
+
+		last_clock_update = SDL_GetPerformanceCounter();
+		halt_game_loop = false;
+		while (!halt_game_loop) {
+			// Sleep until the next clock tick, or until the user does something, whatever comes first.
+			// The events stay in the queue for poll_input.
+			const int timeout = time_to_next_tick();
+			if (timeout < 0)
+				SDL_WaitEvent(nullptr);
+			else if (timeout > 0)
+				SDL_WaitEventTimeout(nullptr, timeout);
+
+			poll_input();
+
+			if (halt_game_loop)
+				return;
 
-			draw_text(165, 15, 10, "ADDRESS");
-			for (const ToggleButton& t : address_buttons)
-				draw_button(t.area, t.up);
+			run_clock();
 
-			draw_text(225, 15, 10, "VALUE");
-			for (const ToggleButton& t : value_buttons)
-				draw_button(t.area, t.up);
+			const Uint64 frame_start = SDL_GetPerformanceCounter();
 
-			draw_text(285, 15, 10, "ENTER");
-			draw_button(enter_button, true);
+			// Same LEDs, same buttons: the frame on the screen is still good.
+			if (!update_panel())
+				continue;
 
-			draw_text(335, 15, 10, "LOADTAPE");
-			draw_button(tape_button, true);
+			int rc = SDL_RenderCopy(renderer, panel, nullptr, nullptr);
+			sdl_return_check(rc);
 
-			draw_tape();
+			report_frame_time(frame_start, SDL_GetPerformanceCounter());
 
 			SDL_RenderPresent(renderer);
 		}
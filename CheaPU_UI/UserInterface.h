@@ -24,7 +24,10 @@ namespace CheaPU {
 	Most of it is a copy-paste from another project I had already done. There is no other reason
 	for the use of SDL or the structure of this code other than "this is already done and works well enough".
 	
-	The interface is "immediate" (redraw everything at every loop), because it is easy to do.
+	The interface was "immediate" (redraw everything at every loop), because it is easy to do. Now it
+	only redraws what changed, since it runs on machines where the power consumption matters.
+	For the same reason, it only shows a new frame when something changed, and sleeps between the clock ticks
+	(see game_loop()).
 	The layout is entirely based on magic numbers scattered everywhere because I do not care much - I don't
 	plan to maintain this code in the long run.
 
@@ -36,20 +39,77 @@ namespace CheaPU {
 		static constexpr int SCREEN_WIDTH = 640;
 		static constexpr int SCREEN_HEIGHT = 480;
 
-		/** Try not to create more than one! It instantiates SDL structures on creation.*/
-		UserInterface();
+		/** Try not to create more than one! It instantiates SDL structures on creation.
+		    The CPU runs at clock_hz cycles per second (0 means "as fast as it can"). */
+		explicit UserInterface(const double clock_hz = 60);
 		~UserInterface();
 		
 		void open_window();
 		void game_loop();
 
+		/** Puts a program in memory from a file, without clicking it in (see CheaPU::load_image()).
+		    The game loop starts running it right away. Throws std::runtime_error if it can't. */
+		void load_program(const std::string& path, const size_t base = 0);
+
 	private:
 		SDL_Window* main_window;
 		SDL_Surface* main_window_surface;
 		SDL_Renderer* renderer;
 
+		/** All the letters of the petscii font side by side, white on transparent, made once in open_window.
+		    Writing a letter is just copying a piece of it. */
+		SDL_Texture* font;
+
+		/** Everything that can change on the front panel. */
+		struct PanelState {
+			uint8_t overflow;
+			uint8_t zero;
+			uint8_t error;
+			uint8_t accumulator;
+			std::array<bool, 8> address;
+			std::array<bool, 8> value;
+			std::array< std::array<bool, 8>, 22> tape;
+
+			bool operator==(const PanelState& other) const = default;
+		};
+
+		/** @name The front panel is drawn in this texture, and stays there between frames.
+		    Only the widgets that changed since the last frame are drawn again,
+			then the whole texture is copied on the screen. */
+		/**@{*/
+		SDL_Texture* panel;
+		bool panel_valid;   ///< False if the texture must be redrawn from scratch.
+		PanelState shown;   ///< What is in the texture now.
+		/**@}*/
+
 		bool halt_game_loop;
 
+		/** @name Program from load_program(), if any.
+		    Without one, the CPU starts halted, waiting for a program to be clicked in. */
+		/**@{*/
+		bool program_loaded;
+		uint64_t loaded_digest;   ///< MemoryChip::digest() right after loading: it must be the same when the game loop starts.
+		/**@}*/
+
+		/** @name Emulated clock.
+		    The display runs at the monitor refresh rate (at most), the CPU at its own clock. Between two frames,
+			the CPU runs all the cycles that it should have done in the meantime, in one go
+			(with CPU::run_cycles). The LEDs show whatever state it has reached at the time of the frame. */
+		/**@{*/
+		double clock_hz;
+		double cycle_credit;           ///< Cycles owed to the CPU. Fractional, for clocks slower than the display.
+		Uint64 last_clock_update;      ///< From SDL_GetPerformanceCounter.
+		/**@}*/
+
+		void run_clock();
+
+		/** How long the game loop can sleep before the CPU has something to do, in ms: 0 for "no sleep",
+		    -1 for "until the user does something". */
+		int time_to_next_tick() const;
+
+		/** How often to look at a CPU in an idle loop (see game_loop()). */
+		static constexpr int idle_poll_ms = 250;
+
 		UserInterface(const UserInterface&) = delete;
 		void operator=(const UserInterface&) = delete;
 
@@ -60,6 +120,21 @@ namespace CheaPU {
 		void draw_text(const uint16_t top, const uint16_t left, const uint16_t size_px, char c);
 		void draw_text(const uint16_t top, const uint16_t left, const uint16_t size_px, const std::string& text);
 		void draw_tape();
+		void draw_hole(const ToggleButton& hole);
+		PanelState panel_state() const;
+		void draw_panel(const PanelState& state);
+		/** False if nothing changed, and there is no need to show a new frame. */
+		bool update_panel();
+		void build_font();
+
+		/** @name Frame time measurement.
+		    The average time it takes to draw a frame goes in the window title, once per second. */
+		/**@{*/
+		Uint64 drawing_time;
+		uint32_t frames_timed;
+		Uint64 last_timing_report;
+		void report_frame_time(const Uint64 frame_start, const Uint64 frame_end);
+		/**@}*/
 
 		/**Construct the rect for the button. The size is standard.*/
 		SDL_Rect button_area(const uint16_t top, const uint16_t left) const;
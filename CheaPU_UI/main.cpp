@@ -1,9 +1,28 @@
 #include "UserInterface.h"
 
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+
+
+/** Usage: CheaPU_UI [clock in Hz] [program]
+    The default 60 Hz makes the LED blink at a nice pace. 0 runs as fast as possible.
+	The program is loaded in memory from address 0: raw, Intel HEX (.hex) or hex text (.txt), see CheaPU::load_image(). */
+int main(int argc, char* argv[]) {
+	const double clock_hz = argc > 1 ? std::strtod(argv[1], nullptr) : 60;
+
+	CheaPU::UserInterface ui(clock_hz);
+	if (argc > 2) {
+		try {
+			ui.load_program(argv[2]);
+		}
+		catch (const std::runtime_error& e) {
+			std::cerr << argv[2] << ": " << e.what() << "\n";
+			return 1;
+		}
+	}
 
-int main(void) {
-	CheaPU::UserInterface ui;
 	ui.open_window();
 	ui.game_loop();
 	return 0;
-}
\ No newline at end of file
+}
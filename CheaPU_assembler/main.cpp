@@ -0,0 +1,136 @@
+#include "Assembler.h"
+#include "ImageLoader.h"
+#include "MemoryChip.h"
+#include "SymbolMap.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+/** Assembles a program (see CheaPU::Assembler for the syntax) into a memory image for the UI or CheaPU_headless.
+
+	Usage: CheaPU_assembler <source> [-o <image>] [--format raw|ihex|text] [--map <file>]
+
+	-o <image> is where the image goes, by default the source with the extension of the format
+	(".bin", ".hex" or ".txt"). The format comes from the extension of the image, unless --format says otherwise.
+	--map <file> also writes the symbol map, for the --symbols of CheaPU_headless and CheaPU_tracedump.
+
+	The image starts at 0 and stops after the last byte of the program: it loads with --base 0. */
+
+namespace {
+
+	struct Options {
+		std::string source;
+		std::string image;
+		CheaPU::ImageFormat format = CheaPU::ImageFormat::guess;
+		std::string map;
+	};
+
+	bool parse_arguments(const int argc, char* argv[], Options& options)
+	{
+		for (int i = 1; i < argc; ++i) {
+			const std::string argument = argv[i];
+			if (argument == "-o" && i + 1 < argc)
+				options.image = argv[++i];
+			else if (argument == "--format" && i + 1 < argc) {
+				const std::string format = argv[++i];
+				if (format == "raw")
+					options.format = CheaPU::ImageFormat::raw;
+				else if (format == "ihex")
+					options.format = CheaPU::ImageFormat::intel_hex;
+				else if (format == "text")
+					options.format = CheaPU::ImageFormat::hex_text;
+				else
+					return false;
+			}
+			else if (argument == "--map" && i + 1 < argc)
+				options.map = argv[++i];
+			else if (options.source.empty() && argument.rfind("-", 0) != 0)
+				options.source = argument;
+			else
+				return false;
+		}
+
+		return !options.source.empty();
+	}
+
+	/** The same rule as load_image(): .hex and .ihx are Intel HEX, .txt is hex text, everything else is raw. */
+	CheaPU::ImageFormat format_of(const std::string& path)
+	{
+		const size_t dot = path.find_last_of('.');
+		const std::string extension = dot == std::string::npos ? "" : path.substr(dot + 1);
+		if (extension == "hex" || extension == "ihx" || extension == "HEX" || extension == "IHX")
+			return CheaPU::ImageFormat::intel_hex;
+		if (extension == "txt" || extension == "TXT")
+			return CheaPU::ImageFormat::hex_text;
+		return CheaPU::ImageFormat::raw;
+	}
+
+	std::string default_image(const std::string& source, const CheaPU::ImageFormat format)
+	{
+		const size_t dot = source.find_last_of('.');
+		const size_t slash = source.find_last_of("/\\");
+		const std::string stem = dot == std::string::npos || (slash != std::string::npos && dot < slash) ? source : source.substr(0, dot);
+
+		switch (format) {
+		case CheaPU::ImageFormat::intel_hex:
+			return stem + ".hex";
+		case CheaPU::ImageFormat::hex_text:
+			return stem + ".txt";
+		default:
+			return stem + ".bin";
+		}
+	}
+}
+
+int main(int argc, char* argv[]) {
+	Options options;
+	if (!parse_arguments(argc, argv, options)) {
+		std::cerr << "Usage: CheaPU_assembler <source> [-o <image>] [--format raw|ihex|text] [--map <file>]\n";
+		return 2;
+	}
+
+	if (options.image.empty())
+		options.image = default_image(options.source, options.format);
+	if (options.format == CheaPU::ImageFormat::guess)
+		options.format = format_of(options.image);
+
+	std::ifstream source(options.source, std::ios::binary);
+	if (!source) {
+		std::cerr << "Can't read " << options.source << "\n";
+		return 1;
+	}
+	std::stringstream text;
+	text << source.rdbuf();
+
+	CheaPU::MemoryChip memory;
+	CheaPU::Assembler assembler;
+	try {
+		assembler.assemble(text.str(), memory);
+	}
+	catch (const CheaPU::AssemblyError& e) {
+		std::cerr << options.source << ": " << e.what() << "\n";
+		return 1;
+	}
+
+	std::ofstream image(options.image, std::ios::binary);
+	CheaPU::write_image(image, memory, 0, assembler.end(), options.format);
+	if (!image) {
+		std::cerr << "Can't write " << options.image << "\n";
+		return 1;
+	}
+
+	if (!options.map.empty()) {
+		std::ofstream map(options.map);
+		assembler.symbol_map().write(map);
+		if (!map) {
+			std::cerr << "Can't write " << options.map << "\n";
+			return 1;
+		}
+	}
+
+	std::cout << options.image << ": " << assembler.end() << " bytes\n";
+	return 0;
+}
@@ -0,0 +1,108 @@
+#include "BatchScaling.h"
+
+#include "BatchRunner.h"
+#include "CPU.h"
+#include "ExamplePrograms.h"
+#include "MemoryChip.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <thread>
+#include <vector>
+
+namespace CheaPU {
+
+	namespace {
+
+		bool same_results(const std::vector<BatchResult>& a, const std::vector<BatchResult>& b)
+		{
+			for (size_t i = 0; i < a.size(); ++i)
+				if (a[i].cycles != b[i].cycles ||
+					a[i].accumulator != b[i].accumulator ||
+					a[i].program_counter != b[i].program_counter ||
+					a[i].error != b[i].error ||
+					a[i].memory_digest != b[i].memory_digest)
+					return false;
+			return true;
+		}
+	}
+
+	bool batch_scaling(std::ostream& out, const size_t jobs, const uint64_t cycles_per_job)
+	{
+		std::vector<BatchJob> batch;
+		for (size_t i = 0; i < jobs; ++i) {
+			const uint8_t seed = static_cast<uint8_t>(i * 7 + 1);
+			batch.push_back({ i % 4 == 0 ? quiz_program(seed) : counter_program(seed), cycles_per_job });
+		}
+
+		const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+		out << "Batch of " << jobs << " programs, " << cycles_per_job << " cycles each, " << cores << " cores.\n";
+		out << std::setw(8) << "threads" << std::setw(12) << "ms" << std::setw(14) << "Mcycles/s"
+			<< std::setw(10) << "speedup" << std::setw(12) << "efficiency" << std::setw(8) << "steals" << "\n";
+
+		std::vector<BatchResult> reference;
+		double single_thread_ms = 0;
+		bool consistent = true;
+
+		for (unsigned threads = 1; ; threads = std::min(threads * 2, cores)) {
+			BatchRunner runner(threads);
+
+			const auto start = std::chrono::steady_clock::now();
+			const std::vector<BatchResult> results = runner.run(batch);
+			const auto end = std::chrono::steady_clock::now();
+
+			uint64_t total_cycles = 0;
+			for (const BatchResult& r : results)
+				total_cycles += r.cycles;
+
+			const double ms = std::chrono::duration<double, std::milli>(end - start).count();
+			if (threads == 1) {
+				reference = results;
+				single_thread_ms = ms;
+			}
+			else if (!same_results(reference, results)) {
+				consistent = false;
+				out << "Results with " << threads << " threads differ from 1 thread!\n";
+			}
+
+			const double speedup = single_thread_ms / ms;
+			out << std::fixed << std::setprecision(1)
+				<< std::setw(8) << threads
+				<< std::setw(12) << ms
+				<< std::setw(14) << total_cycles / ms / 1000.0
+				<< std::setw(10) << speedup
+				<< std::setw(11) << 100.0 * speedup / threads << "%"
+				<< std::setw(8) << runner.steals << "\n";
+
+			if (threads == cores)
+				break;
+		}
+
+		// The counters never halt: with the loop detection, they stop once they go around.
+		// Those that are not stopped must end as without it.
+		BatchRunner detecting(cores);
+		detecting.detect_loops = true;
+
+		const auto start = std::chrono::steady_clock::now();
+		const std::vector<BatchResult> results = detecting.run(batch);
+		const auto end = std::chrono::steady_clock::now();
+
+		size_t stopped = 0;
+		for (size_t i = 0; i < results.size(); ++i) {
+			if (results[i].loop_period != 0)
+				++stopped;
+			else if (!same_results({ reference[i] }, { results[i] })) {
+				consistent = false;
+				out << "Job " << i << " ends differently with the loop detection!\n";
+			}
+		}
+
+		const double ms = std::chrono::duration<double, std::milli>(end - start).count();
+		out << "With loop detection, " << cores << " threads: " << std::setprecision(1) << ms << " ms, "
+			<< stopped << " programs stopped early (" << single_thread_ms / ms << "x one thread without).\n";
+
+		return consistent;
+	}
+
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+
+namespace CheaPU {
+
+	/** Runs the same batch of programs on 1, 2, 4... threads (up to one per core) with the BatchRunner,
+	    and prints how long it took and how much faster than one thread.
+		The programs are a mix of long loops and programs that halt early, so that the threads
+		have to steal work from each other to finish together.
+		Then once more on all the cores with BatchRunner::detect_loops, which stops the loops that never end.
+
+		@return false if the results change with the number of threads, or the loop detection changes
+		        the results of the programs that halt (they must not). */
+	bool batch_scaling(std::ostream& out, const size_t jobs, const uint64_t cycles_per_job);
+
+}
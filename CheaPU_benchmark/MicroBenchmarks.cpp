@@ -0,0 +1,396 @@
+#include "MicroBenchmarks.h"
+
+#include "Assembler.h"
+#include "CPU.h"
+#include "ExamplePrograms.h"
+#include "History.h"
+#include "MemoryChip.h"
+#include "PagedMemoryChip.h"
+#include "ResultCache.h"
+#include "Snapshot.h"
+#include "StepByStep.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+namespace CheaPU {
+
+	namespace {
+
+		/** Where the benchmarks leave their results, so that the compiler can't throw the work away. */
+		volatile uint64_t sink;
+
+		/** Does the operation iterations times, returns anything that depends on the work done. */
+		using Benchmark = std::function<uint64_t(const uint64_t iterations)>;
+
+		struct Timing {
+			double median_ns;
+			double min_ns;
+			double max_ns;
+		};
+
+		double seconds_for(const Benchmark& benchmark, const uint64_t iterations)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			sink = benchmark(iterations);
+			const auto end = std::chrono::steady_clock::now();
+			return std::chrono::duration<double>(end - start).count();
+		}
+
+		/** Finds how many iterations take about target_seconds, then times that many a few times. */
+		Timing measure(const Benchmark& benchmark)
+		{
+			static constexpr double target_seconds = 0.05;
+			static constexpr int repetitions = 7;
+
+			uint64_t iterations = 1;
+			double seconds = seconds_for(benchmark, iterations);
+			while (seconds < target_seconds / 10) {
+				iterations *= 10;
+				seconds = seconds_for(benchmark, iterations);
+			}
+			iterations = std::max<uint64_t>(1, static_cast<uint64_t>(iterations * target_seconds / seconds));
+
+			std::vector<double> ns;
+			for (int i = 0; i < repetitions; ++i)
+				ns.push_back(seconds_for(benchmark, iterations) * 1e9 / iterations);
+			std::sort(ns.begin(), ns.end());
+
+			return { ns[repetitions / 2], ns.front(), ns.back() };
+		}
+
+		std::string spread(const Timing& t)
+		{
+			std::stringstream text;
+			text << std::fixed << std::setprecision(1)
+				<< "-" << 100.0 * (t.median_ns - t.min_ns) / t.median_ns << "% "
+				<< "+" << 100.0 * (t.max_ns - t.median_ns) / t.median_ns << "%";
+			return text.str();
+		}
+
+		/** The quiz halts: start it again, with its counters back to the initial values. */
+		void restart_quiz(CPU& cpu, MemoryChip& memory)
+		{
+			cpu.reset();
+			memory[0x14] = 4;
+			memory[0x15] = 0;
+		}
+
+		/** The 1st 256 bytes full of the same instruction, then a JMP back to 0.
+		    The operands are chosen so that nothing changes: LD, ST, ADD, SUB work on 0xFF (the operand of the JMP,
+			that is 0, as the accumulator), JMP and JZE go to the next instruction (the accumulator is 0, JZE jumps). */
+		MemoryChip same_instruction(const Opcode opcode)
+		{
+			MemoryChip m;
+			const bool has_operand = opcode != Opcode::NOP;
+			const uint8_t length = has_operand ? 2 : 1;
+
+			uint8_t address = 0;
+			while (address + length <= 0xFE) {
+				m[address] = to_word(opcode);
+				if (opcode == Opcode::JMP || opcode == Opcode::JZE)
+					m[address + 1] = address + 2;
+				else if (has_operand)
+					m[address + 1] = 0xFF;
+				address += length;
+			}
+
+			// Anything left before the jump is NOPs.
+			m[0xFE] = to_word(Opcode::JMP);
+			m[0xFF] = 0x00;
+			return m;
+		}
+
+		StepByStep<uint8_t> three_steps()
+		{
+			co_yield 1;
+			co_yield 2;
+			co_return 3;
+		}
+
+		StepByStep<uint8_t> endless_steps()
+		{
+			uint8_t step = 0;
+			while (true)
+				co_yield uint8_t(++step);
+		}
+
+		const char* engine_name(const Engine engine)
+		{
+			return engine == Engine::microcode ? "microcode" : "coroutines";
+		}
+
+		std::vector<std::pair<std::string, Benchmark>> all_benchmarks()
+		{
+			std::vector<std::pair<std::string, Benchmark>> benchmarks;
+
+			for (const Engine engine : { Engine::microcode, Engine::coroutines }) {
+				const std::string name = engine_name(engine);
+
+				benchmarks.emplace_back("cycle/counter/" + name, [engine](const uint64_t cycles) {
+					CPU cpu(engine);
+					MemoryChip memory = counter_program();
+					for (uint64_t i = 0; i < cycles; ++i)
+						cpu.cycle(memory);
+					return uint64_t(cpu.accumulator);
+				});
+
+				benchmarks.emplace_back("cycle/quiz/" + name, [engine](const uint64_t cycles) {
+					CPU cpu(engine);
+					MemoryChip memory = quiz_program();
+					for (uint64_t i = 0; i < cycles; ++i) {
+						cpu.cycle(memory);
+						if (cpu.error)
+							restart_quiz(cpu, memory);
+					}
+					return uint64_t(cpu.accumulator);
+				});
+			}
+
+			benchmarks.emplace_back("run_cycles/counter", [](const uint64_t cycles) {
+				CPU cpu;
+				MemoryChip memory = counter_program();
+				return cpu.run_cycles(memory, cycles) + cpu.accumulator;
+			});
+
+			benchmarks.emplace_back("run_cycles/quiz", [](const uint64_t cycles) {
+				CPU cpu;
+				MemoryChip memory = quiz_program();
+				uint64_t done = 0;
+				while (done < cycles) {
+					done += cpu.run_cycles(memory, cycles - done);
+					if (cpu.error)
+						restart_quiz(cpu, memory);
+				}
+				return done + cpu.accumulator;
+			});
+
+			// HALT is missing: it stops the CPU, there is nothing to repeat. Its cost is in the reset.
+			const std::pair<const char*, Opcode> opcodes[] = {
+				{ "NOP", Opcode::NOP }, { "LD", Opcode::LD }, { "ST", Opcode::ST }, { "ADD", Opcode::ADD },
+				{ "SUB", Opcode::SUB }, { "JMP", Opcode::JMP }, { "JZE", Opcode::JZE }
+			};
+			for (const auto& [opcode_name, opcode] : opcodes) {
+				const uint64_t cycles_per_instruction = opcode == Opcode::NOP ? 2 : 3;
+
+				for (const Engine engine : { Engine::microcode, Engine::coroutines })
+					benchmarks.emplace_back(std::string("opcode/") + opcode_name + "/" + engine_name(engine),
+						[engine, opcode = opcode, cycles_per_instruction](const uint64_t instructions) {
+						CPU cpu(engine);
+						MemoryChip memory = same_instruction(opcode);
+						for (uint64_t i = 0; i < instructions * cycles_per_instruction; ++i)
+							cpu.cycle(memory);
+						return uint64_t(cpu.program_counter);
+					});
+
+				// Most of these are idle loops (same accumulator every time around, no stores): run() would skip them.
+				// One time around per call, it never sees the loop twice.
+				benchmarks.emplace_back(std::string("opcode/") + opcode_name + "/run", [opcode = opcode](const uint64_t instructions) {
+					CPU cpu;
+					MemoryChip memory = same_instruction(opcode);
+					const uint64_t loop = opcode == Opcode::NOP ? 0xFF : 0x80;
+					uint64_t cycles = 0;
+					for (uint64_t done = 0; done < instructions; done += loop)
+						cycles += cpu.run(memory, std::min(loop, instructions - done));
+					return cycles;
+				});
+			}
+
+			// A billion instructions of JMP to itself, that run() does not need to run.
+			benchmarks.emplace_back("run/idle_loop_1G", [](const uint64_t runs) {
+				MemoryChip memory;
+				memory[0x00] = to_word(Opcode::JMP);
+				memory[0x01] = 0x00;
+				uint64_t total = 0;
+				for (uint64_t i = 0; i < runs; ++i) {
+					CPU cpu;
+					total += cpu.run(memory, 1000000000);
+				}
+				return total;
+			});
+
+			benchmarks.emplace_back("stepbystep/create_and_finish", [](const uint64_t coroutines) {
+				uint64_t total = 0;
+				for (uint64_t i = 0; i < coroutines; ++i) {
+					auto steps = three_steps();
+					total += steps();
+					total += steps();
+					total += steps();
+				}
+				return total;
+			});
+
+			benchmarks.emplace_back("stepbystep/resume", [](const uint64_t resumes) {
+				auto steps = endless_steps();
+				uint64_t total = 0;
+				for (uint64_t i = 0; i < resumes; ++i)
+					total += steps();
+				return total;
+			});
+
+			benchmarks.emplace_back("memory/read", [](const uint64_t reads) {
+				const MemoryChip memory = counter_program();
+				uint64_t total = 0;
+				for (uint64_t i = 0; i < reads; ++i)
+					total += memory.read(i & (MemoryChip::size - 1));
+				return total;
+			});
+
+			benchmarks.emplace_back("memory/write", [](const uint64_t writes) {
+				MemoryChip memory;
+				for (uint64_t i = 0; i < writes; ++i)
+					memory.write(i & (MemoryChip::size - 1), static_cast<uint8_t>(i));
+				return uint64_t(memory.read(0)) + memory.code_version;
+			});
+
+			benchmarks.emplace_back("memory/write_watched_code", [](const uint64_t writes) {
+				MemoryChip memory;
+				memory.watch_code(0, 256);
+				for (uint64_t i = 0; i < writes; ++i)
+					memory.write(i & 0xFF, static_cast<uint8_t>(i));
+				return uint64_t(memory.read(0)) + memory.code_version;
+			});
+
+			for (const Engine engine : { Engine::microcode, Engine::coroutines })
+				benchmarks.emplace_back(std::string("reset/") + engine_name(engine), [engine](const uint64_t resets) {
+					CPU cpu(engine);
+					uint64_t total = 0;
+					for (uint64_t i = 0; i < resets; ++i) {
+						cpu.reset();
+						total += cpu.program_counter;
+					}
+					return total;
+				});
+
+			// A fork, a few instructions on it, throw it away: the search workloads do that all the time.
+			benchmarks.emplace_back("fork/MemoryChip", [](const uint64_t forks) {
+				const MemoryChip memory = quiz_program();
+				uint64_t total = 0;
+				for (uint64_t i = 0; i < forks; ++i) {
+					CPU cpu;
+					MemoryChip fork = memory;
+					total += cpu.run(fork, 6);
+				}
+				return total;
+			});
+
+			benchmarks.emplace_back("fork/PagedMemoryChip", [](const uint64_t forks) {
+				const PagedMemoryChip memory(quiz_program());
+				uint64_t total = 0;
+				for (uint64_t i = 0; i < forks; ++i) {
+					CPU cpu;
+					PagedMemoryChip fork = memory;
+					total += cpu.run(fork, 6);
+				}
+				return total;
+			});
+
+			// The same Assembler for every program, as a generator of random programs would do.
+			benchmarks.emplace_back("assemble/quiz", [](const uint64_t programs) {
+				static constexpr const char* source =
+					"loop:   LD sum\n"
+					"        ADD counter\n"
+					"        ST sum\n"
+					"        LD counter\n"
+					"        SUB one\n"
+					"        ST counter\n"
+					"        JZE done\n"
+					"        JMP loop\n"
+					"done:   LD sum\n"
+					"        HALT\n"
+					"one:     .byte 1\n"
+					"counter: .byte 4\n"
+					"sum:     .byte 0\n";
+				Assembler assembler;
+				MemoryChip memory;
+				uint64_t total = 0;
+				for (uint64_t i = 0; i < programs; ++i) {
+					assembler.assemble(source, memory);
+					total += assembler.end();
+				}
+				return total;
+			});
+
+			// The same run over and over: all but the 1st come from the cache. A hit costs the hash of the whole
+			// memory and a read of the record: it pays off when the run is longer than that.
+			benchmarks.emplace_back("cache/hit", [](const uint64_t runs) {
+				const std::string path = (std::filesystem::temp_directory_path() / "cheapu_benchmark_cache").string();
+				uint64_t total = 0;
+				{
+					ResultCache cache(path);
+					const MemoryChip program = quiz_program();
+					for (uint64_t i = 0; i < runs; ++i) {
+						CPU cpu;
+						MemoryChip memory = program;
+						total += cache.run(cpu, memory, 1000);
+					}
+				}
+				std::remove((path + ".data").c_str());
+				std::remove((path + ".index").c_str());
+				return total;
+			});
+
+			benchmarks.emplace_back("history/step", [](const uint64_t cycles) {
+				CPU cpu;
+				MemoryChip memory = counter_program();
+				History history(cpu, memory);
+				return history.run(cycles) + cpu.accumulator;
+			});
+
+			// Half of the times within the last interval (undo log), half from an older checkpoint.
+			benchmarks.emplace_back("history/step_back_1000", [](const uint64_t steps) {
+				CPU cpu;
+				MemoryChip memory = counter_program();
+				History history(cpu, memory);
+				history.run(3000);
+				uint64_t total = 0;
+				for (uint64_t i = 0; i < steps; ++i) {
+					history.step_back(1000);
+					total += history.run(1000);
+				}
+				return total;
+			});
+
+			benchmarks.emplace_back("snapshot/restore", [](const uint64_t restores) {
+				CPU cpu;
+				MemoryChip memory = quiz_program();
+				cpu.run_cycles(memory, 41);
+				const Snapshot snapshot = take_snapshot(cpu, memory);
+				uint64_t total = 0;
+				for (uint64_t i = 0; i < restores; ++i) {
+					restore_snapshot(snapshot, cpu, memory);
+					cpu.cycle(memory);  // So that every restore has something to undo.
+					total += cpu.accumulator;
+				}
+				return total;
+			});
+
+			return benchmarks;
+		}
+	}
+
+	void micro_benchmarks(std::ostream& out, const std::string& filter)
+	{
+		out << std::left << std::setw(36) << "benchmark" << std::right
+			<< std::setw(12) << "ns/op" << std::setw(14) << "Mop/s" << std::setw(16) << "spread" << "\n";
+
+		for (const auto& [name, benchmark] : all_benchmarks()) {
+			if (name.find(filter) == std::string::npos)
+				continue;
+
+			const Timing t = measure(benchmark);
+			out << std::left << std::setw(36) << name << std::right << std::fixed
+				<< std::setprecision(2) << std::setw(12) << t.median_ns
+				<< std::setprecision(1) << std::setw(14) << 1000.0 / t.median_ns
+				<< std::setw(16) << spread(t) << "\n";
+		}
+	}
+
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+
+namespace CheaPU {
+
+	/** Times the hot paths of the simulation, one at a time: CPU::cycle on the README programs (with both engines),
+	    every opcode alone, CPU::run, the StepByStep coroutines, the memory access and the reset.
+
+		Each benchmark is calibrated to run for a while, then repeated a few times. The line it prints has
+		the median time per operation (an "operation" is whatever the benchmark name says: a cycle, an
+		instruction, a read...), its rate per second and how far the slowest and fastest runs were from the median.
+		The median is what to compare between builds; if the spread is more than a few %, the machine was busy.
+
+		Only the benchmarks with filter in their name run (empty filter: all of them). */
+	void micro_benchmarks(std::ostream& out, const std::string& filter);
+
+}
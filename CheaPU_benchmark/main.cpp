@@ -0,0 +1,31 @@
+#include "BatchScaling.h"
+#include "MicroBenchmarks.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+/** Usage: 
+        CheaPU_benchmark micro [name filter]
+		CheaPU_benchmark scaling [jobs [cycles per job]]
+	With no arguments, runs both with the defaults. */
+int main(int argc, char* argv[]) {
+	const std::string what = argc > 1 ? argv[1] : "";
+
+	if (what.empty() || what == "micro") {
+		const std::string filter = argc > 2 ? argv[2] : "";
+		CheaPU::micro_benchmarks(std::cout, filter);
+		std::cout << "\n";
+	}
+
+	if (what.empty() || what == "scaling") {
+		const size_t jobs = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 2000;
+		const uint64_t cycles = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 1000000;
+
+		const bool ok = CheaPU::batch_scaling(std::cout, jobs, cycles);
+		if (!ok)
+			return 1;
+	}
+
+	return 0;
+}
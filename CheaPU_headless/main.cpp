@@ -0,0 +1,317 @@
+#include "CPU.h"
+#include "ImageLoader.h"
+#include "InfiniteLoopDetector.h"
+#include "MemoryChip.h"
+#include "Profiler.h"
+#include "ResultCache.h"
+#include "Snapshot.h"
+#include "SymbolMap.h"
+#include "Trace.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+/** Runs a program with no window: load the memory, run, print the final state.
+    For the machines with no display (and for those with no patience for the front panel).
+
+	Usage: CheaPU_headless (<memory image> | --load <file>) [--base N] [--format raw|ihex|text] [--cycles N] [--coroutines] [--dump] [--counters] [--profile] [--folded <file>] [--symbols <map>] [--trace <file>] [--detect-loops] [--cache <file>] [--save <file>]
+
+	The image is loaded from the --base address (default 0). The format comes from the extension
+	(see CheaPU::load_image()), unless --format says otherwise: the raw content of the memory,
+	Intel HEX or bytes in hex text.
+	Without --cycles, it runs until the error flag goes up (HALT or illegal opcode), or until the program
+	sits in an idle loop (see CPU::idle()): it doesn't go on forever, the skipped cycles are counted instead.
+	--base and --cycles take a number and nothing else (--base also in hex, 0x...).
+	--coroutines uses Engine::coroutines instead of the microcode.
+	--dump prints the 1st 256 bytes of the memory at the end.
+	--counters prints the PerformanceCounters (only if compiled with CHEAPU_PERFORMANCE_COUNTERS).
+	--profile runs with the Profiler and prints its report.
+	--folded <file> also writes the profile for flamegraph.pl in the file.
+	--symbols <map> shows the labels of the symbol map written by CheaPU_assembler in the profile.
+	--trace <file> records every instruction in the file (see TraceRecorder, read it with CheaPU_tracedump).
+	--detect-loops stops the program as soon as it is proved that it never halts (see InfiniteLoopDetector),
+	and prints how long the loop is.
+	--cache <file> looks for the result in a ResultCache (file.data and file.index, created if not there) before running,
+	and puts it there after. It prints the hit rate of the cache, over all the runs that used it.
+	Only one of --profile, --trace, --detect-loops and --cache at a time: the others have to really run the program.
+	--load <file> starts from a snapshot instead of a memory image (see Snapshot), --save <file> saves one at the end.
+	Together with --cycles, they allow to run a long program a bit at a time. */
+
+namespace {
+
+	struct Options {
+		std::string image;
+		size_t base = 0;
+		CheaPU::ImageFormat format = CheaPU::ImageFormat::guess;
+		uint64_t max_cycles = UINT64_MAX;
+		CheaPU::Engine engine = CheaPU::Engine::microcode;
+		bool dump = false;
+		bool counters = false;
+		bool profile = false;
+		std::string folded;
+		std::string symbols;
+		std::string trace;
+		bool detect_loops = false;
+		std::string cache;
+		std::string load;
+		std::string save;
+	};
+
+	/** Reads a whole argument as an unsigned number, in the base of strtoull() (0: decimal, 0x... or 0...).
+		False if there is anything else in it: no digit, a sign, something after the digits, too big. */
+	bool parse_number(const char* text, const int base, uint64_t& number)
+	{
+		if (*text < '0' || *text > '9')  // strtoull() would take spaces and signs.
+			return false;
+		char* end;
+		errno = 0;
+		number = std::strtoull(text, &end, base);
+		return *end == '\0' && errno != ERANGE;
+	}
+
+	bool parse_arguments(const int argc, char* argv[], Options& options)
+	{
+		for (int i = 1; i < argc; ++i) {
+			const std::string argument = argv[i];
+			if (argument == "--base" && i + 1 < argc) {
+				uint64_t base;
+				if (!parse_number(argv[++i], 0, base) || base > SIZE_MAX)
+					return false;
+				options.base = static_cast<size_t>(base);
+			}
+			else if (argument == "--format" && i + 1 < argc) {
+				const std::string format = argv[++i];
+				if (format == "raw")
+					options.format = CheaPU::ImageFormat::raw;
+				else if (format == "ihex")
+					options.format = CheaPU::ImageFormat::intel_hex;
+				else if (format == "text")
+					options.format = CheaPU::ImageFormat::hex_text;
+				else
+					return false;
+			}
+			else if (argument == "--cycles" && i + 1 < argc) {
+				if (!parse_number(argv[++i], 10, options.max_cycles))
+					return false;
+			}
+			else if (argument == "--coroutines")
+				options.engine = CheaPU::Engine::coroutines;
+			else if (argument == "--dump")
+				options.dump = true;
+			else if (argument == "--counters")
+				options.counters = true;
+			else if (argument == "--profile")
+				options.profile = true;
+			else if (argument == "--folded" && i + 1 < argc) {
+				options.profile = true;
+				options.folded = argv[++i];
+			}
+			else if (argument == "--symbols" && i + 1 < argc)
+				options.symbols = argv[++i];
+			else if (argument == "--trace" && i + 1 < argc)
+				options.trace = argv[++i];
+			else if (argument == "--detect-loops")
+				options.detect_loops = true;
+			else if (argument == "--cache" && i + 1 < argc)
+				options.cache = argv[++i];
+			else if (argument == "--load" && i + 1 < argc)
+				options.load = argv[++i];
+			else if (argument == "--save" && i + 1 < argc)
+				options.save = argv[++i];
+			else if (options.image.empty() && argument.rfind("--", 0) != 0)
+				options.image = argument;
+			else
+				return false;
+		}
+
+		const int runners = options.profile + !options.trace.empty() + options.detect_loops + !options.cache.empty();
+		return options.image.empty() != options.load.empty() && runners <= 1;
+	}
+
+	void print_state(std::ostream& out, const CheaPU::CPU& cpu)
+	{
+		out << std::hex << std::setfill('0') << std::uppercase
+			<< "PC 0x" << std::setw(2) << +cpu.program_counter
+			<< "  ACC 0x" << std::setw(2) << +cpu.accumulator
+			<< std::dec
+			<< "  OVER " << cpu.overflow()
+			<< "  ZERO " << cpu.zero()
+			<< "  ERROR " << +cpu.error
+			<< (cpu.idle() ? "  (idle loop)" : "") << "\n"
+			<< std::setfill(' ') << std::nouppercase;
+	}
+
+	void dump_memory(std::ostream& out, const CheaPU::MemoryChip& memory)
+	{
+		out << std::hex << std::setfill('0') << std::uppercase;
+		for (size_t address = 0; address < 256; address += 16) {
+			out << std::setw(2) << address << ":";
+			for (size_t i = address; i < address + 16; ++i)
+				out << " " << std::setw(2) << +memory.read(i);
+			out << "\n";
+		}
+		out << std::dec << std::setfill(' ') << std::nouppercase;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	Options options;
+	if (!parse_arguments(argc, argv, options)) {
+		std::cerr << "Usage: CheaPU_headless (<memory image> | --load <file>) [--base N] [--format raw|ihex|text] [--cycles N] [--coroutines] [--dump] [--counters] [--profile] [--folded <file>] [--symbols <map>] [--trace <file>] [--detect-loops] [--cache <file>] [--save <file>]\n";
+		return 2;
+	}
+
+	CheaPU::MemoryChip memory;
+	CheaPU::CPU cpu(options.engine);
+	if (!options.load.empty()) {
+		try {
+			std::ifstream file(options.load, std::ios::binary);
+			CheaPU::restore_snapshot(CheaPU::read_snapshot(file), cpu, memory);
+		}
+		catch (const std::exception& e) {
+			std::cerr << "Can't load " << options.load << ": " << e.what() << "\n";
+			return 1;
+		}
+	}
+	else {
+		try {
+			CheaPU::load_image(options.image, memory, options.base, options.format);
+		}
+		catch (const std::runtime_error& e) {
+			std::cerr << options.image << ": " << e.what() << "\n";
+			return 1;
+		}
+	}
+
+	CheaPU::SymbolMap symbols;
+	if (!options.symbols.empty()) {
+		try {
+			std::ifstream file(options.symbols);
+			if (!file)
+				throw std::runtime_error("Can't open it.");
+			symbols = CheaPU::SymbolMap::read(file);
+		}
+		catch (const std::runtime_error& e) {
+			std::cerr << options.symbols << ": " << e.what() << "\n";
+			return 1;
+		}
+	}
+
+	CheaPU::Profiler profiler;
+	CheaPU::InfiniteLoopDetector detector;
+	const CheaPU::MemoryChip program = memory;
+
+	std::ofstream trace_file;
+	std::unique_ptr<CheaPU::TraceRecorder> trace;
+	if (!options.trace.empty()) {
+		trace_file.open(options.trace, std::ios::binary);
+		if (!trace_file) {
+			std::cerr << "Can't write " << options.trace << "\n";
+			return 1;
+		}
+		trace = std::make_unique<CheaPU::TraceRecorder>(trace_file);
+	}
+
+	std::unique_ptr<CheaPU::ResultCache> cache;
+	if (!options.cache.empty()) {
+		try {
+			cache = std::make_unique<CheaPU::ResultCache>(options.cache);
+		}
+		catch (const std::exception& e) {
+			std::cerr << "Can't open the cache " << options.cache << ": " << e.what() << "\n";
+			return 1;
+		}
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	uint64_t cycles;
+	if (options.profile)
+		cycles = profiler.run(cpu, memory, options.max_cycles);
+	else if (trace)
+		cycles = trace->run(cpu, memory, options.max_cycles);
+	else if (options.detect_loops)
+		cycles = detector.run(cpu, memory, options.max_cycles);
+	else if (cache) {
+		try {
+			cycles = cache->run(cpu, memory, options.max_cycles);
+		}
+		catch (const std::runtime_error& e) {
+			std::cerr << "Cache " << options.cache << ": " << e.what() << "\n";
+			return 1;
+		}
+	}
+	else
+		cycles = cpu.run_cycles(memory, options.max_cycles);
+	const auto end = std::chrono::steady_clock::now();
+
+	const double seconds = std::chrono::duration<double>(end - start).count();
+
+	print_state(std::cout, cpu);
+	std::cout << "Cycles " << cycles << " in " << std::fixed << std::setprecision(3) << seconds * 1000 << " ms";
+	if (seconds > 0 && !(cache && cache->last_was_hit))  // Nothing ran: no speed to speak of.
+		std::cout << " (" << std::setprecision(1) << cycles / seconds / 1e6 << " Mcycles/s)";
+	std::cout << "\n";
+	std::cout << "Memory digest " << std::hex << memory.digest() << std::dec << "\n";
+
+	if (cache)
+		std::cout << "Cache " << (cache->last_was_hit ? "hit" : "miss") << ", " << cache->size() << " results, "
+			<< cache->hits() << " hits out of " << cache->hits() + cache->misses() << " runs ("
+			<< std::setprecision(1) << 100 * cache->hit_rate() << "%)\n";
+
+	if (detector.looping())
+		std::cout << "Infinite loop: " << detector.period_instructions << " instructions, "
+			<< detector.period_cycles << " cycles around\n";
+
+	if (trace) {
+		trace->flush();
+		std::cout << "Trace " << trace->records() << " instructions\n";
+		if (!trace_file) {
+			std::cerr << "Can't write " << options.trace << "\n";
+			return 1;
+		}
+	}
+
+	if (!options.save.empty()) {
+		try {
+			std::ofstream file(options.save, std::ios::binary);
+			CheaPU::write_snapshot(file, CheaPU::take_snapshot(cpu, memory));
+		}
+		catch (const std::exception& e) {
+			std::cerr << "Can't save " << options.save << ": " << e.what() << "\n";
+			return 1;
+		}
+	}
+
+	if (options.dump)
+		dump_memory(std::cout, memory);
+
+	// The code may have changed while running, the profile refers to the original.
+	if (options.profile)
+		profiler.report(std::cout, program, symbols);
+
+	if (!options.folded.empty()) {
+		std::ofstream folded(options.folded);
+		profiler.folded_stacks(folded, program, symbols);
+		if (!folded) {
+			std::cerr << "Can't write " << options.folded << "\n";
+			return 1;
+		}
+	}
+
+	if (options.counters)
+#ifdef CHEAPU_PERFORMANCE_COUNTERS
+		std::cout << cpu.counters;
+#else
+		std::cout << "No performance counters in this build (define CHEAPU_PERFORMANCE_COUNTERS).\n";
+#endif
+
+	return 0;
+}
@@ -0,0 +1,318 @@
+#include "pch.h"
+#include "Assembler.h"
+
+#include "CPU.h"
+#include "MemoryChip.h"
+
+#include <algorithm>
+#include <cctype>
+
+namespace CheaPU {
+
+	namespace {
+
+		struct Mnemonic {
+			std::string_view name;
+			Opcode opcode;
+			bool operand;
+		};
+
+		constexpr Mnemonic mnemonics[] = {
+			{ "NOP", Opcode::NOP, false },
+			{ "LD", Opcode::LD, true },
+			{ "ST", Opcode::ST, true },
+			{ "ADD", Opcode::ADD, true },
+			{ "HALT", Opcode::HALT, false },
+			{ "JMP", Opcode::JMP, true },
+			{ "JZE", Opcode::JZE, true },
+			{ "SUB", Opcode::SUB, true }
+		};
+
+		bool is_space(const char c)
+		{
+			return c == ' ' || c == '\t' || c == '\r';
+		}
+
+		bool is_symbol_start(const char c)
+		{
+			return std::isalpha(static_cast<unsigned char>(c)) || c == '_';
+		}
+
+		bool is_symbol_char(const char c)
+		{
+			return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+		}
+
+		std::string_view trim(std::string_view text)
+		{
+			while (!text.empty() && is_space(text.front()))
+				text.remove_prefix(1);
+			while (!text.empty() && is_space(text.back()))
+				text.remove_suffix(1);
+			return text;
+		}
+
+		/** The symbol (or mnemonic, or directive) at the start of the text. Empty if there is none. */
+		std::string_view leading_word(std::string_view text)
+		{
+			size_t length = 0;
+			if (!text.empty() && (is_symbol_start(text[0]) || text[0] == '.'))
+				for (length = 1; length < text.size() && is_symbol_char(text[length]); ++length);
+			return text.substr(0, length);
+		}
+
+		bool same_ignoring_case(const std::string_view a, const std::string_view b)
+		{
+			return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](const char x, const char y) {
+				return std::toupper(static_cast<unsigned char>(x)) == std::toupper(static_cast<unsigned char>(y));
+			});
+		}
+
+		/** -1 if not a digit in the base. */
+		int digit_value(const char c, const int base)
+		{
+			int value = 99;
+			if (c >= '0' && c <= '9')
+				value = c - '0';
+			else if (c >= 'a' && c <= 'f')
+				value = c - 'a' + 10;
+			else if (c >= 'A' && c <= 'F')
+				value = c - 'A' + 10;
+			return value < base ? value : -1;
+		}
+	}
+
+	AssemblyError::AssemblyError(const size_t line, const std::string& message) :
+		std::runtime_error("line " + std::to_string(line) + ": " + message),
+		line(line)
+	{
+	}
+
+	Assembler::Assembler() :
+		symbol_count(0),
+		line(0),
+		address(0),
+		highest(0)
+	{
+	}
+
+	void Assembler::assemble(std::string_view source, MemoryChip& memory)
+	{
+		symbol_count = 0;  // The old entries stay, to reuse their names (and the memory of the strings).
+		fixups.clear();
+		line = 0;
+		address = 0;
+		highest = 0;
+
+		while (!source.empty()) {
+			const size_t end_of_line = std::min(source.find('\n'), source.size());
+			++line;
+			assemble_line(source.substr(0, end_of_line), memory);
+			source.remove_prefix(std::min(end_of_line + 1, source.size()));
+		}
+
+		for (const Fixup& fixup : fixups) {
+			const Symbol& s = symbols[fixup.symbol];
+			if (!s.defined)
+				throw AssemblyError(s.line, "undefined symbol " + s.name);
+
+			line = fixup.line;
+			const int32_t value = s.value + fixup.addend;
+			if (value < fixup.minimum || value > 255)
+				error("value out of range: " + std::to_string(value));
+			memory[fixup.address] = static_cast<uint8_t>(value);
+		}
+	}
+
+	size_t Assembler::end() const
+	{
+		return highest;
+	}
+
+	SymbolMap Assembler::symbol_map() const
+	{
+		SymbolMap map;
+		for (size_t i = 0; i < symbol_count; ++i) {
+			const Symbol& s = symbols[i];
+			if (s.defined && s.label)
+				map.labels[s.name] = static_cast<uint16_t>(s.value);  // Addresses: never negative.
+			else if (s.defined)
+				map.constants[s.name] = s.value;
+		}
+		return map;
+	}
+
+	void Assembler::assemble_line(std::string_view text, MemoryChip& memory)
+	{
+		text = trim(text.substr(0, text.find(';')));
+
+		// Labels, any number of them.
+		std::string_view word = leading_word(text);
+		while (!word.empty() && word[0] != '.' && trim(text.substr(word.size())).starts_with(':')) {
+			define(word, static_cast<int32_t>(address), true);
+			text = trim(trim(text.substr(word.size())).substr(1));
+			word = leading_word(text);
+		}
+
+		if (text.empty())
+			return;
+		if (word.empty())
+			error("expected an instruction, a directive or a label");
+
+		std::string_view rest = trim(text.substr(word.size()));
+
+		// Constant.
+		if (word[0] != '.' && rest.starts_with('=')) {
+			const Value value = expression(rest.substr(1));
+			if (value.pending_symbol >= 0)
+				error("a constant can't depend on a symbol defined later");
+			define(word, value.number, false);
+			return;
+		}
+
+		if (same_ignoring_case(word, ".org")) {
+			const Value value = expression(rest);
+			if (value.pending_symbol >= 0)
+				error(".org can't depend on a symbol defined later");
+			if (value.number < 0 || value.number >= static_cast<int32_t>(MemoryChip::size))
+				error(".org outside of the memory");
+			address = static_cast<size_t>(value.number);
+			return;
+		}
+
+		if (same_ignoring_case(word, ".byte")) {
+			while (true) {
+				const size_t comma = std::min(rest.find(','), rest.size());
+				emit(memory, expression(rest.substr(0, comma)), -128);
+				if (comma == rest.size())
+					return;
+				rest.remove_prefix(comma + 1);
+			}
+		}
+
+		for (const Mnemonic& m : mnemonics)
+			if (same_ignoring_case(word, m.name)) {
+				emit_byte(memory, to_word(m.opcode));
+				if (m.operand)
+					emit(memory, expression(rest), 0);
+				else if (!rest.empty())
+					error(std::string(m.name) + " has no operand");
+				return;
+			}
+
+		error("unknown instruction " + std::string(word));
+	}
+
+	void Assembler::define(std::string_view name, const int32_t value, const bool label)
+	{
+		Symbol& s = symbols[symbol(name)];
+		if (s.defined)
+			error("symbol defined twice: " + s.name);
+
+		s.value = value;
+		s.defined = true;
+		s.label = label;
+	}
+
+	uint32_t Assembler::symbol(std::string_view name)
+	{
+		// Programs have a handful of symbols: a linear search beats hashing them.
+		for (uint32_t i = 0; i < symbol_count; ++i)
+			if (symbols[i].name == name)
+				return i;
+
+		if (symbol_count == symbols.size())
+			symbols.emplace_back();
+		Symbol& s = symbols[symbol_count];
+		s.name.assign(name);  // No allocation if an earlier program had a name as long in this entry.
+		s.value = 0;
+		s.defined = false;
+		s.label = false;
+		s.line = line;
+		return static_cast<uint32_t>(symbol_count++);
+	}
+
+	Assembler::Value Assembler::expression(std::string_view text)
+	{
+		Value value{ 0, -1 };
+		text = trim(text);
+		if (text.empty())
+			error("missing value");
+
+		int32_t sign = 1;
+		if (text[0] == '-' || text[0] == '+') {
+			sign = text[0] == '+' ? 1 : -1;
+			text = trim(text.substr(1));
+		}
+
+		while (true) {
+			const std::string_view word = leading_word(text);
+			if (!word.empty() && word[0] != '.') {
+				const uint32_t index = symbol(word);
+				if (symbols[index].defined)
+					value.number += sign * symbols[index].value;
+				else if (value.pending_symbol < 0 && sign > 0)
+					value.pending_symbol = index;
+				else
+					error("too many symbols defined later in one expression");
+				text.remove_prefix(word.size());
+			}
+			else {
+				int base = 10;
+				if (text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X'))
+					base = 16;
+				else if (text.size() > 2 && text[0] == '0' && (text[1] == 'b' || text[1] == 'B'))
+					base = 2;
+				if (base != 10)
+					text.remove_prefix(2);
+
+				int32_t number = 0;
+				size_t digits = 0;
+				for (int d; digits < text.size() && (d = digit_value(text[digits], base)) >= 0; ++digits) {
+					number = number * base + d;
+					if (number > 0xFFFF)
+						error("number too big");
+				}
+				if (digits == 0)
+					error("expected a number or a symbol in '" + std::string(text) + "'");
+				value.number += sign * number;
+				text.remove_prefix(digits);
+			}
+
+			text = trim(text);
+			if (text.empty())
+				return value;
+			if (text[0] != '+' && text[0] != '-')
+				error("unexpected '" + std::string(text) + "'");
+			sign = text[0] == '+' ? 1 : -1;
+			text = trim(text.substr(1));
+		}
+	}
+
+	void Assembler::emit(MemoryChip& memory, const Value value, const int32_t minimum)
+	{
+		if (value.pending_symbol >= 0) {
+			fixups.push_back({ static_cast<uint16_t>(address), static_cast<uint32_t>(value.pending_symbol), value.number, minimum, line });
+			emit_byte(memory, 0);
+			return;
+		}
+
+		if (value.number < minimum || value.number > 255)
+			error("value out of range: " + std::to_string(value.number));
+		emit_byte(memory, static_cast<uint8_t>(value.number));
+	}
+
+	void Assembler::emit_byte(MemoryChip& memory, const uint8_t byte)
+	{
+		if (address >= MemoryChip::size)
+			error("the program does not fit in the memory");
+		memory[address] = byte;
+		highest = std::max(highest, ++address);
+	}
+
+	void Assembler::error(const std::string& message) const
+	{
+		throw AssemblyError(line, message);
+	}
+
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "SymbolMap.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace CheaPU {
+
+	class MemoryChip;
+
+	/** What went wrong, and on which line (from 1). */
+	class AssemblyError : public std::runtime_error {
+	public:
+		AssemblyError(const size_t line, const std::string& message);
+
+		const size_t line;
+	};
+
+	/** Turns the mnemonics of the Opcode enum into machine code, so that nobody has to do it by hand anymore.
+
+		    ; The quiz from the README.
+		    STEP = 1                 ; A constant.
+		    loop:   LD sum           ; A label, then an instruction.
+		            ADD counter
+		            ST sum
+		            LD counter
+		            SUB one
+		            ST counter
+		            JZE done
+		            JMP loop
+		    done:   LD sum
+		            HALT
+		    one:     .byte STEP       ; Data.
+		    counter: .byte 4
+		    sum:     .byte 0
+
+		- Mnemonics and directives don't care about the case, symbols do.
+		- Numbers are decimal, 0x hex or 0b binary. The operands can be expressions with + and -
+		  (e.g. "LD table + 2"), with at most one symbol still to be defined.
+		- .byte takes a list of values, separated by commas (-128 to 255).
+		- .org moves to another address (e.g. ".org 0x40"): the following code or data goes there.
+
+		A single pass over the source: a symbol that is not defined yet leaves a hole, filled at the end
+		(a "fixup"). The symbols and the fixups of a program are kept for the next one, names included:
+		there are no allocations once they are as big as the largest program (and its longest names),
+		unless there is an error to report. So the same Assembler can go through many thousands of programs per second. */
+	class Assembler {
+	public:
+		Assembler();
+
+		/** Puts the program in the memory. What the program does not mention is left as it was.
+		    Throws AssemblyError. */
+		void assemble(std::string_view source, MemoryChip& memory);
+
+		/** One after the highest address written by the last program. */
+		size_t end() const;
+
+		/** Labels and constants of the last program. */
+		SymbolMap symbol_map() const;
+
+	private:
+		struct Symbol {
+			std::string name;
+			int32_t value;   ///< Signed, like the expressions: constants can be negative.
+			bool defined;
+			bool label;
+			size_t line;   ///< The first use, for the "undefined" error.
+		};
+
+		/** A hole to fill at the end, with the value of a symbol plus the rest of the expression. */
+		struct Fixup {
+			uint16_t address;
+			uint32_t symbol;
+			int32_t addend;
+			int32_t minimum;  ///< Smallest acceptable value: -128 for data, 0 for operands.
+			size_t line;
+		};
+
+		/** The value of an expression, or the symbol it still waits for. */
+		struct Value {
+			int32_t number;
+			int64_t pending_symbol;  ///< -1 if none.
+		};
+
+		std::vector<Symbol> symbols;  ///< Only the 1st symbol_count are the current program's, the others wait to be reused.
+		size_t symbol_count;
+		std::vector<Fixup> fixups;
+		size_t line;
+		size_t address;
+		size_t highest;
+
+		void assemble_line(std::string_view text, MemoryChip& memory);
+		void define(std::string_view name, const int32_t value, const bool label);
+		uint32_t symbol(std::string_view name);
+		Value expression(std::string_view text);
+		void emit(MemoryChip& memory, const Value value, const int32_t minimum);
+		void emit_byte(MemoryChip& memory, const uint8_t byte);
+		[[noreturn]] void error(const std::string& message) const;
+	};
+
+}
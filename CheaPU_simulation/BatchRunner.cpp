@@ -0,0 +1,129 @@
+#include "pch.h"
+#include "BatchRunner.h"
+
+#include "CPU.h"
+#include "InfiniteLoopDetector.h"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace CheaPU {
+
+	namespace {
+
+		/** Indexes of the jobs still to run by one thread. The owner takes from the back,
+		    the thieves from the front, so that they rarely want the same jobs. */
+		struct WorkQueue {
+			std::mutex lock;
+			std::deque<size_t> jobs;
+
+			bool pop(size_t& job)
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				if (jobs.empty())
+					return false;
+				job = jobs.back();
+				jobs.pop_back();
+				return true;
+			}
+
+			/** Moves half of the jobs (rounded up) to the thief. */
+			bool steal_into(WorkQueue& thief)
+			{
+				std::scoped_lock guard(lock, thief.lock);
+				if (jobs.empty())
+					return false;
+				const size_t half = (jobs.size() + 1) / 2;
+				thief.jobs.insert(thief.jobs.end(), jobs.begin(), jobs.begin() + half);
+				jobs.erase(jobs.begin(), jobs.begin() + half);
+				return true;
+			}
+		};
+
+		BatchResult run_job(const BatchJob& job, const bool detect_loops)
+		{
+			CPU cpu;
+			MemoryChip memory = job.memory;
+			BatchResult result;
+			result.loop_period = 0;
+
+			if (detect_loops) {
+				InfiniteLoopDetector detector;
+				result.cycles = detector.run(cpu, memory, job.max_cycles);
+				result.loop_period = detector.period_instructions;
+			}
+			else
+				result.cycles = cpu.run_cycles(memory, job.max_cycles);
+			result.program_counter = cpu.program_counter;
+			result.accumulator = cpu.accumulator;
+			result.overflow = cpu.overflow();
+			result.zero = cpu.zero();
+			result.error = cpu.error;
+			result.memory_digest = memory.digest();
+
+			return result;
+		}
+	}
+
+	BatchRunner::BatchRunner(const unsigned threads) :
+		steals(0),
+		detect_loops(false),
+		thread_count(threads)
+	{
+		if (thread_count == 0)
+			thread_count = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	unsigned BatchRunner::threads() const
+	{
+		return thread_count;
+	}
+
+	std::vector<BatchResult> BatchRunner::run(const std::vector<BatchJob>& jobs)
+	{
+		std::vector<BatchResult> results(jobs.size());
+		std::atomic<uint64_t> stolen = 0;
+
+		// No point in threads that would start with nothing to do.
+		const size_t workers = std::min<size_t>(thread_count, jobs.size());
+		std::vector<std::unique_ptr<WorkQueue>> queues;
+		for (size_t w = 0; w < workers; ++w) {
+			queues.push_back(std::make_unique<WorkQueue>());
+			for (size_t job = w * jobs.size() / workers; job < (w + 1) * jobs.size() / workers; ++job)
+				queues.back()->jobs.push_back(job);
+		}
+
+		// Nobody adds jobs while running: when all the queues are empty, it is over.
+		auto work = [&](const size_t me) {
+			size_t job;
+			while (true) {
+				while (queues[me]->pop(job))
+					results[job] = run_job(jobs[job], detect_loops);
+
+				bool found = false;
+				for (size_t i = 1; i < workers && !found; ++i)
+					found = queues[(me + i) % workers]->steal_into(*queues[me]);
+
+				if (!found)
+					return;
+				++stolen;
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for (size_t w = 1; w < workers; ++w)
+			threads.emplace_back(work, w);
+		if (workers > 0)
+			work(0);  // This thread works too.
+		for (std::thread& t : threads)
+			t.join();
+
+		steals = stolen;
+		return results;
+	}
+
+}
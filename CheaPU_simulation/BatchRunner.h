@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "MemoryChip.h"
+
+namespace CheaPU {
+
+	/** A program to run: the initial memory, and for how long. */
+	struct BatchJob {
+		MemoryChip memory;
+		uint64_t max_cycles;
+	};
+
+	/** How a BatchJob ended. The memory is not kept, only its MemoryChip::digest(). */
+	struct BatchResult {
+		uint8_t program_counter;
+		uint8_t accumulator;
+		uint8_t overflow;
+		uint8_t zero;
+		uint8_t error;
+
+		uint64_t cycles;
+		uint64_t memory_digest;
+
+		/** Instructions once around the infinite loop the job was stopped in (see BatchRunner::detect_loops).
+		    0 if it was not stopped. */
+		uint64_t loop_period;
+	};
+
+	/** Runs many independent programs on all the cores.
+
+		Every job gets its own CPU and its own copy of the memory, nothing is shared
+		but the list of jobs, so it should scale with the number of threads.
+		The programs may run for very different times (one halts at once, another loops
+		for the whole budget), so a fixed split of the jobs would leave threads idle.
+		Every thread starts with an equal slice of the jobs in its own queue, and when
+		it runs out, it steals half of what is left in the queue of another. */
+	class BatchRunner {
+	public:
+		/** 0 threads means one per core. */
+		explicit BatchRunner(const unsigned threads = 0);
+
+		unsigned threads() const;
+
+		/** Runs all the jobs, each with CPU::run_cycles() (or InfiniteLoopDetector::run()).
+		    @return the results, in the same order as the jobs. */
+		std::vector<BatchResult> run(const std::vector<BatchJob>& jobs);
+
+		/** How many times a thread took work from another in the last run(). */
+		uint64_t steals;
+
+		/** Run the jobs with the InfiniteLoopDetector: the programs that never halt stop as soon as that is proved,
+		    instead of burning their whole budget. Slower for the programs that do halt (one instruction at a time). */
+		bool detect_loops;
+
+	private:
+		unsigned thread_count;
+	};
+
+}
@@ -0,0 +1,195 @@
+#include "pch.h"
+#include "BlockCache.h"
+
+#include "MemoryChip.h"
+
+namespace CheaPU {
+
+	BlockCache::BlockCache() :
+		translated_memory(0),
+		code_version(0)
+	{
+		for (Block& block : blocks)
+			block.translated = false;
+	}
+
+	uint64_t BlockCache::run(CPU& cpu, MemoryChip& memory, const uint64_t max_instructions)
+	{
+		uint64_t cycles = 0;
+		uint64_t executed = 0;
+
+		// The blocks start at instruction boundaries, let the CPU finish what is in progress.
+		if (!cpu.error && max_instructions > 0 && !cpu.instruction_completed()) {
+			cycles += cpu.run(memory, 1);
+			++executed;
+		}
+
+		// The registers stay in local variables as long as the blocks run, and go back
+		// in the CPU only when it has to take over.
+		const uint8_t* const ram = memory.storage.data();
+		uint8_t pc = cpu.program_counter;
+		uint8_t acc = cpu.accumulator;
+		uint16_t alu = cpu.last_alu_result;
+		bool halted = cpu.error;
+
+		while (!halted && executed < max_instructions) {
+			if (translated_memory != memory.identity() || memory.code_version != code_version)
+				flush(memory);
+
+			Block& block = blocks[pc];
+			if (!block.translated)
+				translate(block, pc, memory);
+
+			const size_t block_size = block.instructions.size();
+			const uint64_t remaining = max_instructions - executed;
+			if (block_size == 0 || block_size > remaining) {
+				// Illegal opcode (it is up to the CPU to stop), or not enough instructions
+				// left to do the whole block.
+				cpu.program_counter = pc;
+				cpu.accumulator = acc;
+				cpu.last_alu_result = alu;
+				cycles += cpu.run(memory, block_size == 0 ? 1 : remaining);
+				executed += (block_size == 0 ? 1 : remaining);
+				pc = cpu.program_counter;
+				acc = cpu.accumulator;
+				alu = cpu.last_alu_result;
+				halted = cpu.error;
+				continue;
+			}
+
+			const DecodedInstruction* instruction = block.instructions.data();
+			const DecodedInstruction* const end = instruction + block_size;
+			for (; instruction != end; ++instruction) {
+				switch (instruction->opcode) {
+				case Opcode::NOP:
+					++pc;
+					cycles += 2;
+					break;
+				case Opcode::LD:
+					acc = ram[instruction->operand];
+					pc += 2;
+					cycles += 3;
+					break;
+				case Opcode::ST:
+					memory.write(instruction->operand, acc);
+					pc += 2;
+					cycles += 3;
+					if (memory.code_version != code_version) {
+						++instruction;
+						goto code_changed;  // Maybe even the rest of this very block.
+					}
+					break;
+				case Opcode::ADD:
+					alu = acc + ram[instruction->operand];
+					acc = static_cast<uint8_t>(alu);
+					pc += 2;
+					cycles += 3;
+					break;
+				case Opcode::SUB:
+					alu = static_cast<uint16_t>(acc - ram[instruction->operand]);
+					acc = static_cast<uint8_t>(alu);
+					pc += 2;
+					cycles += 3;
+					break;
+				case Opcode::JMP:
+					pc = instruction->operand;
+					cycles += 3;
+					break;
+				case Opcode::JZE:
+					if (acc == 0) {
+						pc = instruction->operand;
+						cycles += 3;
+					}
+					else {
+						pc += 2;
+						cycles += 2;
+					}
+					break;
+				case Opcode::HALT:
+					halted = true;
+					cycles += 2;
+					break;
+				}
+			}
+		code_changed:
+			executed += instruction - block.instructions.data();
+		}
+
+		cpu.program_counter = pc;
+		cpu.accumulator = acc;
+		cpu.last_alu_result = alu;
+		if (halted)
+			cpu.error = true;
+
+		return cycles;
+	}
+
+	void BlockCache::flush(MemoryChip& memory)
+	{
+		for (Block& block : blocks) {
+			block.translated = false;
+			block.instructions.clear();  // Keeps the capacity, no allocations when translating again.
+		}
+
+		memory.forget_code();
+		translated_memory = memory.identity();
+		code_version = memory.code_version;
+	}
+
+	void BlockCache::translate(Block& block, const uint8_t start, MemoryChip& memory)
+	{
+		const size_t end = decode_block(memory, start, block.instructions);
+		memory.watch_code(start, end);
+		block.translated = true;
+	}
+
+	size_t decode_block(const MemoryChip& memory, const uint8_t start, std::vector<DecodedInstruction>& instructions)
+	{
+		size_t address = start;
+		bool end_of_block = false;
+
+		// The program counter is 8 bits: an instruction that goes past 0xFF wraps it around
+		// to 0, so it has to be the last of the block.
+		while (!end_of_block && address <= 0xFF) {
+			const uint8_t opcode = memory.read(address);
+			DecodedInstruction instruction;
+			instruction.opcode = static_cast<Opcode>(opcode);
+			instruction.operand = 0;
+
+			switch (instruction.opcode) {
+			case Opcode::NOP:
+				address += 1;
+				break;
+			case Opcode::HALT:
+				address += 1;
+				end_of_block = true;
+				break;
+			case Opcode::JMP:
+			case Opcode::JZE:
+				instruction.operand = memory.read(address + 1);
+				address += 2;
+				end_of_block = true;
+				break;
+			case Opcode::LD:
+			case Opcode::ST:
+			case Opcode::ADD:
+			case Opcode::SUB:
+				instruction.operand = memory.read(address + 1);
+				address += 2;
+				break;
+			default:
+				// Illegal opcode: the block stops before it, but the byte is still
+				// part of it (to be watched, in case someone fixes it).
+				if (address == start)
+					address += 1;
+				end_of_block = true;
+				continue;
+			}
+
+			instructions.push_back(instruction);
+		}
+
+		return address;
+	}
+
+}
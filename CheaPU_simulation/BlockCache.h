@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "CPU.h"
+
+namespace CheaPU {
+
+	class MemoryChip;
+
+	/** An instruction, ready to execute. */
+	struct DecodedInstruction {
+		Opcode opcode;
+		uint8_t operand;
+	};
+
+	/** Decodes the basic block (see BlockCache) that starts at the given address into the list 
+	    of instructions, which is empty if the 1st is illegal.
+		@return the address after the last byte of the block. */
+	size_t decode_block(const MemoryChip& memory, const uint8_t start, std::vector<DecodedInstruction>& instructions);
+
+	/** Translation cache, to run the programs one "basic block" at a time.
+	
+		A block is a straight run of instructions up to the next JMP, JZE or HALT.
+		It is decoded once, the first time the program counter gets there, into
+		a list of opcodes and operands. After that, running the block does not look
+		at the opcodes in memory anymore. The programs for this machine are almost always
+		little loops, so they are decoded once and replayed over and over.
+
+		The blocks are stored by the address of their first instruction. The program counter
+		is only 8 bits, so this is a plain array.
+
+		The bytes of the translated code are watched by the MemoryChip: if something writes 
+		there (self-modifying code, or the front panel), the whole cache is thrown away. 
+		It does not happen often enough to bother with anything smarter.
+
+		The results are the same of CPU::run(), cycle count included. */
+	class BlockCache {
+	public:
+		BlockCache();
+
+		/** Same as CPU::run(), but trough the cache.
+		    Falls back to the CPU for illegal opcodes and for the last few instructions, 
+			when what is left of max_instructions is less than a whole block. */
+		uint64_t run(CPU& cpu, MemoryChip& memory, const uint64_t max_instructions);
+
+		/** Throw away all the blocks. */
+		void flush(MemoryChip& memory);
+
+	private:
+		struct Block {
+			bool translated;
+			std::vector<DecodedInstruction> instructions;  ///< Empty if it starts with an illegal opcode.
+		};
+
+		std::array<Block, 256> blocks;
+
+		/** @name What the blocks were translated from. */
+		/**@{*/
+		uint64_t translated_memory;  ///< MemoryChip::identity()
+		uint32_t code_version;
+		/**@}*/
+
+		void translate(Block& block, const uint8_t start, MemoryChip& memory);
+	};
+
+}
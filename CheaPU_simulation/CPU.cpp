@@ -2,68 +2,572 @@
 #include "CPU.h"
 
 #include "MemoryChip.h"
+#include "PagedMemoryChip.h"
 
 #include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
 
 namespace CheaPU {
 
+	namespace {
+
+		/** Builds the decode table for every possible byte in memory, with the given
+		    value for each legal opcode and the "illegal" value everywhere else.
+			Decoding becomes a single index in an array, rather than a chain of ifs. */
+		template <typename T, size_t N>
+		constexpr std::array<T, 256> dispatch_table(const T illegal, const std::pair<Opcode, T>(&handlers)[N])
+		{
+			std::array<T, 256> table{};
+			table.fill(illegal);
+			for (const auto& handler : handlers)
+				table[static_cast<uint8_t>(handler.first)] = handler.second;
+			return table;
+		}
+
+		/** The elementary steps of the instructions, for the Engine::microcode.
+		    Each takes exactly one machine cycle. */
+		enum class MicroOp : uint8_t {
+			fetch,                 ///< Fetch and decode the next instruction.
+			increment_pc,          ///< Skip over an instruction without operand.
+			read_operand,          ///< Latch the byte after the opcode.
+			load,                  ///< Accumulator = memory[operand].
+			store,                 ///< memory[operand] = accumulator.
+			add,                   ///< Accumulator += memory[operand].
+			subtract,              ///< Accumulator -= memory[operand].
+			halt,                  ///< Raise the error flag.
+			jump,                  ///< Program counter = operand.
+			read_operand_if_zero   ///< Latch the operand if the accumulator is 0, otherwise skip the instruction.
+		};
+
+		/** The "microcode ROM". The micro-programs of all the instructions, one after the other.
+		    Every one of them ends with a fetch: that is where the CPU is when the instruction is completed.
+			It is the same sequence of steps that the coroutines go trough, with the co_yield replaced
+			by the move to the next micro-operation. */
+		constexpr MicroOp microcode[] = {
+			MicroOp::fetch,                                                  // 0: nothing in progress.
+			MicroOp::increment_pc, MicroOp::fetch,                           // 1: NOP
+			MicroOp::read_operand, MicroOp::load, MicroOp::fetch,            // 3: LD
+			MicroOp::read_operand, MicroOp::store, MicroOp::fetch,           // 6: ST
+			MicroOp::read_operand, MicroOp::add, MicroOp::fetch,             // 9: ADD
+			MicroOp::halt, MicroOp::fetch,                                   // 12: HALT
+			MicroOp::read_operand, MicroOp::jump, MicroOp::fetch,            // 14: JMP
+			MicroOp::read_operand_if_zero, MicroOp::jump, MicroOp::fetch,    // 17: JZE
+			MicroOp::read_operand, MicroOp::subtract, MicroOp::fetch         // 20: SUB
+		};
+
+		/** Where the micro-program of each instruction starts. Illegal opcodes stay on the fetch. */
+		constexpr uint8_t illegal_entry_point = 0;
+		constexpr std::array<uint8_t, 256> microcode_entry_points = dispatch_table<uint8_t>(illegal_entry_point, {
+			{Opcode::NOP, 1},
+			{Opcode::LD, 3},
+			{Opcode::ST, 6},
+			{Opcode::ADD, 9},
+			{Opcode::HALT, 12},
+			{Opcode::JMP, 14},
+			{Opcode::JZE, 17},
+			{Opcode::SUB, 20}
+		});
+
+		/** Position of each instruction in the label table of CPU::run (threaded code version). */
+		constexpr uint8_t illegal_index = 8;
+		constexpr std::array<uint8_t, 256> instruction_index = dispatch_table<uint8_t>(illegal_index, {
+			{Opcode::NOP, 0},
+			{Opcode::LD, 1},
+			{Opcode::ST, 2},
+			{Opcode::ADD, 3},
+			{Opcode::HALT, 4},
+			{Opcode::JMP, 5},
+			{Opcode::JZE, 6},
+			{Opcode::SUB, 7}
+		});
+	}
+
+	// The statement only exists with the performance counters enabled.
+#ifdef CHEAPU_PERFORMANCE_COUNTERS
+#define CHEAPU_COUNT(statement) statement
+#else
+#define CHEAPU_COUNT(statement)
+#endif
+
+#ifdef CHEAPU_PERFORMANCE_COUNTERS
+	namespace {
+
+		/** Count everything an instruction that starts is going to do. */
+		void count_instruction(PerformanceCounters& counters, const uint8_t opcode, const bool accumulator_zero)
+		{
+			++counters.instructions;
+
+			switch (static_cast<Opcode>(opcode)) {
+			case Opcode::NOP:
+			case Opcode::HALT:
+				counters.memory_reads += 1;
+				counters.stall_cycles += 1;
+				break;
+			case Opcode::LD:
+			case Opcode::ADD:
+			case Opcode::SUB:
+				counters.memory_reads += 3;  // Opcode, operand, value.
+				counters.stall_cycles += 2;
+				break;
+			case Opcode::ST:
+				counters.memory_reads += 2;
+				counters.memory_writes += 1;
+				counters.stall_cycles += 2;
+				break;
+			case Opcode::JMP:
+				counters.memory_reads += 2;
+				counters.stall_cycles += 2;
+				break;
+			case Opcode::JZE:
+				if (accumulator_zero) {
+					++counters.jze_taken;
+					counters.memory_reads += 2;
+					counters.stall_cycles += 2;
+				}
+				else {
+					++counters.jze_not_taken;
+					counters.memory_reads += 1;
+					counters.stall_cycles += 1;
+				}
+				break;
+			default:
+				++counters.illegal_opcodes;
+				counters.memory_reads += 1;  // Stops at the fetch.
+				return;
+			}
+
+			++counters.opcodes[opcode];
+		}
+	}
+#endif
+
 	uint8_t to_word(const Opcode x) 
 	{
 		return static_cast<uint8_t>(x);
 	}
 
 
+	template <typename Memory>
+	constinit const std::array<CPU::Instruction<Memory>, 256> CPU::instruction_set = dispatch_table<CPU::Instruction<Memory>>(&CPU::ILLEGAL<Memory>, {
+		{Opcode::NOP, &CPU::NOP<Memory>},
+		{Opcode::LD, &CPU::LD<Memory>},
+		{Opcode::ST, &CPU::ST<Memory>},
+		{Opcode::ADD, &CPU::ADD<Memory>},
+		{Opcode::HALT, &CPU::HALT<Memory>},
+		{Opcode::JMP, &CPU::JMP<Memory>},
+		{Opcode::JZE, &CPU::JZE<Memory>},
+		{Opcode::SUB, &CPU::SUB<Memory>}
+	});
+
+
+	CPU::CPU(const Engine engine) :
+		engine(engine)
+	{
+		reset();
+	}
+
 	void CPU::reset()
 	{
 		accumulator = 0;
 		program_counter = 0;
-		overflow = 0;
-		zero = 0;
+		set_flags(false, false);
 		error = 0;
 
-		running_instruction = FakeInitInstruction();
-		running_instruction();  // CPU does nothing, but instruction is complete. 1st cycle will fetch real code.
+		micro_pc = 0;
+		operand = 0;
+		idle_loop = false;
+		idle_state = no_loop;
+		idle_end = 0;
+
+		CHEAPU_COUNT(counters.reset());
+
+		if (engine == Engine::coroutines) {
+			running_instruction = FakeInitInstruction();
+			running_instruction();  // CPU does nothing, but instruction is complete. 1st cycle will fetch real code.
+		}
 	}
 
-	void CPU::cycle(MemoryChip& memory) 
+	template <typename Memory>
+	void CPU::cycle(Memory& memory) 
 	{
 		// Block on error: do nothing.
 		if (error)
 			return;
 
-		if (running_instruction.completed()) {
-			// Fetch
-			uint8_t instruction = memory[program_counter];
-
-			// Decode.
-			if (instruction == to_word(Opcode::NOP)) {
-				running_instruction = NOP();
-			}
-			else if (instruction == to_word(Opcode::LD)) {
-				running_instruction = LD(memory);
+		// Storing something: the next run() can't compare with the last loop anymore.
+		// Out of the idle loop: not idle.
+		if (idle_state != no_loop && instruction_completed()) {
+			const uint8_t loop_start = static_cast<uint8_t>(idle_state);
+			if (memory.read(program_counter) == to_word(Opcode::ST)) {
+				idle_state = no_loop;
+				idle_loop = false;
 			}
-			else if (instruction == to_word(Opcode::ST)) {
-				running_instruction = ST(memory);
-			}
-			else if (instruction == to_word(Opcode::ADD)) {
-				running_instruction = ADD(memory);
-			}
-			else if (instruction == to_word(Opcode::HALT)) {
-				running_instruction = HALT(memory);
-			}
-			else if (instruction == to_word(Opcode::JMP)) {
-				running_instruction = JMP(memory);
-			}
-			else if (instruction == to_word(Opcode::JZE)) {
-				running_instruction = JZE(memory);
+			else if (program_counter < loop_start || program_counter > idle_end)
+				idle_loop = false;
+		}
+
+		CHEAPU_COUNT(++counters.cycles);
+		CHEAPU_COUNT(if (instruction_completed()) count_instruction(counters, memory.read(program_counter), accumulator == 0));
+
+		if (engine == Engine::microcode)
+			microcode_cycle(memory);
+		else
+			coroutine_cycle(memory);
+	}
+
+	template <typename Memory>
+	uint64_t CPU::run(Memory& memory, const uint64_t max_instructions)
+	{
+		uint64_t cycles = 0;
+		uint64_t executed = 0;
+
+		// Finish what is in progress the slow way, so that the loop can start from a fetch.
+		if (!error && max_instructions > 0 && !instruction_completed()) {
+			while (!error && !instruction_completed()) {
+				cycle(memory);
+				++cycles;
 			}
-			else if (instruction == to_word(Opcode::SUB)) {
-				running_instruction = SUB(memory);
+			++executed;
+		}
+
+		// Each instruction does all its cycles at once. There can't be any change to the memory
+		// in between the cycles, so the result is the same. Registers are kept in local variables,
+		// so that the compiler can keep them in the CPU registers.
+		CHEAPU_COUNT(const uint64_t counted_cycles = cycles);  // By cycle(), already.
+
+		uint8_t pc = program_counter;
+		uint8_t acc = accumulator;
+		unsigned alu = last_alu_result;  // Full width: no 16 bit partial register operations.
+
+		// Idle loop detection. Every backward jump closes a loop: if it comes back to the same place
+		// with the same accumulator and flags, and nothing was stored in between, it is going to do the
+		// exact same thing again, forever. No need to run it: skip ahead whole loops, count their cycles.
+		// The CPU remembers the last loop to compare with the first backward jump of the next run() (even if
+		// that is many short runs later), not to skip anything or to say that it is still there: the memory
+		// may have changed since. Only a backward jump of this run() makes it idle, a loop is measured within each run().
+#ifdef CHEAPU_PERFORMANCE_COUNTERS
+#define CHEAPU_STORED
+#define CHEAPU_LOOP_BACK(from) (void)(from)
+#else
+		// Program counter, accumulator and the 16 bits of the ALU result (as in last_alu_result: a SUB that
+		// borrows sets all the bits above) in one number: less to keep in the registers.
+		// Setting it to no_loop (which no real state can be) means "something was stored".
+		bool idle = false;
+		uint64_t loop_state = idle_state;
+		uint8_t loop_end = idle_end;
+		uint64_t loop_executed = 0;  // 0 until the loop is measured in this run().
+		uint64_t loop_cycles = 0;
+
+#define CHEAPU_STORED loop_state = no_loop
+#define CHEAPU_LOOP_BACK(from) \
+		if (pc <= (from)) [[unlikely]] { \
+			const uint64_t state = pc | (acc << 8) | (uint64_t(alu & 0xFFFF) << 16); \
+			idle = state == loop_state; \
+			if (idle && loop_executed != 0) { \
+				const uint64_t period = executed + 1 - loop_executed; \
+				const uint64_t period_cycles = cycles - loop_cycles; \
+				const uint64_t periods = (max_instructions - executed - 1) / period; \
+				if (periods > (UINT64_MAX - cycles) / period_cycles) { \
+					++executed; \
+					goto done; \
+				} \
+				executed += periods * period; \
+				cycles += periods * period_cycles; \
+			} \
+			loop_state = state; \
+			loop_end = (from); \
+			loop_executed = executed + 1; \
+			loop_cycles = cycles; \
+		}
+#endif
+
+#define CHEAPU_COUNT_INSTRUCTION CHEAPU_COUNT(count_instruction(counters, memory.read(pc), acc == 0))
+
+		// Same idea as the microcode_cycle. With the threaded code, every instruction jumps
+		// directly to the next one, instead of going back to the top of the loop.
+#if defined(CHEAPU_COMPUTED_GOTO) && (defined(__GNUC__) || defined(__clang__))
+		static void* const instructions[] = {  // Same order as instruction_index.
+			&&NOP, &&LD, &&ST, &&ADD, &&HALT, &&JMP, &&JZE, &&SUB, &&ILLEGAL
+		};
+#define CHEAPU_INSTRUCTION(name) name
+#define CHEAPU_ILLEGAL_INSTRUCTION ILLEGAL
+#define CHEAPU_NEXT_INSTRUCTION \
+		if (++executed == max_instructions) \
+			goto done; \
+		goto *instructions[instruction_index[memory.read(pc)]]
+
+		if (error || executed == max_instructions)
+			goto done;
+		goto *instructions[instruction_index[memory.read(pc)]];
+#else
+#define CHEAPU_INSTRUCTION(name) case Opcode::name
+#define CHEAPU_ILLEGAL_INSTRUCTION default
+#define CHEAPU_NEXT_INSTRUCTION \
+		++executed; \
+		continue
+
+		if (error)
+			goto done;
+
+		while (executed < max_instructions)
+			switch (static_cast<Opcode>(memory.read(pc)))
+#endif
+			{
+			CHEAPU_INSTRUCTION(NOP):
+				CHEAPU_COUNT_INSTRUCTION;
+				++pc;
+				cycles += 2;
+				CHEAPU_NEXT_INSTRUCTION;
+			CHEAPU_INSTRUCTION(LD):
+				CHEAPU_COUNT_INSTRUCTION;
+				acc = memory.read(memory.read(pc + 1));
+				pc += 2;
+				cycles += 3;
+				CHEAPU_NEXT_INSTRUCTION;
+			CHEAPU_INSTRUCTION(ST):
+				CHEAPU_COUNT_INSTRUCTION;
+				memory.write(memory.read(pc + 1), acc);
+				CHEAPU_STORED;
+				pc += 2;
+				cycles += 3;
+				CHEAPU_NEXT_INSTRUCTION;
+			CHEAPU_INSTRUCTION(ADD):
+				CHEAPU_COUNT_INSTRUCTION;
+				alu = acc + memory.read(memory.read(pc + 1));
+				acc = static_cast<uint8_t>(alu);
+				pc += 2;
+				cycles += 3;
+				CHEAPU_NEXT_INSTRUCTION;
+			CHEAPU_INSTRUCTION(SUB):
+				CHEAPU_COUNT_INSTRUCTION;
+				alu = acc - memory.read(memory.read(pc + 1));
+				acc = static_cast<uint8_t>(alu);
+				pc += 2;
+				cycles += 3;
+				CHEAPU_NEXT_INSTRUCTION;
+			CHEAPU_INSTRUCTION(JMP): {
+				CHEAPU_COUNT_INSTRUCTION;
+				const uint8_t from = pc;
+				pc = memory.read(pc + 1);
+				cycles += 3;
+				CHEAPU_LOOP_BACK(from);
+				CHEAPU_NEXT_INSTRUCTION;
 			}
-			else {
-				// Illegal opcode.
+			CHEAPU_INSTRUCTION(JZE):
+				CHEAPU_COUNT_INSTRUCTION;
+				if (acc == 0) {
+					const uint8_t from = pc;
+					pc = memory.read(pc + 1);
+					cycles += 3;
+					CHEAPU_LOOP_BACK(from);
+				}
+				else {
+					pc += 2;
+					cycles += 2;
+				}
+				CHEAPU_NEXT_INSTRUCTION;
+			CHEAPU_INSTRUCTION(HALT):
+				CHEAPU_COUNT_INSTRUCTION;
+				error = true;
+				cycles += 2;
+				++executed;
+				goto done;
+			CHEAPU_ILLEGAL_INSTRUCTION:
+				CHEAPU_COUNT_INSTRUCTION;
 				error = true;
+				cycles += 1;  // Only the fetch.
+				++executed;
+				goto done;
+			}
+#undef CHEAPU_INSTRUCTION
+#undef CHEAPU_ILLEGAL_INSTRUCTION
+#undef CHEAPU_NEXT_INSTRUCTION
+#undef CHEAPU_COUNT_INSTRUCTION
+#undef CHEAPU_LOOP_BACK
+#undef CHEAPU_STORED
+
+	done:
+		CHEAPU_COUNT(counters.cycles += cycles - counted_cycles);
+		program_counter = pc;
+		accumulator = acc;
+		last_alu_result = static_cast<uint16_t>(alu);
+#ifndef CHEAPU_PERFORMANCE_COUNTERS
+		// It may have left the loop after the jump that said it was idle (if the memory changed since the last run()).
+		idle_loop = idle && loop_state != no_loop && pc >= static_cast<uint8_t>(loop_state) && pc <= loop_end;
+		idle_state = loop_state;
+		idle_end = loop_end;
+#endif
+		micro_pc = 0;  // Any fetch in the microcode is as good as the other.
+
+		return cycles;
+	}
+
+	template <typename Memory>
+	uint64_t CPU::run_until_halt(Memory& memory)
+	{
+		return run(memory, UINT64_MAX);
+	}
+
+	template <typename Memory>
+	uint64_t CPU::step_instruction(Memory& memory, const uint64_t max_cycles)
+	{
+		return max_cycles >= longest_instruction ? run(memory, 1) : run_cycles(memory, max_cycles);
+	}
+
+	template <typename Memory>
+	uint64_t CPU::run_cycles(Memory& memory, const uint64_t max_cycles)
+	{
+		// At least 1/3 of what is left surely fits.
+		uint64_t cycles = 0;
+		while (!error && max_cycles - cycles >= longest_instruction)
+			cycles += run(memory, (max_cycles - cycles) / longest_instruction);
+
+		while (!error && cycles < max_cycles) {
+			cycle(memory);
+			++cycles;
+		}
+
+		return cycles;
+	}
+
+	bool CPU::instruction_completed()
+	{
+		if (engine == Engine::microcode)
+			return microcode[micro_pc] == MicroOp::fetch;
+		else
+			return running_instruction.completed();
+	}
+
+	bool CPU::idle() const
+	{
+		return idle_loop;
+	}
+
+	Engine CPU::which_engine() const
+	{
+		return engine;
+	}
+
+	CPUState CPU::save_state()
+	{
+		if (engine == Engine::coroutines && !instruction_completed())
+			throw std::logic_error("Can't save the state of a coroutine in the middle of an instruction.");
+
+		// Between instructions, any fetch in the microcode is as good as the other and the operand
+		// is a leftover: always the same values, so that equal states compare equal.
+		const bool between_instructions = instruction_completed();
+		return {
+			program_counter, accumulator,
+			overflow(), zero(), error,
+			between_instructions ? uint8_t(0) : micro_pc,
+			between_instructions ? uint8_t(0) : operand
+		};
+	}
+
+	void CPU::restore_state(const CPUState& state)
+	{
+		if (state.micro_pc >= std::size(microcode))
+			throw std::invalid_argument("Not a CPU state: the microcode is not that long.");
+		if (state.overflow > 1 || state.zero > 1 || state.error > 1)
+			throw std::invalid_argument("Not a CPU state: the flags are 0 or 1.");
+		if (engine == Engine::coroutines && microcode[state.micro_pc] != MicroOp::fetch)
+			throw std::logic_error("Can't restore a coroutine in the middle of an instruction.");
+
+		program_counter = state.program_counter;
+		accumulator = state.accumulator;
+		set_flags(state.overflow, state.zero);
+		error = state.error;
+		micro_pc = state.micro_pc;
+		operand = state.operand;
+		idle_loop = false;
+		idle_state = no_loop;
+
+		// Whatever the coroutine was doing, it is not happening anymore.
+		if (engine == Engine::coroutines && !running_instruction.completed()) {
+			running_instruction = FakeInitInstruction();
+			running_instruction();
+		}
+	}
+
+	template <typename Memory>
+	void CPU::microcode_cycle(Memory& memory)
+	{
+		// Decoding the micro-operation is a single indirect jump either way, but the switch also
+		// does a bounds check. Define CHEAPU_COMPUTED_GOTO to use the GCC/Clang "labels as values"
+		// extension (threaded code) instead.
+#if defined(CHEAPU_COMPUTED_GOTO) && (defined(__GNUC__) || defined(__clang__))
+		static void* const steps[] = {  // Same order as the MicroOp values.
+			&&fetch, &&increment_pc, &&read_operand, &&load, &&store,
+			&&add, &&subtract, &&halt, &&jump, &&read_operand_if_zero
+		};
+		goto *steps[static_cast<uint8_t>(microcode[micro_pc])];
+#define CHEAPU_MICRO_OP(name) name
+#else
+		switch (microcode[micro_pc])
+#define CHEAPU_MICRO_OP(name) case MicroOp::name
+#endif
+		{
+		CHEAPU_MICRO_OP(fetch):
+			micro_pc = microcode_entry_points[memory.read(program_counter)];
+			operand = 0;  // Nothing latched yet. Clears the leftover, so that the same machine always saves the same CPUState.
+			error = (micro_pc == illegal_entry_point);
+			return;  // No execute! Access to memory to fetch used up the cycle. 
+		CHEAPU_MICRO_OP(increment_pc):
+			program_counter++;
+			goto next_step;
+		CHEAPU_MICRO_OP(read_operand):
+			operand = memory.read(program_counter + 1);
+			goto next_step;
+		CHEAPU_MICRO_OP(load):
+			accumulator = memory.read(operand);
+			program_counter += 2;
+			goto next_step;
+		CHEAPU_MICRO_OP(store):
+			memory.write(operand, accumulator);
+			program_counter += 2;
+			goto next_step;
+		CHEAPU_MICRO_OP(add):
+			last_alu_result = accumulator + memory.read(operand);
+			accumulator = static_cast<uint8_t>(last_alu_result);
+			program_counter += 2;
+			goto next_step;
+		CHEAPU_MICRO_OP(subtract):
+			last_alu_result = static_cast<uint16_t>(accumulator - memory.read(operand));
+			accumulator = static_cast<uint8_t>(last_alu_result);
+			program_counter += 2;
+			goto next_step;
+		CHEAPU_MICRO_OP(halt):
+			error = true;
+			goto next_step;
+		CHEAPU_MICRO_OP(jump):
+			program_counter = operand;
+			goto next_step;
+		CHEAPU_MICRO_OP(read_operand_if_zero):
+			if (accumulator != 0) {
+				program_counter += 2;
+				micro_pc = 0;  // Done already.
+				return;
 			}
+			operand = memory.read(program_counter + 1);
+			goto next_step;
+		}
+#undef CHEAPU_MICRO_OP
+
+	next_step:
+		++micro_pc;
+	}
+
+	template <typename Memory>
+	void CPU::coroutine_cycle(Memory& memory)
+	{
+		if (running_instruction.completed()) {
+			// Fetch
+			uint8_t instruction = memory.read(program_counter);
+
+			// Decode.
+			running_instruction = (this->*instruction_set<Memory>[instruction])(memory);
 
 			// No execute! Access to memory to fetch used up the cycle. 
 		}
@@ -76,66 +580,72 @@ namespace CheaPU {
 		co_return true;
 	}
 
-	CheaPU::StepByStep<bool> CPU::NOP()
+	template <typename Memory>
+	CheaPU::StepByStep<bool> CPU::NOP(Memory&)
 	{
 		program_counter++;
 		co_return true;
 	}
 
-	CheaPU::StepByStep<bool> CPU::LD(MemoryChip& memory)
+	template <typename Memory>
+	CheaPU::StepByStep<bool> CPU::LD(Memory& memory)
 	{
-		uint8_t source_address = memory[program_counter + 1];
+		uint8_t source_address = memory.read(program_counter + 1);
 		co_yield false;
 
-		accumulator = memory[source_address];
+		accumulator = memory.read(source_address);
 		program_counter += 2;
 
 		co_return true;
 	}
 
-	CheaPU::StepByStep<bool> CPU::ST(MemoryChip& memory)
+	template <typename Memory>
+	CheaPU::StepByStep<bool> CPU::ST(Memory& memory)
 	{
-		uint8_t source_address = memory[program_counter + 1];
+		uint8_t source_address = memory.read(program_counter + 1);
 		co_yield false;
 
-		memory[source_address] = accumulator;
+		memory.write(source_address, accumulator);
 		program_counter += 2;
 
 		co_return true;
 	}
 
-	CheaPU::StepByStep<bool> CPU::ADD(MemoryChip& memory)
+	template <typename Memory>
+	CheaPU::StepByStep<bool> CPU::ADD(Memory& memory)
 	{
-		// TODO: overflow flag if overflow.
-
-		uint8_t source_address = memory[program_counter + 1];
+		uint8_t source_address = memory.read(program_counter + 1);
 		co_yield false;
 
-		accumulator += memory[source_address];
+		last_alu_result = accumulator + memory.read(source_address);
+		accumulator = static_cast<uint8_t>(last_alu_result);
 		program_counter += 2;
 		co_return true;
 	}
 
-	CheaPU::StepByStep<bool> CPU::HALT(MemoryChip& memory)
+	template <typename Memory>
+	CheaPU::StepByStep<bool> CPU::HALT(Memory&)
 	{
 		error = true;
 		co_return true;
 	}
 
 
-	CheaPU::StepByStep<bool> CPU::JMP(MemoryChip& memory)
+	template <typename Memory>
+	CheaPU::StepByStep<bool> CPU::JMP(Memory& memory)
 	{
-		uint8_t jump_to = memory[program_counter + 1];
+		uint8_t jump_to = memory.read(program_counter + 1);
 		co_yield false;
 
 		program_counter = jump_to;
 		co_return true;
 	}
 
-	CheaPU::StepByStep<bool> CPU::JZE(MemoryChip& memory)
+	template <typename Memory>
+	CheaPU::StepByStep<bool> CPU::JZE(Memory& memory)
 	{
 		if (accumulator == 0) {
-			uint8_t jump_to = memory[program_counter + 1];
+			uint8_t jump_to = memory.read(program_counter + 1);
 			co_yield false;
 
 			program_counter = jump_to;
@@ -147,17 +657,38 @@ namespace CheaPU {
 		}
 	}
 
-	CheaPU::StepByStep<bool> CPU::SUB(MemoryChip& memory)
+	template <typename Memory>
+	CheaPU::StepByStep<bool> CPU::SUB(Memory& memory)
 	{
-		// TODO: overflow flag if undeflow.
-
-		uint8_t source_address = memory[program_counter + 1];
+		uint8_t source_address = memory.read(program_counter + 1);
 		co_yield false;
 
-		accumulator -= memory[source_address];
+		last_alu_result = static_cast<uint16_t>(accumulator - memory.read(source_address));
+		accumulator = static_cast<uint8_t>(last_alu_result);
 		program_counter += 2;
 		co_return true;
 	}
 
+	template <typename Memory>
+	CheaPU::StepByStep<bool> CPU::ILLEGAL(Memory&)
+	{
+		error = true;
+		return {};
+	}
 
-}
\ No newline at end of file
+	/** @name The memories the CPU can work with. */
+	/**@{*/
+	template void CPU::cycle(MemoryChip& memory);
+	template uint64_t CPU::run(MemoryChip& memory, const uint64_t max_instructions);
+	template uint64_t CPU::run_until_halt(MemoryChip& memory);
+	template uint64_t CPU::run_cycles(MemoryChip& memory, const uint64_t max_cycles);
+	template uint64_t CPU::step_instruction(MemoryChip& memory, const uint64_t max_cycles);
+
+	template void CPU::cycle(PagedMemoryChip& memory);
+	template uint64_t CPU::run(PagedMemoryChip& memory, const uint64_t max_instructions);
+	template uint64_t CPU::run_until_halt(PagedMemoryChip& memory);
+	template uint64_t CPU::run_cycles(PagedMemoryChip& memory, const uint64_t max_cycles);
+	template uint64_t CPU::step_instruction(PagedMemoryChip& memory, const uint64_t max_cycles);
+	/**@}*/
+
+}
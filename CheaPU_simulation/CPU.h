@@ -1,9 +1,14 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
 
 #include "StepByStep.h"
 
+#ifdef CHEAPU_PERFORMANCE_COUNTERS
+#include "PerformanceCounters.h"
+#endif
+
 /** \file */ // Forces Doxygen to pick up out-of-class enums (https://www.doxygen.nl/manual/commands.html#cmdfile).
 
 namespace CheaPU {
@@ -60,6 +65,36 @@ namespace CheaPU {
 	uint8_t to_word(const Opcode x);
 
 
+	/** The ways the CPU can keep track of the instructions that take more than one cycle.
+	    Both give exactly the same results, cycle by cycle. */
+	enum class Engine : uint8_t {
+		/** Every instruction is a StepByStep coroutine. This is the original implementation,
+		    but it has to allocate a new coroutine frame for every instruction it runs. */
+		coroutines,
+
+		/** Every instruction is a short sequence of micro-operations in a table (think of
+		    the microcode ROM of a real CPU). The only state to keep between cycles is the
+		    position in the table and the operand, so there are no allocations at all. */
+		microcode
+	};
+
+
+	/** Everything the CPU knows, instruction in progress included, in plain bytes.
+	    Trivially copyable: saving and restoring it is a handful of moves.
+		@see CPU::save_state(), CPU::restore_state(). */
+	struct CPUState {
+		uint8_t program_counter;
+		uint8_t accumulator;
+		uint8_t overflow;
+		uint8_t zero;
+		uint8_t error;
+		uint8_t micro_pc;  ///< Where the Engine::microcode is in the instruction. 0 if there is none in progress.
+		uint8_t operand;   ///< Latched by the instruction in progress. 0 if there is none.
+
+		bool operator==(const CPUState& other) const = default;
+	};
+
+
 	/** Emulated CPU. On the cheap, as the namespace says.
 	    
 		The fields represent the usual parts of a CPU, but this 
@@ -72,13 +107,88 @@ namespace CheaPU {
 		@see Opcode for the programming details.*/
 	class CPU  {
 	public:
+		/** The CPU starts in the reset state. */
+		explicit CPU(const Engine engine = Engine::microcode);
+
+		/** The engine given to the constructor. */
+		Engine which_engine() const;
+
 		/** Restore the CPU to the "just turned on" state. 
 		    Zero the flags, put the program counter back to 0...*/
 		void reset();
 
+		/** @name Running.
+		    The Memory is a MemoryChip or a PagedMemoryChip (the only two compiled in, at the end of CPU.cpp). */
+		/**@{*/
 		/** Simulate a single machine cycle. 
 		    Instructions that take more than one cycle will remain "in wait". */
-		void cycle(MemoryChip& memory);
+		template <typename Memory>
+		void cycle(Memory& memory);
+
+		/** Run whole instructions in a tight loop, without going trough the single cycles.
+		    It is much faster than calling cycle() over and over, but you only see the final state.
+			
+			An instruction that is half-done is completed first (and counts as one of the max_instructions).
+			Stops early if the error flag goes up (HALT, illegal opcode...).
+
+			Idle loops are not run at all (see idle()): once the CPU sees one, it skips ahead as many times
+			around the loop as max_instructions allows, adding up their cycles. If they are too many to count
+			in 64 bits (run_until_halt() on a program that waits forever) it stops there instead.
+			
+			@return how many machine cycles it took. Calling cycle() that many times gives the same result. */
+		template <typename Memory>
+		uint64_t run(Memory& memory, const uint64_t max_instructions);
+
+		/** Same as run(), with no limit. Don't call it on programs that never halt...
+		    unless they do it in an idle loop: then it returns, with idle() true. */
+		template <typename Memory>
+		uint64_t run_until_halt(Memory& memory);
+
+		/** Run for max_cycles machine cycles, as fast as run() while whole instructions fit, 
+		    then cycle by cycle (so it may stop in the middle of an instruction).
+			Stops early if the error flag goes up.
+			
+			@return how many cycles it took: max_cycles, unless the CPU stopped. */
+		template <typename Memory>
+		uint64_t run_cycles(Memory& memory, const uint64_t max_cycles);
+
+		/** One instruction (or the rest of the one in progress), for whoever looks at the CPU after each of them.
+		    If fewer than longest_instruction cycles are left, it runs only those: it may stop half-way.
+
+			@return how many cycles it took. */
+		template <typename Memory>
+		uint64_t step_instruction(Memory& memory, const uint64_t max_cycles);
+
+		/** No instruction takes more cycles than this (not even one that is half-done). */
+		static constexpr uint64_t longest_instruction = 3;
+		/**@}*/
+
+		/** True if the CPU is between two instructions (the next cycle will fetch). */
+		bool instruction_completed();
+
+		/** True if the last loop that run() went around can never end: it came back to its backward jump
+		    with the same accumulator and flags, without storing anything. Think of "JMP to itself",
+			or waiting for a memory location that nobody will ever change.
+			Only something from outside (the front panel writing in memory, reset()...) can get
+			the CPU out of there: there is no need to run it, or to draw the panel again, until then.
+			It is only as fresh as the last run(): the next one says it again only if it reaches the backward jump,
+			and cycle() clears it as soon as it fetches outside the loop, or a ST inside it.
+			Never true with CHEAPU_PERFORMANCE_COUNTERS: the counters have to see every instruction. */
+		bool idle() const;
+
+		/** @name Save states.
+		    The Engine::microcode can save and restore in the middle of an instruction: the next cycle()
+			continues exactly where it was. The Engine::coroutines keeps the instruction in progress
+			inside a coroutine frame, which can't be copied: it can only save and restore between instructions
+			(it throws std::logic_error otherwise).
+			The performance counters are not part of the state. */
+		/**@{*/
+		CPUState save_state();
+
+		/** Throws std::invalid_argument if the state can't come from a CPU (micro_pc out of the microcode,
+		    a flag that is not 0 or 1). */
+		void restore_state(const CPUState& state);
+		/**@}*/
 
 		/** @name CPU registers.
 		*  Names are "obvious" (if you know the basics of CPU architectures). */
@@ -88,16 +198,76 @@ namespace CheaPU {
 		/**@}*/
 
 
-		/** @name CPU flags. */
+		/** @name CPU flags.
+		    Overflow and zero describe the result of the last ADD or SUB (LD does not change them,
+			JZE looks at the accumulator itself). They are not computed by the instructions: the
+			ADD and SUB only keep their result in last_alu_result, the flags come out of it
+			when someone asks (the front panel, a snapshot...). */
 		/**@{*/
-		uint8_t overflow : 1;
-		uint8_t zero : 1;
+		/** The ADD carried out of the 8 bits, or the SUB borrowed (unsigned). */
+		bool overflow() const
+		{
+			return (last_alu_result & 0xFF00) != 0;
+		}
+
+		/** The ADD or SUB gave 0. */
+		bool zero() const
+		{
+			return (last_alu_result & 0x00FF) == 0;
+		}
+
+		/** For who runs the instructions without the CPU (BlockCache, JitCompiler...) and only knows the flags. */
+		void set_flags(const bool overflow, const bool zero)
+		{
+			last_alu_result = (overflow ? 0x100 : 0) | (zero ? 0 : 1);
+		}
+
 		uint8_t error : 1;
 		/**@}*/
 
+		/** The last ADD or SUB, done on 16 bits: the low byte is the new accumulator, anything in the high byte
+		    is the carry (accumulator + value > 0xFF) or the borrow (accumulator - value < 0 wraps to 0xFFxx).
+			Public for the same reason as the registers: BlockCache keeps it in a local variable, like the accumulator. */
+		uint16_t last_alu_result;
+
+#ifdef CHEAPU_PERFORMANCE_COUNTERS
+		/** What the CPU did since the last reset(). Only with CHEAPU_PERFORMANCE_COUNTERS defined. */
+		PerformanceCounters counters;
+#endif
+
 	private:
+		Engine engine;
+
+		/** @name State of the Engine::microcode. */
+		/**@{*/
+		uint8_t micro_pc;  ///< Position in the microcode table (see CPU.cpp). 0 means "fetch the next instruction".
+		uint8_t operand;   ///< The operand, read in a cycle and used in the next.
+		/**@}*/
+
+		/** @name The idle loop the CPU is in (see idle()). */
+		/**@{*/
+		bool idle_loop;
+		uint64_t idle_state;  ///< Where the last backward jump went, the accumulator and the ALU result there, packed by run().
+		static constexpr uint64_t no_loop = UINT64_MAX;  ///< idle_state after a store: no real state can be this.
+		uint8_t idle_end;     ///< Where the backward jump is: the loop is from the low byte of idle_state to here.
+		/**@}*/
+
+		template <typename Memory>
+		void microcode_cycle(Memory& memory);
+		template <typename Memory>
+		void coroutine_cycle(Memory& memory);
+
 		CheaPU::StepByStep<bool> running_instruction;
 
+		/** What the Engine::coroutines decodes every byte to. */
+		template <typename Memory>
+		using Instruction = CheaPU::StepByStep<bool>(CPU::*)(Memory& memory);
+
+		/** One entry for every possible byte, so that decoding is just an index in the table.
+		    Illegal opcodes go to CPU::ILLEGAL. Built at compile time from the Opcode values. */
+		template <typename Memory>
+		static const std::array<Instruction<Memory>, 256> instruction_set;
+
 		/** NOP that does not increment the program counter. 
 		It immediately terminates so that the CPU can fetch the 1st real
 		instruction. */
@@ -105,15 +275,20 @@ namespace CheaPU {
 
 		/** @name Implementations of machine instructions. */
 		/**@{*/
-		CheaPU::StepByStep<bool> NOP();
-		CheaPU::StepByStep<bool> LD(MemoryChip& memory);
-		CheaPU::StepByStep<bool> ST(MemoryChip& memory);
-		CheaPU::StepByStep<bool> ADD(MemoryChip& memory);
-		CheaPU::StepByStep<bool> HALT(MemoryChip& memory);
-		CheaPU::StepByStep<bool> JMP(MemoryChip& memory);
-		CheaPU::StepByStep<bool> JZE(MemoryChip& memory);
-		CheaPU::StepByStep<bool> SUB(MemoryChip& memory);
+		template <typename Memory> CheaPU::StepByStep<bool> NOP(Memory& memory);
+		template <typename Memory> CheaPU::StepByStep<bool> LD(Memory& memory);
+		template <typename Memory> CheaPU::StepByStep<bool> ST(Memory& memory);
+		template <typename Memory> CheaPU::StepByStep<bool> ADD(Memory& memory);
+		template <typename Memory> CheaPU::StepByStep<bool> HALT(Memory& memory);
+		template <typename Memory> CheaPU::StepByStep<bool> JMP(Memory& memory);
+		template <typename Memory> CheaPU::StepByStep<bool> JZE(Memory& memory);
+		template <typename Memory> CheaPU::StepByStep<bool> SUB(Memory& memory);
 		/**@}*/
+
+		/** Not an instruction: stops the CPU as soon as it decodes an illegal opcode.
+		    Returns an empty StepByStep, there is nothing to run. */
+		template <typename Memory>
+		CheaPU::StepByStep<bool> ILLEGAL(Memory& memory);
 	};
 
 }
\ No newline at end of file
@@ -0,0 +1,400 @@
+#include "pch.h"
+#include "CPUBatch.h"
+
+#include "CPU.h"
+#include "MemoryChip.h"
+
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace CheaPU {
+
+	namespace {
+
+		/** The lane counts are rounded up to this, whatever the vector width. */
+		constexpr size_t lane_padding = 32;
+
+		/** One SIMD register worth of lanes, with the few operations the batch needs.
+		    The masks are bytes at 0xFF (true) or 0x00 (false), like the SIMD compares produce. */
+#if defined(__AVX2__)
+		struct Lanes {
+			static constexpr size_t width = 32;
+			__m256i v;
+
+			static Lanes load(const uint8_t* p) { return { _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)) }; }
+			void store(uint8_t* p) const { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+			static Lanes all(const uint8_t x) { return { _mm256_set1_epi8(static_cast<char>(x)) }; }
+
+			Lanes operator+(const Lanes& o) const { return { _mm256_add_epi8(v, o.v) }; }
+			Lanes operator-(const Lanes& o) const { return { _mm256_sub_epi8(v, o.v) }; }
+			Lanes operator&(const Lanes& o) const { return { _mm256_and_si256(v, o.v) }; }
+			Lanes operator|(const Lanes& o) const { return { _mm256_or_si256(v, o.v) }; }
+			Lanes and_not(const Lanes& o) const { return { _mm256_andnot_si256(o.v, v) }; }  ///< this & ~o
+			Lanes equal(const Lanes& o) const { return { _mm256_cmpeq_epi8(v, o.v) }; }
+			Lanes min(const Lanes& o) const { return { _mm256_min_epu8(v, o.v) }; }
+
+			/** mask ? a : b, lane by lane. */
+			static Lanes select(const Lanes& mask, const Lanes& a, const Lanes& b) { return { _mm256_blendv_epi8(b.v, a.v, mask.v) }; }
+		};
+#elif defined(__SSE2__) || defined(_M_X64)
+		struct Lanes {
+			static constexpr size_t width = 16;
+			__m128i v;
+
+			static Lanes load(const uint8_t* p) { return { _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)) }; }
+			void store(uint8_t* p) const { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+			static Lanes all(const uint8_t x) { return { _mm_set1_epi8(static_cast<char>(x)) }; }
+
+			Lanes operator+(const Lanes& o) const { return { _mm_add_epi8(v, o.v) }; }
+			Lanes operator-(const Lanes& o) const { return { _mm_sub_epi8(v, o.v) }; }
+			Lanes operator&(const Lanes& o) const { return { _mm_and_si128(v, o.v) }; }
+			Lanes operator|(const Lanes& o) const { return { _mm_or_si128(v, o.v) }; }
+			Lanes and_not(const Lanes& o) const { return { _mm_andnot_si128(o.v, v) }; }
+			Lanes equal(const Lanes& o) const { return { _mm_cmpeq_epi8(v, o.v) }; }
+			Lanes min(const Lanes& o) const { return { _mm_min_epu8(v, o.v) }; }
+
+			static Lanes select(const Lanes& mask, const Lanes& a, const Lanes& b) { return { _mm_or_si128(_mm_and_si128(mask.v, a.v), _mm_andnot_si128(mask.v, b.v)) }; }
+		};
+#else
+		struct Lanes {
+			static constexpr size_t width = 1;
+			uint8_t v;
+
+			static Lanes load(const uint8_t* p) { return { *p }; }
+			void store(uint8_t* p) const { *p = v; }
+			static Lanes all(const uint8_t x) { return { x }; }
+
+			Lanes operator+(const Lanes& o) const { return { static_cast<uint8_t>(v + o.v) }; }
+			Lanes operator-(const Lanes& o) const { return { static_cast<uint8_t>(v - o.v) }; }
+			Lanes operator&(const Lanes& o) const { return { static_cast<uint8_t>(v & o.v) }; }
+			Lanes operator|(const Lanes& o) const { return { static_cast<uint8_t>(v | o.v) }; }
+			Lanes and_not(const Lanes& o) const { return { static_cast<uint8_t>(v & ~o.v) }; }
+			Lanes equal(const Lanes& o) const { return { static_cast<uint8_t>(v == o.v ? 0xFF : 0x00) }; }
+			Lanes min(const Lanes& o) const { return { std::min(v, o.v) }; }
+
+			static Lanes select(const Lanes& mask, const Lanes& a, const Lanes& b) { return { mask.v ? a.v : b.v }; }
+		};
+#endif
+
+		static_assert(lane_padding % Lanes::width == 0);
+
+		/** The counters of cycles and instructions are kept in bytes during the run (so that they
+		    fit in the vectors too) and moved to the 64 bit totals before they can overflow.
+			The most expensive instruction takes 3 cycles. */
+		constexpr size_t steps_between_totals = 255 / 3;
+
+		bool uses_operand(const uint8_t opcode)
+		{
+			switch (static_cast<Opcode>(opcode)) {
+			case Opcode::LD:
+			case Opcode::ST:
+			case Opcode::ADD:
+			case Opcode::SUB:
+			case Opcode::JMP:
+			case Opcode::JZE:
+				return true;
+			default:
+				return false;
+			}
+		}
+	}
+
+	CPUBatch::CPUBatch(const size_t lanes) :
+		lane_count(lanes),
+		stride((lanes + lane_padding - 1) / lane_padding * lane_padding),
+		ram(MemoryChip::size * stride, 0)
+	{
+		program_counter.assign(stride, 0);
+		accumulator.assign(stride, 0);
+		overflow.assign(stride, 0);
+		zero.assign(stride, 0);
+		alu_low.assign(stride, 1);  // As after CPU::reset(): neither flag.
+		alu_high.assign(stride, 0);
+		error.assign(stride, 1);
+		std::fill(error.begin(), error.begin() + lane_count, 0);
+		cycles.assign(stride, 0);
+	}
+
+	size_t CPUBatch::lanes() const
+	{
+		return lane_count;
+	}
+
+	void CPUBatch::load(const size_t lane, const MemoryChip& memory)
+	{
+		for (size_t address = 0; address < MemoryChip::size; ++address)
+			ram[address * stride + lane] = memory.read(address);
+
+		program_counter[lane] = 0;
+		accumulator[lane] = 0;
+		overflow[lane] = 0;
+		zero[lane] = 0;
+		alu_low[lane] = 1;
+		alu_high[lane] = 0;
+		error[lane] = 0;
+		cycles[lane] = 0;
+	}
+
+	MemoryChip CPUBatch::memory(const size_t lane) const
+	{
+		MemoryChip memory;
+		for (size_t address = 0; address < MemoryChip::size; ++address)
+			memory.storage[address] = ram[address * stride + lane];
+		return memory;
+	}
+
+	void CPUBatch::run(const uint64_t max_instructions)
+	{
+		std::vector<uint8_t> active(stride);
+		std::vector<uint8_t> group(stride);
+		std::vector<uint8_t> step_cycles(stride, 0);
+		std::vector<uint8_t> step_instructions(stride, 0);
+		std::vector<uint64_t> executed(stride, 0);
+
+		/** @name Idle loops, as in CPU::run(). The state packs where the last backward jump went,
+		    the accumulator and the ALU result there. */
+		/**@{*/
+		static constexpr uint64_t no_loop = UINT64_MAX;
+		std::vector<uint64_t> loop_state(stride, no_loop);
+		std::vector<uint64_t> loop_executed(stride, 0);  ///< 0 until the loop is measured.
+		std::vector<uint64_t> loop_cycles(stride, 0);
+		std::vector<uint8_t> stored(stride, 0);          ///< 0xFF if the lane stored something since its last backward jump.
+		bool skipped = false;
+		/**@}*/
+
+		for (size_t lane = 0; lane < stride; ++lane) {
+			active[lane] = (!error[lane] && max_instructions > 0) ? 0xFF : 0x00;
+			cycles[lane] = 0;
+		}
+
+		// Move the byte counters to the totals. Near the end of the budget, it has to be
+		// done at every step, to stop the lanes that used it all.
+		uint64_t steps = 0;
+		size_t steps_since_totals = 0;
+		auto update_totals = [&]() {
+			for (size_t lane = 0; lane < stride; ++lane) {
+				cycles[lane] += step_cycles[lane];
+				executed[lane] += step_instructions[lane];
+				if (executed[lane] >= max_instructions)
+					active[lane] = 0x00;
+			}
+			std::fill(step_cycles.begin(), step_cycles.end(), 0);
+			std::fill(step_instructions.begin(), step_instructions.end(), 0);
+			steps_since_totals = 0;
+		};
+
+		const Lanes no = Lanes::all(0x00);
+		const Lanes all_ones = Lanes::all(0xFF);
+		const Lanes one = Lanes::all(1);
+		const Lanes two = Lanes::all(2);
+		const Lanes three = Lanes::all(3);
+
+		// Lowest program counter, from the given one up, among the lanes that are still running.
+		auto lowest_from = [&](const uint8_t from, uint8_t& lowest_pc) {
+			const Lanes start = Lanes::all(from);
+			Lanes lowest = Lanes::all(0xFF);
+			Lanes any_active = no;
+			for (size_t i = 0; i < stride; i += Lanes::width) {
+				const Lanes pc_now = Lanes::load(&program_counter[i]);
+				const Lanes candidate = Lanes::load(&active[i]) & start.min(pc_now).equal(start);
+				lowest = lowest.min(Lanes::select(candidate, pc_now, Lanes::all(0xFF)));
+				any_active = any_active | candidate;
+			}
+
+			uint8_t lowest_bytes[Lanes::width];
+			uint8_t active_bytes[Lanes::width];
+			lowest.store(lowest_bytes);
+			any_active.store(active_bytes);
+			lowest_pc = *std::min_element(lowest_bytes, lowest_bytes + Lanes::width);
+			return std::any_of(active_bytes, active_bytes + Lanes::width, [](const uint8_t b) { return b != 0; });
+		};
+
+		// Where the sweep is: the next step goes to the lowest program counter from next_pc up (and, at
+		// next_pc, to the lanes from next_lane on). A lane that jumps back, even to itself, waits for the
+		// others until the sweep starts again from 0: no lane can keep the batch for itself.
+		uint8_t next_pc = 0;
+		size_t next_lane = 0;
+
+		// The first running lane at pc, from the given lane on. stride if there is none.
+		auto first_lane_at = [&](const uint8_t pc, const size_t from) {
+			size_t lane = from;
+			while (lane < stride && !(active[lane] && program_counter[lane] == pc))
+				++lane;
+			return lane;
+		};
+
+		while (true) {
+			// Ahead in the sweep, or start it again.
+			uint8_t pc;
+			size_t leader = stride;
+			if (lowest_from(next_pc, pc)) {
+				leader = first_lane_at(pc, pc == next_pc ? next_lane : 0);
+				if (leader == stride && pc != 0xFF && lowest_from(pc + 1, pc))
+					leader = first_lane_at(pc, 0);
+			}
+			if (leader == stride) {
+				if (!lowest_from(0, pc))
+					break;
+				leader = first_lane_at(pc, 0);
+			}
+
+			// The instruction of the leader lane decides what runs at this step.
+			const uint8_t* const opcodes = &ram[pc * stride];
+			const uint8_t* const operands = &ram[(pc + 1) * stride];
+			const uint8_t opcode = opcodes[leader];
+			const uint8_t operand = operands[leader];
+			const Lanes same_operand_needed = Lanes::all(uses_operand(opcode) ? 0xFF : 0x00);
+
+			// Lanes at the same address with a different instruction (their own memory) come next,
+			// before the sweep moves on.
+			Lanes left_out = no;
+			for (size_t i = 0; i < stride; i += Lanes::width) {
+				const Lanes here = Lanes::load(&active[i]) & Lanes::load(&program_counter[i]).equal(Lanes::all(pc));
+				const Lanes same_opcode = Lanes::load(&opcodes[i]).equal(Lanes::all(opcode));
+				const Lanes same_operand = Lanes::load(&operands[i]).equal(Lanes::all(operand)) | all_ones.and_not(same_operand_needed);
+				const Lanes in_group = here & same_opcode & same_operand;
+				in_group.store(&group[i]);
+				left_out = left_out | here.and_not(in_group);
+			}
+			uint8_t left_out_bytes[Lanes::width];
+			left_out.store(left_out_bytes);
+			if (std::any_of(left_out_bytes, left_out_bytes + Lanes::width, [](const uint8_t b) { return b != 0; })) {
+				next_pc = pc;
+				next_lane = leader + 1;
+			}
+			else {
+				next_pc = static_cast<uint8_t>(pc + 1);
+				next_lane = 0;
+			}
+
+			uint8_t* const data = &ram[operand * stride];
+			for (size_t i = 0; i < stride; i += Lanes::width) {
+				const Lanes in_group = Lanes::load(&group[i]);
+				const Lanes pc_now = Lanes::load(&program_counter[i]);
+				const Lanes acc = Lanes::load(&accumulator[i]);
+				Lanes cost = no;
+
+				switch (static_cast<Opcode>(opcode)) {
+				case Opcode::NOP:
+					Lanes::select(in_group, pc_now + one, pc_now).store(&program_counter[i]);
+					cost = two;
+					break;
+				case Opcode::LD:
+					Lanes::select(in_group, Lanes::load(&data[i]), acc).store(&accumulator[i]);
+					Lanes::select(in_group, pc_now + two, pc_now).store(&program_counter[i]);
+					cost = three;
+					break;
+				case Opcode::ST:
+					Lanes::select(in_group, acc, Lanes::load(&data[i])).store(&data[i]);
+					(Lanes::load(&stored[i]) | in_group).store(&stored[i]);
+					Lanes::select(in_group, pc_now + two, pc_now).store(&program_counter[i]);
+					cost = three;
+					break;
+				case Opcode::ADD: {
+					// Carry: the 8 bit sum wrapped around, below where it started.
+					const Lanes value = Lanes::load(&data[i]);
+					const Lanes sum = acc + value;
+					const Lanes carry = all_ones.and_not(acc.min(sum).equal(acc));
+					Lanes::select(in_group, sum, acc).store(&accumulator[i]);
+					Lanes::select(in_group, sum, Lanes::load(&alu_low[i])).store(&alu_low[i]);
+					Lanes::select(in_group, carry & one, Lanes::load(&alu_high[i])).store(&alu_high[i]);
+					Lanes::select(in_group, carry & one, Lanes::load(&overflow[i])).store(&overflow[i]);
+					Lanes::select(in_group, sum.equal(no) & one, Lanes::load(&zero[i])).store(&zero[i]);
+					Lanes::select(in_group, pc_now + two, pc_now).store(&program_counter[i]);
+					cost = three;
+					break;
+				}
+				case Opcode::SUB: {
+					// Borrow: took away more than there was.
+					const Lanes value = Lanes::load(&data[i]);
+					const Lanes difference = acc - value;
+					const Lanes borrow = all_ones.and_not(value.min(acc).equal(value));
+					Lanes::select(in_group, difference, acc).store(&accumulator[i]);
+					Lanes::select(in_group, difference, Lanes::load(&alu_low[i])).store(&alu_low[i]);
+					Lanes::select(in_group, borrow, Lanes::load(&alu_high[i])).store(&alu_high[i]);
+					Lanes::select(in_group, borrow & one, Lanes::load(&overflow[i])).store(&overflow[i]);
+					Lanes::select(in_group, difference.equal(no) & one, Lanes::load(&zero[i])).store(&zero[i]);
+					Lanes::select(in_group, pc_now + two, pc_now).store(&program_counter[i]);
+					cost = three;
+					break;
+				}
+				case Opcode::JMP:
+					Lanes::select(in_group, Lanes::all(operand), pc_now).store(&program_counter[i]);
+					cost = three;
+					break;
+				case Opcode::JZE: {
+					const Lanes taken = in_group & acc.equal(no);
+					const Lanes not_taken = in_group.and_not(taken);
+					Lanes::select(taken, Lanes::all(operand), Lanes::select(not_taken, pc_now + two, pc_now)).store(&program_counter[i]);
+					cost = Lanes::select(taken, three, two);
+					break;
+				}
+				case Opcode::HALT:
+					Lanes::select(in_group, one, Lanes::load(&error[i])).store(&error[i]);
+					Lanes::load(&active[i]).and_not(in_group).store(&active[i]);
+					cost = two;
+					break;
+				default:  // Illegal opcode: it only took the fetch.
+					Lanes::select(in_group, one, Lanes::load(&error[i])).store(&error[i]);
+					Lanes::load(&active[i]).and_not(in_group).store(&active[i]);
+					cost = one;
+					break;
+				}
+
+				(Lanes::load(&step_cycles[i]) + (cost & in_group)).store(&step_cycles[i]);
+				(Lanes::load(&step_instructions[i]) + (one & in_group)).store(&step_instructions[i]);
+			}
+
+			// Idle loop detection, lane by lane, as in CPU::run(): a backward jump that comes back to the same
+			// place with the same accumulator and ALU result, without storing anything, is going to do the same
+			// thing forever. Skip ahead whole loops, or stop the lane if they are too many to count.
+			const bool jump = opcode == to_word(Opcode::JMP) || opcode == to_word(Opcode::JZE);
+			for (size_t lane = 0; jump && operand <= pc && lane < stride; ++lane) {
+				if (!group[lane] || (opcode == to_word(Opcode::JZE) && accumulator[lane] != 0))
+					continue;  // Not there, or the JZE was not taken.
+
+				if (stored[lane]) {
+					loop_state[lane] = no_loop;
+					stored[lane] = 0;
+				}
+
+				const uint64_t alu = alu_high[lane] == 0xFF ? 0xFF00 | alu_low[lane] : alu_high[lane] << 8 | alu_low[lane];
+				const uint64_t state = operand | (uint64_t(accumulator[lane]) << 8) | (alu << 16);
+				uint64_t done = executed[lane] + step_instructions[lane];
+				uint64_t spent = cycles[lane] + step_cycles[lane];
+				if (state == loop_state[lane] && loop_executed[lane] != 0) {
+					const uint64_t period = done - loop_executed[lane];
+					const uint64_t period_cycles = spent - loop_cycles[lane];
+					const uint64_t periods = (max_instructions - done) / period;
+					if (periods > (UINT64_MAX - spent) / period_cycles) {
+						active[lane] = 0x00;
+						continue;
+					}
+					executed[lane] += periods * period;
+					cycles[lane] += periods * period_cycles;
+					done += periods * period;
+					spent += periods * period_cycles;
+					skipped = true;
+				}
+				loop_state[lane] = state;
+				loop_executed[lane] = done;
+				loop_cycles[lane] = spent;
+			}
+
+			// No lane can do more instructions than there were steps (unless it skipped a loop):
+			// until then, no need to check.
+			++steps;
+			++steps_since_totals;
+			if (steps_since_totals == steps_between_totals || steps >= max_instructions || skipped)
+				update_totals();
+		}
+
+		update_totals();
+	}
+
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace CheaPU {
+
+	class MemoryChip;
+
+	/** Many CPUs, each with its own memory, running in lockstep. Meant for running the same program
+	    on many different initial memories (parameter sweeps), using the SIMD instructions of the host.
+
+		Everything is stored "structure of arrays": a vector of accumulators, one of program counters...
+		with one entry per lane. The memories are interleaved, so that the same address of all the lanes
+		is contiguous. When every lane loads from the same address, it is just a vector load.
+
+		At each step, the batch picks a program counter among the lanes still running, and executes its
+		instruction on all the lanes that are at that address with the same opcode and operand.
+		The others are masked out and wait for their turn. The program counters are picked in sweeps,
+		from the lowest up: the lanes behind catch up with the ones ahead (that is where the lanes of a loop
+		meet again), and a lane that jumps back waits for the next sweep, so it can't starve the others.
+		Idle loops are skipped lane by lane, as CPU::run() does: a lane that waits forever ends the run()
+		when it is too many loops to count, even with no limit on the instructions.
+
+		Each lane ends exactly as a CPU that ran its memory with CPU::run(). The vectors are as wide as
+		the host allows: AVX2, SSE2 or (anything else) one lane at a time. */
+	class CPUBatch {
+	public:
+		/** All lanes start in the reset state, with an empty memory. */
+		explicit CPUBatch(const size_t lanes);
+
+		size_t lanes() const;
+
+		/** Copy the memory in a lane, and reset that lane. */
+		void load(const size_t lane, const MemoryChip& memory);
+
+		/** Copy of the memory of a lane. */
+		MemoryChip memory(const size_t lane) const;
+
+		/** Every lane runs up to max_instructions, as in CPU::run().
+		    The cycles each lane ran are in the cycles vector. */
+		void run(const uint64_t max_instructions);
+
+		/** @name Registers and flags, one entry per lane.
+		    The vectors are padded to a multiple of the SIMD width. The padding lanes are in error. */
+		/**@{*/
+		std::vector<uint8_t> program_counter;
+		std::vector<uint8_t> accumulator;
+		std::vector<uint8_t> overflow;   ///< 0 or 1, as CPU::overflow() after the last ADD or SUB of the lane.
+		std::vector<uint8_t> zero;       ///< 0 or 1, as CPU::zero() after the last ADD or SUB of the lane.
+		std::vector<uint8_t> error;
+		/**@}*/
+
+		/** Cycles taken by each lane in the last run(). */
+		std::vector<uint64_t> cycles;
+
+	private:
+		size_t lane_count;
+		size_t stride;   ///< Lanes, rounded up to the vector width.
+
+		/** @name The last ADD or SUB, as CPU::last_alu_result (which the idle loops compare).
+		    The high byte is 0x00, 0x01 (carry) or 0xFF (borrow). */
+		/**@{*/
+		std::vector<uint8_t> alu_low;
+		std::vector<uint8_t> alu_high;
+		/**@}*/
+
+		/** All the memories. Address a of lane l is at a * stride + l. */
+		std::vector<uint8_t> ram;
+	};
+
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "CPU.h"
+#include "MemoryChip.h"
+
+#include <cstdint>
+
+namespace CheaPU {
+
+	/** The counter from the README: ADD 0x04, JMP 0x00, counting by the step at 0x04. */
+	inline MemoryChip counter_program(const uint8_t step = 1) {
+		MemoryChip m;
+		m[0x00] = to_word(Opcode::ADD);
+		m[0x01] = 0x04;
+		m[0x02] = to_word(Opcode::JMP);
+		m[0x03] = 0x00;
+		m[0x04] = step;
+		return m;
+	}
+
+	/** The quiz from the README: sums start + ... + 2 + 1 into 0x15, then halts. */
+	inline MemoryChip quiz_program(const uint8_t start = 4) {
+		MemoryChip m;
+		const uint8_t code[] = {
+			to_word(Opcode::LD), 0x15,
+			to_word(Opcode::ADD), 0x14,
+			to_word(Opcode::ST), 0x15,
+			to_word(Opcode::LD), 0x14,
+			to_word(Opcode::SUB), 0x13,
+			to_word(Opcode::ST), 0x14,
+			to_word(Opcode::JZE), 0x10,
+			to_word(Opcode::JMP), 0x00,
+			to_word(Opcode::LD), 0x15,
+			to_word(Opcode::HALT),
+			1, start, 0
+		};
+		for (uint8_t i = 0; i < sizeof(code); ++i)
+			m[i] = code[i];
+		return m;
+	}
+}
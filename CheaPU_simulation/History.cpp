@@ -0,0 +1,116 @@
+#include "pch.h"
+#include "History.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace CheaPU {
+
+	History::History(CPU& cpu, MemoryChip& memory, const size_t memory_budget, const uint64_t checkpoint_interval) :
+		cpu(cpu),
+		memory(memory),
+		memory_budget(memory_budget),
+		checkpoint_interval(std::max<uint64_t>(checkpoint_interval, 1)),
+		cycle_count(0)
+	{
+		if (cpu.which_engine() != Engine::microcode)
+			throw std::invalid_argument("The History needs a CPU with the microcode engine.");
+		if (memory_budget < sizeof(Checkpoint) + max_stores() * sizeof(Store))
+			throw std::invalid_argument("The memory budget can't fit even one checkpoint and its undo log.");
+
+		undo_log.reserve(max_stores());
+		take_checkpoint();
+	}
+
+	bool History::step()
+	{
+		if (cpu.error)
+			return false;
+
+		if (cycle_count - checkpoints.back().cycle == checkpoint_interval)
+			take_checkpoint();
+
+		const uint8_t address = cpu.save_state().operand;  // 0 between instructions, but no write starts there.
+		const uint8_t old_value = memory.read(address);
+		cpu.cycle(memory);
+		if (memory.read(address) != old_value)
+			undo_log.push_back({ address, old_value });
+		++cycle_count;
+		return true;
+	}
+
+	uint64_t History::run(const uint64_t max_cycles)
+	{
+		uint64_t cycles = 0;
+		while (cycles < max_cycles && step())
+			++cycles;
+		return cycles;
+	}
+
+	bool History::step_back(const uint64_t cycles)
+	{
+		if (cycles > cycle_count - oldest())
+			return false;
+
+		// Back to the last checkpoint not after the target, then forward again.
+		const uint64_t target = cycle_count - cycles;
+		if (target >= checkpoints.back().cycle)
+			undo();
+		else {
+			while (checkpoints.back().cycle > target)
+				checkpoints.pop_back();
+			restore_snapshot(checkpoints.back().snapshot, cpu, memory);
+			undo_log.clear();
+		}
+		cycle_count = checkpoints.back().cycle;
+
+		// It can only stop before the target if something changed behind its back.
+		while (cycle_count < target)
+			if (!step())
+				return false;
+		return true;
+	}
+
+	uint64_t History::now() const
+	{
+		return cycle_count;
+	}
+
+	uint64_t History::oldest() const
+	{
+		return checkpoints.front().cycle;
+	}
+
+	size_t History::memory_used() const
+	{
+		return checkpoints.size() * sizeof(Checkpoint) + undo_log.capacity() * sizeof(Store);
+	}
+
+	uint64_t History::max_stores() const
+	{
+		return checkpoint_interval / 3 + 1;
+	}
+
+	void History::take_checkpoint()
+	{
+		checkpoints.push_back({ cycle_count, take_snapshot(cpu, memory) });
+		undo_log.clear();  // The new checkpoint covers everything before.
+		forget_old_checkpoints();
+	}
+
+	void History::undo()
+	{
+		for (auto store = undo_log.rbegin(); store != undo_log.rend(); ++store)
+			memory.write(store->address, store->old_value);
+		undo_log.clear();
+		cpu.restore_state(checkpoints.back().snapshot.cpu);
+	}
+
+	void History::forget_old_checkpoints()
+	{
+		// The newest checkpoint stays, whatever happens: it is where the undo log starts.
+		while (checkpoints.size() > 1 && memory_used() > memory_budget)
+			checkpoints.pop_front();
+	}
+
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "CPU.h"
+#include "MemoryChip.h"
+#include "Snapshot.h"
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace CheaPU {
+
+	/** Runs the CPU forward one cycle at a time, remembering enough to go back.
+
+		Every checkpoint_interval cycles it takes a Snapshot (a checkpoint: the registers and the memory).
+		Since the last checkpoint, it also keeps an undo log of the stores: where and what each ST overwrote.
+		Nothing for the cycles that write nothing, which are most of them. Going back:
+		- into the last interval, undoes the stores to bring the memory back to the checkpoint
+		  (no need to copy all of it), puts back the registers of the checkpoint and runs forward to the target;
+		- further, restores the closest checkpoint before the target and runs forward from there.
+		Either way it runs the cycles again: the machine has no inputs, it does exactly what it did the first time.
+
+		Going back drops whatever came after: running forward again re-records it.
+
+		The memory is bounded: when the checkpoints and the undo log take more than the budget,
+		the oldest checkpoints go (and with them the chance to go back that far).
+
+		Needs a CPU with the Engine::microcode: the coroutines can't save their state in the middle of an instruction.
+		The CPU and the memory must not change behind its back. */
+	class History {
+	public:
+		/** The current state of the CPU and memory is the cycle 0, the first checkpoint.
+		    Throws std::invalid_argument if the CPU does not use the Engine::microcode, or if the budget
+			does not even fit one checkpoint and a full undo log. */
+		History(CPU& cpu, MemoryChip& memory, const size_t memory_budget = 64 * 1024 * 1024, const uint64_t checkpoint_interval = 4096);
+
+		/** One cycle forward. False (and nothing done) if the CPU is stopped. */
+		bool step();
+
+		/** Up to max_cycles forward, stops if the CPU stops. @return the cycles done. */
+		uint64_t run(const uint64_t max_cycles);
+
+		/** Goes back to the state of cycles ago. False (and nothing done) if that is before oldest().
+		    Also false if the CPU stopped while running forward to it again, which can only happen if the CPU
+			or the memory changed behind its back: then it stays where it stopped (see now()). */
+		bool step_back(const uint64_t cycles = 1);
+
+		/** Cycles run since the History was created (forward, minus the ones undone). */
+		uint64_t now() const;
+
+		/** The earliest cycle that step_back() can still reach. */
+		uint64_t oldest() const;
+
+		/** Bytes in checkpoints and undo log (allocated, not just used). */
+		size_t memory_used() const;
+
+	private:
+		/** A byte that a cycle changed. The only write a cycle can do is the ST that goes to the latched operand. */
+		struct Store {
+			uint8_t address;
+			uint8_t old_value;
+		};
+
+		struct Checkpoint {
+			uint64_t cycle;
+			Snapshot snapshot;
+		};
+
+		CPU& cpu;
+		MemoryChip& memory;
+		const size_t memory_budget;
+		const uint64_t checkpoint_interval;
+
+		uint64_t cycle_count;
+		std::deque<Checkpoint> checkpoints;
+		std::vector<Store> undo_log;  ///< From the last checkpoint to now.
+
+		/** Worst case for the undo log: a ST every 3 cycles, one more if the interval starts in the middle of one. */
+		uint64_t max_stores() const;
+
+		void take_checkpoint();
+		/** Back to the last checkpoint: the memory with the undo log, the registers from its snapshot. */
+		void undo();
+		void forget_old_checkpoints();
+	};
+
+}
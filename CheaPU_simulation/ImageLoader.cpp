@@ -0,0 +1,328 @@
+#include "pch.h"
+#include "ImageLoader.h"
+
+#include "MemoryChip.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace CheaPU {
+
+	namespace {
+
+		/** A read-only view of a whole file. No copy: the OS pages it in when it is read. */
+		class MappedFile {
+		public:
+			explicit MappedFile(const std::string& path) :
+				data(nullptr),
+				size(0)
+			{
+#ifdef _WIN32
+				file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+				if (file == INVALID_HANDLE_VALUE)
+					throw std::runtime_error("Can't open " + path);
+
+				LARGE_INTEGER file_size;
+				GetFileSizeEx(file, &file_size);
+				size = static_cast<size_t>(file_size.QuadPart);
+				if (size == 0)
+					return;  // Can't map nothing.
+
+				mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+				if (mapping)
+					data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+				descriptor = open(path.c_str(), O_RDONLY);
+				if (descriptor < 0)
+					throw std::runtime_error("Can't open " + path);
+
+				struct stat status;
+				fstat(descriptor, &status);
+				size = static_cast<size_t>(status.st_size);
+				if (size == 0)
+					return;
+
+				void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+				if (view != MAP_FAILED)
+					data = static_cast<const uint8_t*>(view);
+#endif
+				if (!data) {
+					close_file();
+					throw std::runtime_error("Can't map " + path);
+				}
+			}
+
+			~MappedFile()
+			{
+				close_file();
+			}
+
+			const uint8_t* data;
+			size_t size;
+
+		private:
+#ifdef _WIN32
+			HANDLE file = INVALID_HANDLE_VALUE;
+			HANDLE mapping = nullptr;
+#else
+			int descriptor = -1;
+#endif
+
+			void close_file()
+			{
+#ifdef _WIN32
+				if (data)
+					UnmapViewOfFile(data);
+				if (mapping)
+					CloseHandle(mapping);
+				CloseHandle(file);
+#else
+				if (data)
+					munmap(const_cast<uint8_t*>(data), size);
+				close(descriptor);
+#endif
+			}
+
+			MappedFile(const MappedFile&) = delete;
+			void operator=(const MappedFile&) = delete;
+		};
+
+		void check_fits(const size_t address, const size_t count)
+		{
+			if (address > MemoryChip::size || count > MemoryChip::size - address)
+				throw std::runtime_error("The image does not fit in the memory.");
+		}
+
+		int hex_digit(const char c)
+		{
+			if (c >= '0' && c <= '9')
+				return c - '0';
+			if (c >= 'a' && c <= 'f')
+				return c - 'a' + 10;
+			if (c >= 'A' && c <= 'F')
+				return c - 'A' + 10;
+			throw std::runtime_error(std::string("Not a hex digit: '") + c + "'.");
+		}
+
+		uint8_t hex_byte(const std::string& text, const size_t position)
+		{
+			if (position + 2 > text.size())
+				throw std::runtime_error("Intel HEX record too short.");
+			return static_cast<uint8_t>(hex_digit(text[position]) * 16 + hex_digit(text[position + 1]));
+		}
+
+		/** The data of a record, at its address in the memory. */
+		struct Chunk {
+			size_t address;
+			std::vector<uint8_t> data;
+		};
+
+		void load_chunks(const std::vector<Chunk>& chunks, MemoryChip& memory)
+		{
+			for (const Chunk& chunk : chunks)
+				memory.load(chunk.address, chunk.data.data(), chunk.data.size());
+		}
+
+		size_t parse_intel_hex(const std::string& text, MemoryChip& memory, const size_t base)
+		{
+			// Nothing goes in the memory until the whole file is good: a broken record leaves it as it was.
+			std::istringstream lines(text);
+			std::string line;
+			std::vector<Chunk> chunks;
+			size_t loaded = 0;
+			size_t extended_address = 0;
+
+			while (std::getline(lines, line)) {
+				while (!line.empty() && std::isspace(static_cast<unsigned char>(line.back())))
+					line.pop_back();  // Also the \r of the DOS files.
+				if (line.empty())
+					continue;
+				if (line[0] != ':')
+					throw std::runtime_error("Intel HEX record without ':'.");
+
+				// :LLAAAATT, the data, the checksum.
+				const uint8_t length = hex_byte(line, 1);
+				if (line.size() != 11 + 2 * size_t(length))
+					throw std::runtime_error("Intel HEX record of the wrong length.");
+
+				std::vector<uint8_t> bytes;
+				uint8_t checksum = 0;
+				for (size_t i = 1; i < line.size(); i += 2) {
+					bytes.push_back(hex_byte(line, i));
+					checksum += bytes.back();
+				}
+				if (checksum != 0)
+					throw std::runtime_error("Intel HEX record with the wrong checksum.");
+
+				const size_t address = bytes[1] * 256 + bytes[2];
+				const uint8_t* const data = bytes.data() + 4;
+				switch (bytes[3]) {
+				case 0x00:  // Data.
+					check_fits(base + extended_address + address, length);
+					chunks.push_back({ base + extended_address + address, std::vector<uint8_t>(data, data + length) });
+					loaded += length;
+					break;
+				case 0x01:  // End of file.
+					load_chunks(chunks, memory);
+					return loaded;
+				case 0x02:  // Extended segment address: 16 bytes "paragraphs".
+					if (length != 2)
+						throw std::runtime_error("Intel HEX extended segment address record without 2 bytes.");
+					extended_address = (data[0] * 256 + data[1]) * 16;
+					break;
+				case 0x04:  // Extended linear address: the upper 16 bits.
+					if (length != 2)
+						throw std::runtime_error("Intel HEX extended linear address record without 2 bytes.");
+					extended_address = size_t(data[0] * 256 + data[1]) << 16;
+					break;
+				default:  // Start addresses: the CPU always starts from 0.
+					break;
+				}
+			}
+
+			load_chunks(chunks, memory);
+			return loaded;
+		}
+
+		size_t parse_hex_text(const std::string& text, MemoryChip& memory, const size_t base)
+		{
+			std::istringstream lines(text);
+			std::string line;
+			std::vector<uint8_t> bytes;
+
+			while (std::getline(lines, line)) {
+				line = line.substr(0, line.find_first_of(";#"));
+
+				std::istringstream words(line);
+				std::string word;
+				while (words >> word) {
+					if (word.size() > 2 && word[0] == '0' && (word[1] == 'x' || word[1] == 'X'))
+						word = word.substr(2);
+					if (word.size() > 2)
+						throw std::runtime_error("Not a byte: " + word);
+
+					int value = 0;
+					for (const char c : word)
+						value = value * 16 + hex_digit(c);
+					bytes.push_back(static_cast<uint8_t>(value));
+				}
+			}
+
+			check_fits(base, bytes.size());
+			memory.load(base, bytes.data(), bytes.size());
+			return bytes.size();
+		}
+
+		void write_intel_hex(std::ostream& out, const MemoryChip& memory, const size_t first, const size_t end)
+		{
+			static constexpr size_t record_size = 16;
+
+			out << std::hex << std::uppercase << std::setfill('0');
+			for (size_t start = first; start < end; start += record_size) {
+				const size_t length = std::min(record_size, end - start);
+				const size_t address = start - first;
+
+				uint8_t checksum = static_cast<uint8_t>(length + (address >> 8) + (address & 0xFF));
+				out << ':' << std::setw(2) << length << std::setw(4) << address << "00";
+				for (size_t i = start; i < start + length; ++i) {
+					out << std::setw(2) << +memory.read(i);
+					checksum += memory.read(i);
+				}
+				out << std::setw(2) << +static_cast<uint8_t>(-checksum) << "\n";
+			}
+			out << ":00000001FF\n" << std::dec << std::nouppercase << std::setfill(' ');
+		}
+
+		void write_hex_text(std::ostream& out, const MemoryChip& memory, const size_t first, const size_t end)
+		{
+			static constexpr size_t line_size = 16;
+
+			out << std::hex << std::uppercase << std::setfill('0');
+			for (size_t i = first; i < end; ++i)
+				out << std::setw(2) << +memory.read(i) << ((i - first) % line_size == line_size - 1 || i + 1 == end ? "\n" : " ");
+			out << std::dec << std::nouppercase << std::setfill(' ');
+		}
+
+		ImageFormat format_of(const std::string& path)
+		{
+			const size_t dot = path.find_last_of('.');
+			std::string extension = dot == std::string::npos ? "" : path.substr(dot + 1);
+			for (char& c : extension)
+				c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+
+			if (extension == "hex" || extension == "ihx")
+				return ImageFormat::intel_hex;
+			if (extension == "txt")
+				return ImageFormat::hex_text;
+			return ImageFormat::raw;
+		}
+	}
+
+	size_t load_image(const std::string& path, MemoryChip& memory, const size_t base, ImageFormat format)
+	{
+		if (format == ImageFormat::guess)
+			format = format_of(path);
+
+		if (format == ImageFormat::raw) {
+			const MappedFile file(path);
+			check_fits(base, file.size);
+			memory.load(base, file.data, file.size);
+			return file.size;
+		}
+
+		std::ifstream file(path, std::ios::binary);
+		if (!file)
+			throw std::runtime_error("Can't open " + path);
+		std::stringstream text;
+		text << file.rdbuf();
+		return parse_image(text.str(), memory, base, format);
+	}
+
+	size_t parse_image(const std::string& text, MemoryChip& memory, const size_t base, const ImageFormat format)
+	{
+		switch (format) {
+		case ImageFormat::intel_hex:
+			return parse_intel_hex(text, memory, base);
+		case ImageFormat::hex_text:
+			return parse_hex_text(text, memory, base);
+		default:
+			throw std::invalid_argument("Only the text formats can be parsed.");
+		}
+	}
+
+	void write_image(std::ostream& out, const MemoryChip& memory, const size_t first, const size_t end, const ImageFormat format)
+	{
+		if (first > end || end > MemoryChip::size)
+			throw std::invalid_argument("The range is not in the memory.");
+
+		switch (format) {
+		case ImageFormat::raw:
+			for (size_t i = first; i < end; ++i)
+				out.put(static_cast<char>(memory.read(i)));
+			break;
+		case ImageFormat::intel_hex:
+			write_intel_hex(out, memory, first, end);
+			break;
+		case ImageFormat::hex_text:
+			write_hex_text(out, memory, first, end);
+			break;
+		default:
+			throw std::invalid_argument("Can't write an image without knowing the format.");
+		}
+	}
+
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace CheaPU {
+
+	class MemoryChip;
+
+	/** The files a program can come from. */
+	enum class ImageFormat : uint8_t {
+		/** The bytes as they go in memory. Mapped in memory (mmap, MapViewOfFile), then copied in one go. */
+		raw,
+
+		/** Intel HEX (":10000000..." records with checksums), as written by most assemblers and EPROM tools.
+		    The addresses in the file are relative to the base. */
+		intel_hex,
+
+		/** Bytes written in hex, separated by spaces or new lines ("01 15 03 14 ...").
+		    Anything after a ';' or a '#' is a comment, up to the end of the line. */
+		hex_text,
+
+		/** From the extension: ".hex" and ".ihx" are Intel HEX, ".txt" is hex text, everything else is raw. */
+		guess
+	};
+
+	/** Loads a program in the memory, starting from the base address.
+	    What is not in the file stays as it was.
+		Throws std::runtime_error if the file can't be read, is broken (bad checksum, not hex...)
+		or does not fit in the memory.
+		@return how many bytes it loaded. */
+	size_t load_image(const std::string& path, MemoryChip& memory, const size_t base = 0, ImageFormat format = ImageFormat::guess);
+
+	/** The same, from what would be in the file. Raw images can't be parsed (there is nothing to parse):
+	    they are std::invalid_argument here. */
+	size_t parse_image(const std::string& text, MemoryChip& memory, const size_t base, const ImageFormat format);
+
+	/** The other way around: writes the bytes from first to end (excluded) so that load_image() with first as the base
+	    gets them back. Intel HEX has 16 bytes per record, hex text 16 per line.
+		Throws std::invalid_argument for the guess format or a range outside the memory. */
+	void write_image(std::ostream& out, const MemoryChip& memory, const size_t first, const size_t end, const ImageFormat format);
+}
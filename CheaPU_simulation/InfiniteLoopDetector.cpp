@@ -0,0 +1,109 @@
+#include "pch.h"
+#include "InfiniteLoopDetector.h"
+
+#include <algorithm>
+#include <array>
+
+namespace CheaPU {
+
+	StateHash::StateHash(const MemoryChip& memory) :
+		memory_hash(0)
+	{
+		for (size_t address = 0; address < memory.storage.size(); ++address)
+			memory_hash ^= byte_hash(address, memory.storage[address]);
+	}
+
+	uint64_t StateHash::of(const CPUState& cpu) const
+	{
+		const uint64_t registers =
+			uint64_t(cpu.program_counter) |
+			uint64_t(cpu.accumulator) << 8 |
+			uint64_t(cpu.overflow) << 16 |
+			uint64_t(cpu.zero) << 17 |
+			uint64_t(cpu.error) << 18 |
+			uint64_t(cpu.micro_pc) << 24 |
+			uint64_t(cpu.operand) << 32;
+
+		// Bit 63 is never set in the input of a byte_hash: the registers never mix the same number.
+		return memory_hash ^ mix(registers | uint64_t(1) << 63);
+	}
+
+	InfiniteLoopDetector::InfiniteLoopDetector() :
+		period_instructions(0),
+		period_cycles(0)
+	{
+	}
+
+	bool InfiniteLoopDetector::looping() const
+	{
+		return period_instructions != 0;
+	}
+
+	uint64_t InfiniteLoopDetector::run(CPU& cpu, MemoryChip& memory, const uint64_t max_cycles)
+	{
+		// The operand of ST is a single byte: the rest of the memory never changes, there is no need to compare it.
+		static constexpr size_t writable = 256;
+
+		period_instructions = 0;
+		period_cycles = 0;
+
+		// The hash can only follow a ST from its start: finish the half instruction left by run_cycles(), if any.
+		uint64_t total = 0;
+		if (!cpu.error && !cpu.instruction_completed() && max_cycles >= CPU::longest_instruction)
+			total += cpu.step_instruction(memory, max_cycles);
+
+		StateHash hash(memory);
+
+		/** @name The saved state (the "tortoise" of Brent). */
+		/**@{*/
+		bool saved = false;
+		CPUState saved_cpu{};
+		std::array<uint8_t, writable> saved_memory;
+		uint64_t saved_hash = 0;
+		uint64_t saved_cycles = 0;
+		/**@}*/
+
+		uint64_t power = 1;     // The saved state moves when the distance reaches it...
+		uint64_t distance = 0;  // ...instructions since it was saved.
+
+		while (!cpu.error && total < max_cycles) {
+			const bool between_instructions = cpu.instruction_completed();
+			if (between_instructions) {
+				const CPUState state = cpu.save_state();
+				const uint64_t current = hash.of(state);
+
+				if (saved && current == saved_hash && state == saved_cpu &&
+					std::equal(saved_memory.begin(), saved_memory.end(), memory.storage.begin())) {
+					period_instructions = distance;
+					period_cycles = total - saved_cycles;
+					return total;
+				}
+
+				if (!saved || distance == power) {
+					if (saved)
+						power *= 2;
+					saved = true;
+					saved_cpu = state;
+					std::copy_n(memory.storage.begin(), writable, saved_memory.begin());
+					saved_hash = current;
+					saved_cycles = total;
+					distance = 0;
+				}
+			}
+
+			// Take note of what a ST is about to overwrite.
+			const bool store = between_instructions && memory.read(cpu.program_counter) == to_word(Opcode::ST);
+			const uint8_t address = store ? memory.read(cpu.program_counter + 1) : 0;
+			const uint8_t old_value = memory.read(address);
+
+			total += cpu.step_instruction(memory, max_cycles - total);
+
+			if (store && cpu.instruction_completed())
+				hash.write(address, old_value, memory.read(address));
+			++distance;
+		}
+
+		return total;
+	}
+
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "CPU.h"
+#include "MemoryChip.h"
+
+#include <cstddef>
+#include <cstdint>
+
+namespace CheaPU {
+
+	/** A 64 bit hash of the whole machine: the CPU (between two instructions) and the memory.
+
+		The memory part is the xor of one random looking number per byte, which depends on the address and
+		on the value (Zobrist hashing, as in the chess programs, with the numbers computed instead of kept
+		in a table: a table for 8K bytes of 256 values each would take 16MB).
+		When a byte changes, it is enough to take its old number out and put the new one in:
+		no need to go over the whole memory again after every ST.
+		The CPU is just a few bytes, it is hashed from scratch every time. */
+	class StateHash {
+	public:
+		/** Goes over the whole memory, once. */
+		explicit StateHash(const MemoryChip& memory);
+
+		/** The byte at the address went from old_value to new_value. */
+		void write(const size_t address, const uint8_t old_value, const uint8_t new_value)
+		{
+			memory_hash ^= byte_hash(address, old_value) ^ byte_hash(address, new_value);
+		}
+
+		/** The hash of the memory together with the CPU. */
+		uint64_t of(const CPUState& cpu) const;
+
+		/** The hash of the memory alone. */
+		uint64_t memory() const
+		{
+			return memory_hash;
+		}
+
+		/** The number of one byte. 0 for the zeroes, so that the empty memory costs nothing. */
+		static uint64_t byte_hash(const size_t address, const uint8_t value)
+		{
+			return value == 0 ? 0 : mix((uint64_t(address) << 8) | value);
+		}
+
+	private:
+		uint64_t memory_hash;
+
+		/** The "finalizer" of SplitMix64: any change in the input changes half of the output bits. */
+		static uint64_t mix(uint64_t x)
+		{
+			x += 0x9E3779B97F4A7C15;
+			x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9;
+			x = (x ^ (x >> 27)) * 0x94D049BB133111EB;
+			return x ^ (x >> 31);
+		}
+	};
+
+	/** Proves that a program never halts, and stops it.
+
+		The machine is deterministic: if it ever comes back to a state it was in before (between two instructions),
+		from there it does the same things all over again, forever. Think of a loop that counts from 0 to 255
+		and back to 0, without ever halting. The idle loops of CPU::run() are a special case,
+		but here the loop can also store in memory, as long as it comes back to the same content.
+
+		The repeated state is found with Brent's algorithm. There is one saved state at a time, and every new state
+		is compared with it. The saved state moves forward to the current one when the instructions since
+		it was saved reach a power of 2. A loop of period p that starts after s instructions is found within
+		about 2 * max(s, p) + p instructions. The states are compared by their StateHash first, then in full,
+		so two states that happen to have the same hash are no false alarm. */
+	class InfiniteLoopDetector {
+	public:
+		InfiniteLoopDetector();
+
+		/** Runs like CPU::run_cycles(), one instruction at a time, but stops as soon as a state repeats
+		    (see looping()). Every run() starts looking from scratch. */
+		uint64_t run(CPU& cpu, MemoryChip& memory, const uint64_t max_cycles);
+
+		/** True if the last run() stopped because the program went into an infinite loop. */
+		bool looping() const;
+
+		/** @name The infinite loop found by the last run(). 0 if there was none (or it was not found in time). */
+		/**@{*/
+		uint64_t period_instructions;  ///< Instructions to go once around the loop.
+		uint64_t period_cycles;        ///< Machine cycles to go once around the loop.
+		/**@}*/
+	};
+
+}
@@ -0,0 +1,482 @@
+#include "pch.h"
+#include "JitCompiler.h"
+
+#include "MemoryChip.h"
+
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CHEAPU_JIT_X64
+#endif
+
+#ifdef CHEAPU_JIT_X64
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+namespace CheaPU {
+
+	static_assert(offsetof(JitCompiler::NativeContext, ram) == 0);
+	static_assert(offsetof(JitCompiler::NativeContext, cycles) == 8);
+	static_assert(offsetof(JitCompiler::NativeContext, accumulator) == 16);
+	static_assert(offsetof(JitCompiler::NativeContext, program_counter) == 17);
+	static_assert(offsetof(JitCompiler::NativeContext, halted) == 18);
+	static_assert(offsetof(JitCompiler::NativeContext, code_written) == 19);
+	static_assert(offsetof(JitCompiler::NativeContext, overflow) == 20);
+	static_assert(offsetof(JitCompiler::NativeContext, zero) == 21);
+	static_assert(offsetof(JitCompiler::NativeContext, link_site) == 24);
+	static_assert(offsetof(JitCompiler::NativeContext, budget) == 32);
+	static_assert(offsetof(JitCompiler::NativeContext, code_bytes) == 40);
+
+	namespace {
+
+		constexpr size_t executable_buffer_size = 1024 * 1024;
+
+		/** More than the code for the longest possible block (256 NOPs, or 128 stores with their checks). */
+		constexpr size_t max_block_code = 16 * 1024;
+
+		/** Puts the machine code in the buffer, one byte after the other.
+		    Register usage in the generated code:
+				R8  = the NativeContext
+				R9  = the memory
+				R10 = how many instructions can still run
+				R11 = cycles
+				RCX = the table of the bytes that are compiled code
+				AL  = the accumulator
+			They are all "volatile" registers in both the Windows and the System V calling conventions,
+			so there is nothing to save. */
+		class Emitter {
+		public:
+			explicit Emitter(uint8_t* cursor) :
+				cursor(cursor)
+			{}
+
+			void bytes(std::initializer_list<uint8_t> code)
+			{
+				for (const uint8_t byte : code)
+					*cursor++ = byte;
+			}
+
+			void imm32(const uint32_t value)
+			{
+				std::memcpy(cursor, &value, sizeof(value));  // x86 is little endian, like the immediates.
+				cursor += sizeof(value);
+			}
+
+			/** A 32 bit relative displacement to fill later. Points to the next instruction for now. */
+			uint8_t* rel32_placeholder()
+			{
+				uint8_t* const site = cursor;
+				imm32(0);
+				return site;
+			}
+
+			static void patch_rel32(uint8_t* site, const uint8_t* target)
+			{
+				const int32_t displacement = static_cast<int32_t>(target - (site + 4));
+				std::memcpy(site, &displacement, sizeof(displacement));
+			}
+
+			/** @name Instructions that access the guest memory, [R9 + address]. */
+			/**@{*/
+			void load(const uint8_t address)             { bytes({ 0x41, 0x8A, 0x81 }); imm32(address); }  // mov al, [r9 + address]
+			void store(const uint8_t address)            { bytes({ 0x41, 0x88, 0x81 }); imm32(address); }  // mov [r9 + address], al
+			void add(const uint8_t address)              { bytes({ 0x41, 0x02, 0x81 }); imm32(address); }  // add al, [r9 + address]
+			void subtract(const uint8_t address)         { bytes({ 0x41, 0x2A, 0x81 }); imm32(address); }  // sub al, [r9 + address]
+			/**@}*/
+
+			void compare_code_byte(const uint8_t address) { bytes({ 0x80, 0xB9 }); imm32(address); bytes({ 0x00 }); }  // cmp byte [rcx + address], 0
+			void test_accumulator()                       { bytes({ 0x84, 0xC0 }); }                             // test al, al
+
+			void compare_budget(const uint32_t value)     { bytes({ 0x49, 0x81, 0xFA }); imm32(value); }  // cmp r10, value
+			void subtract_budget(const uint32_t value)    { bytes({ 0x49, 0x81, 0xEA }); imm32(value); }  // sub r10, value
+			void add_budget(const uint32_t value)         { bytes({ 0x49, 0x81, 0xC2 }); imm32(value); }  // add r10, value
+			void add_cycles(const uint32_t value)         { bytes({ 0x49, 0x81, 0xC3 }); imm32(value); }  // add r11, value
+
+			void set_program_counter(const uint8_t value) { bytes({ 0x41, 0xC6, 0x40, 0x11, value }); }  // mov byte [r8 + 17], value
+			void set_halted()                             { bytes({ 0x41, 0xC6, 0x40, 0x12, 0x01 }); }   // mov byte [r8 + 18], 1
+			void set_code_written()                       { bytes({ 0x41, 0xC6, 0x40, 0x13, 0x01 }); }   // mov byte [r8 + 19], 1
+
+			/** setc byte [r8 + 20]; setz byte [r8 + 21] */
+			void save_flags()
+			{
+				bytes({ 0x41, 0x0F, 0x92, 0x40, 0x14 });
+				bytes({ 0x41, 0x0F, 0x94, 0x40, 0x15 });
+			}
+
+			/** lea rdx, [site]; mov [r8 + 24], rdx */
+			void set_link_site(const uint8_t* site)
+			{
+				bytes({ 0x48, 0x8D, 0x15 });
+				const int32_t displacement = static_cast<int32_t>(site - (cursor + 4));
+				imm32(static_cast<uint32_t>(displacement));
+				bytes({ 0x49, 0x89, 0x50, 0x18 });
+			}
+
+			uint8_t* jump()                   { bytes({ 0xE9 }); return rel32_placeholder(); }        // jmp
+			uint8_t* jump_if_below()          { bytes({ 0x0F, 0x82 }); return rel32_placeholder(); }  // jb
+			uint8_t* jump_if_not_zero()       { bytes({ 0x0F, 0x85 }); return rel32_placeholder(); }  // jnz
+
+			void jump_to(const uint8_t* target)
+			{
+				patch_rel32(jump(), target);
+			}
+
+			uint8_t* cursor;
+		};
+
+		/** A way out of a block that is emitted after the body, to keep the body straight. */
+		struct DeferredExit {
+			uint8_t* site;
+			uint8_t program_counter;
+			uint32_t cycles;
+			uint32_t refund;   ///< Instructions that were subtracted from the budget, but did not run.
+		};
+	}
+
+	JitCompiler::JitCompiler() :
+		buffer(nullptr),
+		buffer_size(0),
+		buffer_used(0),
+		flushed_size(0),
+		enter(nullptr),
+		common_exit(nullptr),
+		compiled_memory(0),
+		code_version(0)
+	{
+		for (Block& block : blocks) {
+			block.compiled = false;
+			block.body = nullptr;
+			block.instructions = 0;
+		}
+		code_bytes.fill(0);
+
+#ifdef CHEAPU_JIT_X64
+#ifdef _WIN32
+		void* memory = VirtualAlloc(nullptr, executable_buffer_size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+		if (!memory)
+			return;
+#else
+		void* memory = mmap(nullptr, executable_buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (memory == MAP_FAILED)
+			return;
+#endif
+		buffer = static_cast<uint8_t*>(memory);
+		buffer_size = executable_buffer_size;
+
+		// The trampoline from C++: takes the context and the block to start from, loads the registers
+		// and jumps. It is never called again until the code comes back trough the common exit,
+		// that "returns" to the C++ caller.
+		Emitter e(buffer);
+#ifdef _WIN32
+		e.bytes({ 0x49, 0x89, 0xC8 });  // mov r8, rcx
+#else
+		e.bytes({ 0x49, 0x89, 0xF8 });  // mov r8, rdi
+#endif
+		e.bytes({ 0x4D, 0x8B, 0x08 });        // mov r9, [r8]
+		e.bytes({ 0x4D, 0x8B, 0x58, 0x08 });  // mov r11, [r8 + 8]
+		e.bytes({ 0x4D, 0x8B, 0x50, 0x20 });  // mov r10, [r8 + 32]
+		e.bytes({ 0x49, 0x8B, 0x48, 0x28 });  // mov rcx, [r8 + 40]
+		e.bytes({ 0x41, 0x8A, 0x40, 0x10 });  // mov al, [r8 + 16]
+#ifdef _WIN32
+		e.bytes({ 0xFF, 0xE2 });  // jmp rdx
+#else
+		e.bytes({ 0xFF, 0xE6 });  // jmp rsi
+#endif
+
+		common_exit = e.cursor;
+		e.bytes({ 0x41, 0x88, 0x40, 0x10 });  // mov [r8 + 16], al
+		e.bytes({ 0x4D, 0x89, 0x58, 0x08 });  // mov [r8 + 8], r11
+		e.bytes({ 0x4D, 0x89, 0x50, 0x20 });  // mov [r8 + 32], r10
+		e.bytes({ 0xC3 });                    // ret
+
+		enter = reinterpret_cast<Trampoline>(buffer);
+		buffer_used = e.cursor - buffer;
+		flushed_size = buffer_used;
+		make_executable();
+#endif
+	}
+
+	JitCompiler::~JitCompiler()
+	{
+#ifdef CHEAPU_JIT_X64
+		if (buffer) {
+#ifdef _WIN32
+			VirtualFree(buffer, 0, MEM_RELEASE);
+#else
+			munmap(buffer, buffer_size);
+#endif
+		}
+#endif
+	}
+
+	bool JitCompiler::available() const
+	{
+		return buffer != nullptr;
+	}
+
+	uint64_t JitCompiler::run(CPU& cpu, MemoryChip& memory, const uint64_t max_instructions)
+	{
+		if (!available())
+			return cpu.run(memory, max_instructions);
+
+		uint64_t cycles = 0;
+		uint64_t executed = 0;
+
+		// The blocks start at instruction boundaries, let the CPU finish what is in progress.
+		if (!cpu.error && max_instructions > 0 && !cpu.instruction_completed()) {
+			cycles += cpu.run(memory, 1);
+			++executed;
+		}
+
+		NativeContext context;
+		context.ram = memory.storage.data();
+		context.code_bytes = code_bytes.data();
+		context.accumulator = cpu.accumulator;
+		context.program_counter = cpu.program_counter;
+		context.halted = cpu.error;
+		context.overflow = cpu.overflow();
+		context.zero = cpu.zero();
+
+		while (!context.halted && executed < max_instructions) {
+			if (compiled_memory != memory.identity() || memory.code_version != code_version)
+				flush(memory);
+
+			Block& block = blocks[context.program_counter];
+			if (!block.compiled) {
+				if (buffer_size - buffer_used < max_block_code)
+					flush(memory);
+				compile(block, context.program_counter, memory);
+			}
+
+			const uint64_t remaining = max_instructions - executed;
+			if (!block.body || block.instructions > remaining) {
+				// Illegal opcode (it is up to the CPU to stop), or not enough instructions
+				// left to do the whole block.
+				const uint64_t steps = block.body ? remaining : 1;
+				cpu.program_counter = context.program_counter;
+				cpu.accumulator = context.accumulator;
+				cpu.set_flags(context.overflow, context.zero);
+				cycles += cpu.run(memory, steps);
+				executed += steps;
+				context.program_counter = cpu.program_counter;
+				context.accumulator = cpu.accumulator;
+				context.overflow = cpu.overflow();
+				context.zero = cpu.zero();
+				context.halted = cpu.error;
+				continue;
+			}
+
+			context.cycles = 0;
+			context.budget = remaining;
+			context.code_written = 0;
+			context.link_site = nullptr;
+			enter(&context, block.body);
+			cycles += context.cycles;
+			executed += remaining - context.budget;
+
+			if (context.code_written) {
+				// The native code does not go trough MemoryChip::write, do its job.
+				++memory.code_version;
+				flush(memory);
+			}
+			else if (context.link_site) {
+				// The block ended jumping to another: next time, go there directly.
+				Block& target = blocks[context.program_counter];
+				if (!target.compiled && buffer_size - buffer_used >= max_block_code)
+					compile(target, context.program_counter, memory);
+				if (target.compiled && target.body)
+					link(context.link_site, target);
+			}
+		}
+
+		cpu.program_counter = context.program_counter;
+		cpu.accumulator = context.accumulator;
+		cpu.set_flags(context.overflow, context.zero);
+		if (context.halted)
+			cpu.error = true;
+
+		return cycles;
+	}
+
+	void JitCompiler::flush(MemoryChip& memory)
+	{
+		for (Block& block : blocks) {
+			block.compiled = false;
+			block.body = nullptr;
+			block.instructions = 0;
+		}
+		code_bytes.fill(0);
+		buffer_used = flushed_size;
+
+		memory.forget_code();
+		compiled_memory = memory.identity();
+		code_version = memory.code_version;
+	}
+
+	void JitCompiler::compile(Block& block, const uint8_t start, MemoryChip& memory)
+	{
+		decoded.clear();
+		const size_t end = decode_block(memory, start, decoded);
+		memory.watch_code(start, end);
+		for (size_t address = start; address < end; ++address)
+			code_bytes[address] = 1;
+
+		block.compiled = true;
+		block.instructions = decoded.size();
+		block.body = nullptr;
+		if (decoded.empty())
+			return;
+
+		make_writable();
+		Emitter e(buffer + buffer_used);
+		block.body = e.cursor;
+
+		const uint32_t size = static_cast<uint32_t>(decoded.size());
+		e.compare_budget(size);
+		uint8_t* const no_budget = e.jump_if_below();
+		e.subtract_budget(size);
+
+		std::vector<DeferredExit> code_written_exits;
+		uint8_t pc = start;
+		uint32_t cycles = 0;
+		bool open_end = true;
+
+		// Leaves the block going to another one. The jump can be patched later to go there directly
+		// (see link()), until then it goes to the next instruction, which is the way back to the dispatcher.
+		auto exit_to_block = [&e, this](const uint8_t next, const uint32_t exit_cycles) {
+			e.add_cycles(exit_cycles);
+			uint8_t* const site = e.jump();
+			e.set_program_counter(next);
+			e.set_link_site(site);
+			e.jump_to(common_exit);
+		};
+
+		// The flags of an ADD or SUB can only be seen if the block can exit before the next one:
+		// at a store (it may change the code) or at the end.
+		auto flags_visible = [this, size](const uint32_t alu) {
+			for (uint32_t i = alu + 1; i < size; ++i) {
+				if (decoded[i].opcode == Opcode::ST)
+					return true;
+				if (decoded[i].opcode == Opcode::ADD || decoded[i].opcode == Opcode::SUB)
+					return false;
+			}
+			return true;
+		};
+
+		for (uint32_t i = 0; i < size; ++i) {
+			const DecodedInstruction& instruction = decoded[i];
+			switch (instruction.opcode) {
+			case Opcode::NOP:
+				pc += 1;
+				cycles += 2;
+				break;
+			case Opcode::LD:
+				e.load(instruction.operand);
+				pc += 2;
+				cycles += 3;
+				break;
+			case Opcode::ST:
+				e.store(instruction.operand);
+				pc += 2;
+				cycles += 3;
+				e.compare_code_byte(instruction.operand);
+				code_written_exits.push_back({ e.jump_if_not_zero(), pc, cycles, size - i - 1 });
+				break;
+			case Opcode::ADD:
+				e.add(instruction.operand);
+				if (flags_visible(i))
+					e.save_flags();
+				pc += 2;
+				cycles += 3;
+				break;
+			case Opcode::SUB:
+				e.subtract(instruction.operand);
+				if (flags_visible(i))
+					e.save_flags();
+				pc += 2;
+				cycles += 3;
+				break;
+			case Opcode::JMP:
+				exit_to_block(instruction.operand, cycles + 3);
+				open_end = false;
+				break;
+			case Opcode::JZE: {
+				e.test_accumulator();
+				uint8_t* const not_zero = e.jump_if_not_zero();
+				exit_to_block(instruction.operand, cycles + 3);
+				Emitter::patch_rel32(not_zero, e.cursor);
+				exit_to_block(static_cast<uint8_t>(pc + 2), cycles + 2);
+				open_end = false;
+				break;
+			}
+			case Opcode::HALT:
+				e.add_cycles(cycles + 2);
+				e.set_program_counter(pc);
+				e.set_halted();
+				e.jump_to(common_exit);
+				open_end = false;
+				break;
+			}
+		}
+
+		// Stopped before an illegal opcode or at the end of the memory: carry on from there.
+		if (open_end)
+			exit_to_block(pc, cycles);
+
+		Emitter::patch_rel32(no_budget, e.cursor);
+		e.set_program_counter(start);
+		e.jump_to(common_exit);
+
+		for (const DeferredExit& exit : code_written_exits) {
+			Emitter::patch_rel32(exit.site, e.cursor);
+			e.add_cycles(exit.cycles);
+			if (exit.refund > 0)
+				e.add_budget(exit.refund);
+			e.set_program_counter(exit.program_counter);
+			e.set_code_written();
+			e.jump_to(common_exit);
+		}
+
+		buffer_used = e.cursor - buffer;
+		make_executable();
+	}
+
+	void JitCompiler::link(uint8_t* site, const Block& target)
+	{
+		make_writable();
+		Emitter::patch_rel32(site, target.body);
+		make_executable();
+	}
+
+	void JitCompiler::make_writable()
+	{
+#ifdef CHEAPU_JIT_X64
+#ifdef _WIN32
+		DWORD old_protection;
+		VirtualProtect(buffer, buffer_size, PAGE_READWRITE, &old_protection);
+#else
+		mprotect(buffer, buffer_size, PROT_READ | PROT_WRITE);
+#endif
+#endif
+	}
+
+	void JitCompiler::make_executable()
+	{
+#ifdef CHEAPU_JIT_X64
+#ifdef _WIN32
+		DWORD old_protection;
+		VirtualProtect(buffer, buffer_size, PAGE_EXECUTE_READ, &old_protection);
+		FlushInstructionCache(GetCurrentProcess(), buffer, buffer_size);
+#else
+		mprotect(buffer, buffer_size, PROT_READ | PROT_EXEC);
+#endif
+#endif
+	}
+
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "BlockCache.h"
+#include "CPU.h"
+
+namespace CheaPU {
+
+	class MemoryChip;
+
+	/** Compiles the basic blocks (see BlockCache) into x86-64 machine code and runs them natively.
+
+		Every block becomes a function in an executable buffer. The accumulator lives in AL,
+		the memory is accessed from a base pointer in R9 and the cycles are counted in R11.
+		The x86 ADD and SUB compute the CheaPU overflow and zero flags anyway (CF and ZF): they are saved
+		after the last ADD or SUB before the block can exit, and not at all if nobody could see them.
+		When a block jumps to another one that is already compiled, the jump is patched to go
+		there directly, so loops run without ever coming back to C++ (a budget counter in R10 makes
+		sure they stop after max_instructions).
+
+		The native code does not know about the MemoryChip code tracking. It checks every store against
+		its own table of the bytes it compiled, and bails out to the dispatcher, which throws away
+		all the compiled code. Anything else it can't handle (illegal opcodes, not enough instructions left
+		for a whole block) is done by the CPU itself.
+
+		On anything that is not x86-64 (or if the executable memory can't be had) there is no native code:
+		it all goes to CPU::run(). In any case, the result is exactly the same as CPU::run(). */
+	class JitCompiler {
+	public:
+		JitCompiler();
+		~JitCompiler();
+
+		/** True if there is native code generation on this platform. */
+		bool available() const;
+
+		/** Same as CPU::run(), with the native code. */
+		uint64_t run(CPU& cpu, MemoryChip& memory, const uint64_t max_instructions);
+
+		/** Throw away all the compiled code. */
+		void flush(MemoryChip& memory);
+
+		/** Where the generated code finds and leaves its state.
+		    The offsets are hardcoded in the machine code, don't move things around. */
+		struct NativeContext {
+			uint8_t* ram;                 ///< +0
+			uint64_t cycles;              ///< +8
+			uint8_t accumulator;          ///< +16
+			uint8_t program_counter;      ///< +17
+			uint8_t halted;               ///< +18
+			uint8_t code_written;         ///< +19 A store hit the compiled code.
+			uint8_t overflow;             ///< +20 The carry of the last ADD or SUB, straight from the host flags.
+			uint8_t zero;                 ///< +21
+			uint8_t* link_site;           ///< +24 Jump to patch to go to the block at program_counter, or null.
+			uint64_t budget;              ///< +32 How many instructions can still run.
+			const uint8_t* code_bytes;    ///< +40 Which addresses hold compiled code (1 byte per address).
+		};
+
+	private:
+		struct Block {
+			bool compiled;
+			const uint8_t* body;   ///< Null if the block starts with an illegal opcode.
+			size_t instructions;
+		};
+
+		std::array<Block, 256> blocks;
+
+		/** One byte per address that can hold code (the operand of an instruction at 0xFF is at 0x100). */
+		std::array<uint8_t, 257> code_bytes;
+
+		/** @name The executable buffer. */
+		/**@{*/
+		uint8_t* buffer;
+		size_t buffer_size;
+		size_t buffer_used;
+		size_t flushed_size;   ///< The common code at the beginning that survives a flush.
+		/**@}*/
+
+		/** Jumps to the native code (the first thing in the buffer). */
+		using Trampoline = void(*)(NativeContext* context, const uint8_t* body);
+		Trampoline enter;
+		const uint8_t* common_exit;
+
+		/** @name What the code was compiled from. */
+		/**@{*/
+		uint64_t compiled_memory;  ///< MemoryChip::identity()
+		uint32_t code_version;
+		/**@}*/
+
+		std::vector<DecodedInstruction> decoded;
+
+		void compile(Block& block, const uint8_t start, MemoryChip& memory);
+		void link(uint8_t* site, const Block& target);
+
+		void make_writable();
+		void make_executable();
+
+		JitCompiler(const JitCompiler&) = delete;
+		void operator=(const JitCompiler&) = delete;
+	};
+
+}
@@ -1,15 +1,44 @@
 #include "pch.h"
 #include "MemoryChip.h"
 
+#include <algorithm>
+#include <atomic>
+
 namespace CheaPU {
 
-    MemoryChip::MemoryChip()
+    static uint64_t next_serial_number()
+    {
+        static std::atomic<uint64_t> last_serial_number = 0;
+        return ++last_serial_number;
+    }
+
+    MemoryChip::MemoryChip() :
+        code_version(0),
+        serial_number(next_serial_number())
     {
         storage.fill(0);
     }
 
+    MemoryChip::MemoryChip(const MemoryChip& other) :
+        code_version(0),
+        storage(other.storage),
+        serial_number(next_serial_number())
+    {
+    }
+
+    MemoryChip& MemoryChip::operator=(const MemoryChip& other)
+    {
+        storage = other.storage;
+        code_bytes.reset();
+        ++code_version;
+        serial_number = next_serial_number();
+        return *this;
+    }
+
     uint8_t& MemoryChip::operator[](size_t idx)
     {
+        if (code_bytes[idx])
+            ++code_version;
         return storage[idx];
     }
 
@@ -18,4 +47,42 @@ namespace CheaPU {
         return storage[idx];
     }
 
-}
+    void MemoryChip::watch_code(const size_t first, const size_t last)
+    {
+        for (size_t idx = first; idx < last; ++idx)
+            code_bytes.set(idx);
+    }
+
+    void MemoryChip::forget_code()
+    {
+        code_bytes.reset();
+    }
+
+    void MemoryChip::load(const size_t base, const uint8_t* data, const size_t count)
+    {
+        std::copy_n(data, count, storage.begin() + base);
+        for (size_t idx = base; idx < base + count; ++idx)
+            if (code_bytes[idx]) {
+                ++code_version;
+                return;
+            }
+    }
+
+    void MemoryChip::restore(const std::array<uint8_t, size>& content)
+    {
+        storage = content;
+        if (code_bytes.any())
+            ++code_version;
+    }
+
+    uint64_t MemoryChip::digest() const
+    {
+        uint64_t hash = 0xcbf29ce484222325;  // FNV-1a offset basis and prime.
+        for (const uint8_t byte : storage) {
+            hash ^= byte;
+            hash *= 0x100000001b3;
+        }
+        return hash;
+    }
+
+}
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <array>
+#include <bitset>
 #include <cstdint>
 
 namespace CheaPU {
@@ -9,17 +10,85 @@ namespace CheaPU {
 	    Just a big, linear space (no segments, pages...).
 		Addressable by the byte, as if an array. 
 		No reactions for out-of-bound access (but expect the emulation
-		to crash).*/
+		to crash).
+		
+		It also keeps track of writes to the bytes that hold code, so that
+		whoever keeps translated copies of the code (see BlockCache) knows 
+		when to throw them away. Self-modifying code is legal on this machine. */
 	class MemoryChip
 	{
 	public:
+		static constexpr size_t size = 8 * 1024;
+
 		MemoryChip();
 
+		/** A copy is a different chip, as far as the code tracking goes: 
+		    new identity(), nothing watched. */
+		MemoryChip(const MemoryChip& other);
+		MemoryChip& operator=(const MemoryChip& other);
+
+		/** Access for writing. Since there is no way to know what happens to the reference,
+		    it counts as a write to the code if the byte is watched. 
+			Use read() or the const version to avoid it. */
 		uint8_t& operator[](size_t idx);
 		const uint8_t& operator[](size_t idx) const;
 
-		/** The actual memory. 8K, for no particular reason. */
-		std::array<uint8_t, 8 * 1024> storage;
+		/** @name Access with write tracking. 
+		    Inline, as the CPU calls them on every memory access. */
+		/**@{*/
+		uint8_t read(const size_t idx) const
+		{
+			return storage[idx];
+		}
+
+		void write(const size_t idx, const uint8_t value)
+		{
+			storage[idx] = value;
+			if (code_bytes[idx])
+				++code_version;
+		}
+		/**@}*/
+
+		/** @name Code tracking. */
+		/**@{*/
+		/** Mark the bytes in [first, last) as code. Writing them changes the code_version. */
+		void watch_code(const size_t first, const size_t last);
+
+		/** Nothing is code anymore. */
+		void forget_code();
+
+		/** Changes every time a byte of code is written. */
+		uint32_t code_version;
+
+		/** Different for every chip (and for every copy). Together with the code_version,
+		    it tells whoever translated the code if it is still the same. */
+		uint64_t identity() const
+		{
+			return serial_number;
+		}
+		/**@}*/
+
+		/** Copies count bytes from data, starting at base (see load_image()). Does not check the bounds.
+		    It counts as a write to the code if any of the bytes is watched. */
+		void load(const size_t base, const uint8_t* data, const size_t count);
+
+		/** Put back a content saved before (see Snapshot). A copy of the storage and nothing more,
+		    but it counts as a write to all the code, if any is watched. */
+		void restore(const std::array<uint8_t, size>& content);
+
+		/** Hash of the whole content (64 bit FNV-1a), to compare memories without keeping them around. */
+		uint64_t digest() const;
+
+		/** The actual memory. 8K, for no particular reason.
+		    Aligned to the cache line: copies of the whole memory (snapshots...) go several times faster. */
+		alignas(64) std::array<uint8_t, size> storage;
+
+	private:
+		/** One bit per byte, not per page: all the programs on this machine fit in the 1st
+		    256 bytes, code and data mixed, so pages of any sensible size would mix them up. */
+		std::bitset<size> code_bytes;
+
+		uint64_t serial_number;
 	};
 }
 
@@ -0,0 +1,56 @@
+#include "pch.h"
+#include "PagedMemoryChip.h"
+
+#include "MemoryChip.h"
+
+#include <algorithm>
+
+namespace CheaPU {
+
+    static_assert(PagedMemoryChip::size == MemoryChip::size, "Both chips must hold the same programs.");
+
+    PagedMemoryChip::PagedMemoryChip()
+    {
+        // One page of zeroes for everybody. Kept alive here, so it is always shared: the 1st write copies it.
+        static const std::shared_ptr<Page> zeroes = std::make_shared<Page>(Page{});
+        pages.fill(zeroes);
+    }
+
+    PagedMemoryChip::PagedMemoryChip(const MemoryChip& memory)
+    {
+        for (size_t page = 0; page < page_count; ++page) {
+            pages[page] = std::make_shared<Page>();
+            std::copy_n(memory.storage.begin() + page * page_size, page_size, pages[page]->bytes.begin());
+        }
+    }
+
+    void PagedMemoryChip::copy_to(MemoryChip& memory) const
+    {
+        std::array<uint8_t, size> content;
+        for (size_t page = 0; page < page_count; ++page)
+            std::copy(pages[page]->bytes.begin(), pages[page]->bytes.end(), content.begin() + page * page_size);
+        memory.restore(content);  // Not straight in the storage: the code tracking must know.
+    }
+
+    uint64_t PagedMemoryChip::digest() const
+    {
+        uint64_t hash = 0xcbf29ce484222325;  // FNV-1a offset basis and prime, as the MemoryChip.
+        for (const std::shared_ptr<Page>& page : pages)
+            for (const uint8_t byte : page->bytes) {
+                hash ^= byte;
+                hash *= 0x100000001b3;
+            }
+        return hash;
+    }
+
+    size_t PagedMemoryChip::private_pages() const
+    {
+        return std::count_if(pages.begin(), pages.end(), [](const std::shared_ptr<Page>& page) { return page.use_count() == 1; });
+    }
+
+    void PagedMemoryChip::unshare(const size_t page)
+    {
+        pages[page] = std::make_shared<Page>(*pages[page]);
+    }
+
+}
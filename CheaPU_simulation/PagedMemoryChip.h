@@ -0,0 +1,91 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+
+namespace CheaPU {
+
+	class MemoryChip;
+
+	/** Same memory as the MemoryChip, made of pages that the copies share until somebody writes them
+	    (copy-on-write). A copy is a fork of the machine: it costs a pointer per page, not 8K, and
+		then every page that is written is copied once. The CPU only reaches the 1st 257 bytes
+		(the operand of an instruction at 0xFF is at 0x100): all in the 1st page. However the program
+		goes, a fork that only runs it ends up with 1 page of its own, at most.
+
+		About the page size: smaller pages are less to copy on a write, but more reference counts
+		to update on every fork. With 1K pages, fork and run is about as fast as copying the whole MemoryChip
+		(8K copies are cheap on a modern CPU) and a fork that is kept around takes 1/7 of the space.
+
+		The CPU works with it as with a MemoryChip. No code tracking: the BlockCache and the JitCompiler
+		need a MemoryChip.
+
+		All the forks of a chip must stay in the same thread: the copy-on-write looks at shared_ptr::use_count(),
+		which is only approximate when other threads copy or drop the same page. To send a machine to another
+		thread, give it a new chip with the content (copy_to() a MemoryChip, build a PagedMemoryChip from that). */
+	class PagedMemoryChip
+	{
+	public:
+		static constexpr size_t size = 8 * 1024;
+		static constexpr size_t page_size = 1024;
+		static constexpr size_t page_count = size / page_size;
+
+		/** All zeroes, as a new MemoryChip. All the pages are the same page, until written. */
+		PagedMemoryChip();
+
+		/** Copies the content of the memory. */
+		explicit PagedMemoryChip(const MemoryChip& memory);
+
+		/** @name Access.
+		    Inline, as the CPU calls them on every memory access.
+			Writes copy the page first, if it is shared. operator[] counts as a write. */
+		/**@{*/
+		uint8_t read(const size_t idx) const
+		{
+			return pages[idx / page_size]->bytes[idx % page_size];
+		}
+
+		void write(const size_t idx, const uint8_t value)
+		{
+			writable_page(idx / page_size)[idx % page_size] = value;
+		}
+
+		uint8_t& operator[](const size_t idx)
+		{
+			return writable_page(idx / page_size)[idx % page_size];
+		}
+
+		const uint8_t& operator[](const size_t idx) const
+		{
+			return pages[idx / page_size]->bytes[idx % page_size];
+		}
+		/**@}*/
+
+		/** Puts the content in a normal chip (for the BlockCache, the snapshots...). */
+		void copy_to(MemoryChip& memory) const;
+
+		/** Same as MemoryChip::digest(), for the same content. */
+		uint64_t digest() const;
+
+		/** How many pages are not shared with any other chip. */
+		size_t private_pages() const;
+
+	private:
+		struct Page {
+			std::array<uint8_t, page_size> bytes;
+		};
+
+		std::array<std::shared_ptr<Page>, page_count> pages;
+
+		uint8_t* writable_page(const size_t page)
+		{
+			if (pages[page].use_count() > 1)
+				unshare(page);
+			return pages[page]->bytes.data();
+		}
+
+		/** Gives this chip its own copy of the page. */
+		void unshare(const size_t page);
+	};
+}
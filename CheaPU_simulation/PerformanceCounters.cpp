@@ -0,0 +1,29 @@
+#include "pch.h"
+#include "PerformanceCounters.h"
+
+#include <iomanip>
+
+namespace CheaPU {
+
+	std::ostream& operator<<(std::ostream& out, const PerformanceCounters& counters)
+	{
+		static constexpr const char* names[] = { "NOP", "LD", "ST", "ADD", "HALT", "JMP", "JZE", "SUB" };
+
+		out << std::setfill(' ')
+			<< "cycles          " << counters.cycles << "\n"
+			<< "instructions    " << counters.instructions << "\n";
+
+		for (size_t opcode = 0; opcode < counters.opcodes.size(); ++opcode)
+			out << "  " << std::left << std::setw(14) << names[opcode] << std::right << counters.opcodes[opcode] << "\n";
+		out << "  illegal       " << counters.illegal_opcodes << "\n";
+
+		out << "JZE taken       " << counters.jze_taken << "\n"
+			<< "JZE not taken   " << counters.jze_not_taken << "\n"
+			<< "memory reads    " << counters.memory_reads << "\n"
+			<< "memory writes   " << counters.memory_writes << "\n"
+			<< "stall cycles    " << counters.stall_cycles << "\n";
+
+		return out;
+	}
+
+}
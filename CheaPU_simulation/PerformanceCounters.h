@@ -0,0 +1,38 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+
+namespace CheaPU {
+
+	/** Statistics of what a CPU did, to find out where the programs spend their time.
+
+		They exist only if CHEAPU_PERFORMANCE_COUNTERS is defined (see CPU::counters): the counting is
+		compiled out otherwise, so the normal build does not pay a single instruction for it.
+
+		Everything an instruction does is counted at once, when it is fetched (whether the JZE jumps is
+		known at that time: the accumulator can't change before the jump). Only the cycles are counted one by one.
+		Only CPU::cycle() and CPU::run() count: whoever runs the code some other way (BlockCache, JitCompiler,
+		CPUBatch...) does not update them. */
+	struct PerformanceCounters {
+		uint64_t cycles = 0;
+		uint64_t instructions = 0;           ///< Fetched, including the HALT and the illegal ones.
+		std::array<uint64_t, 8> opcodes{};   ///< Instructions, by Opcode value.
+		uint64_t illegal_opcodes = 0;
+		uint64_t jze_taken = 0;
+		uint64_t jze_not_taken = 0;
+		uint64_t memory_reads = 0;           ///< Including the fetches.
+		uint64_t memory_writes = 0;
+		uint64_t stall_cycles = 0;           ///< The cycles after the fetch, waiting for multi-cycle instructions to complete.
+
+		void reset()
+		{
+			*this = PerformanceCounters();
+		}
+	};
+
+	/** Human-readable report, one counter per line. */
+	std::ostream& operator<<(std::ostream& out, const PerformanceCounters& counters);
+
+}
@@ -0,0 +1,155 @@
+#include "pch.h"
+#include "Profiler.h"
+
+#include "CPU.h"
+#include "MemoryChip.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <numeric>
+#include <sstream>
+#include <string>
+
+namespace CheaPU {
+
+	namespace {
+
+		std::string hex(const uint8_t value)
+		{
+			std::stringstream text;
+			text << "0x" << std::hex << std::uppercase << std::setfill('0') << std::setw(2) << +value;
+			return text.str();
+		}
+
+		/** The label at the address if there is one, the address in hex otherwise. */
+		std::string name(const uint8_t address, const SymbolMap& symbols)
+		{
+			const std::string label = symbols.label_at(address);
+			return label.empty() ? hex(address) : label;
+		}
+
+		/** "LD 0x15", "NOP", "ILLEGAL 0xFF", "JMP loop"... */
+		std::string disassemble(const MemoryChip& memory, const uint8_t address, const SymbolMap& symbols)
+		{
+			static constexpr const char* names[] = { "NOP", "LD", "ST", "ADD", "HALT", "JMP", "JZE", "SUB" };
+
+			const uint8_t opcode = memory.read(address);
+			std::stringstream text;
+			text << std::hex << std::uppercase << std::setfill('0');
+
+			if (opcode >= std::size(names))
+				text << "ILLEGAL 0x" << std::setw(2) << +opcode;
+			else if (opcode == to_word(Opcode::NOP) || opcode == to_word(Opcode::HALT))
+				text << names[opcode];
+			else
+				text << names[opcode] << " " << name(memory.read(address + 1), symbols);
+
+			return text.str();
+		}
+
+		bool is_jump(const uint8_t opcode)
+		{
+			return opcode == to_word(Opcode::JMP) || opcode == to_word(Opcode::JZE);
+		}
+	}
+
+	Profiler::Profiler()
+	{
+		clear();
+	}
+
+	void Profiler::clear()
+	{
+		cycles.fill(0);
+		instructions.fill(0);
+		back_edges.clear();
+	}
+
+	uint64_t Profiler::run(CPU& cpu, MemoryChip& memory, const uint64_t max_cycles)
+	{
+		uint64_t total = 0;
+		while (!cpu.error && total < max_cycles) {
+			const uint8_t address = cpu.program_counter;
+			const uint8_t opcode = memory.read(address);
+
+			const uint64_t used = cpu.step_instruction(memory, max_cycles - total);
+			if (cpu.instruction_completed())
+				++instructions[address];
+
+			cycles[address] += used;
+			total += used;
+
+			if (is_jump(opcode) && cpu.instruction_completed() && cpu.program_counter <= address)
+				++back_edges[{ address, cpu.program_counter }];
+		}
+
+		return total;
+	}
+
+	std::vector<Profiler::Loop> Profiler::loops() const
+	{
+		std::vector<Loop> found;
+		for (const auto& [edge, iterations] : back_edges) {
+			const auto [from, to] = edge;
+			// The jump has an operand: the byte after it is part of the loop too, but it has no cycles of its own.
+			const uint64_t body_cycles = std::accumulate(cycles.begin() + to, cycles.begin() + from + 1, uint64_t(0));
+			found.push_back({ to, from, iterations, body_cycles });
+		}
+
+		std::stable_sort(found.begin(), found.end(), [](const Loop& a, const Loop& b) { return a.cycles > b.cycles; });
+		return found;
+	}
+
+	void Profiler::report(std::ostream& out, const MemoryChip& memory, const SymbolMap& symbols) const
+	{
+		const uint64_t total_cycles = std::accumulate(cycles.begin(), cycles.end(), uint64_t(0));
+		const uint64_t total_instructions = std::accumulate(instructions.begin(), instructions.end(), uint64_t(0));
+		const double percent = total_cycles > 0 ? 100.0 / total_cycles : 0;
+
+		std::vector<uint8_t> addresses;
+		for (size_t address = 0; address < cycles.size(); ++address)
+			if (cycles[address] > 0)
+				addresses.push_back(static_cast<uint8_t>(address));
+		std::stable_sort(addresses.begin(), addresses.end(), [this](const uint8_t a, const uint8_t b) { return cycles[a] > cycles[b]; });
+
+		out << "Flat profile: " << total_cycles << " cycles, " << total_instructions << " instructions\n"
+			<< std::left << std::setw(9) << "address" << std::setw(14) << "instruction" << std::right
+			<< std::setw(12) << "cycles" << std::setw(8) << "%" << std::setw(14) << "instructions" << "\n";
+		for (const uint8_t address : addresses)
+			out << std::left << std::setw(9) << hex(address) << std::setw(14) << disassemble(memory, address, symbols) << std::right
+				<< std::setw(12) << cycles[address]
+				<< std::setw(8) << std::fixed << std::setprecision(1) << cycles[address] * percent
+				<< std::setw(14) << instructions[address] << "\n";
+
+		out << "\nLoops\n"
+			<< std::left << std::setw(9) << "header" << std::setw(11) << "back edge" << std::right
+			<< std::setw(12) << "iterations" << std::setw(12) << "cycles" << std::setw(8) << "%" << "\n";
+		for (const Loop& loop : loops())
+			out << std::left << std::setw(8) << name(loop.header, symbols) << " " << std::setw(10) << name(loop.back_edge, symbols) << " " << std::right
+				<< std::setw(12) << loop.iterations
+				<< std::setw(12) << loop.cycles
+				<< std::setw(8) << std::fixed << std::setprecision(1) << loop.cycles * percent << "\n";
+	}
+
+	void Profiler::folded_stacks(std::ostream& out, const MemoryChip& memory, const SymbolMap& symbols) const
+	{
+		// Outermost loops first, so that the nested ones come after the ones that contain them.
+		std::vector<Loop> nesting = loops();
+		std::stable_sort(nesting.begin(), nesting.end(), [](const Loop& a, const Loop& b) {
+			return (a.back_edge - a.header) > (b.back_edge - b.header);
+		});
+
+		for (size_t address = 0; address < cycles.size(); ++address) {
+			if (cycles[address] == 0)
+				continue;
+
+			out << "program";
+			for (const Loop& loop : nesting)
+				if (loop.header <= address && address <= loop.back_edge)
+					out << ";loop " << name(loop.header, symbols) << "-" << name(loop.back_edge, symbols);
+			out << ";" << hex(static_cast<uint8_t>(address)) << " " << disassemble(memory, static_cast<uint8_t>(address), symbols)
+				<< " " << cycles[address] << "\n";
+		}
+	}
+
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "SymbolMap.h"
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+namespace CheaPU {
+
+	class CPU;
+	class MemoryChip;
+
+	/** Finds out where a program spends its time. Exact, not sampling: every cycle is
+	    charged to the address of the instruction that uses it.
+
+		The loops are found from the jumps that go backwards (JMP or JZE to an address not after themselves):
+		the target is the loop header, the jump closes the loop, everything in between is the body.
+
+		The results add up over many run() calls, until clear(). */
+	class Profiler {
+	public:
+		Profiler();
+
+		/** Runs like CPU::run_cycles(), one instruction at a time, taking note of everything. */
+		uint64_t run(CPU& cpu, MemoryChip& memory, const uint64_t max_cycles);
+
+		void clear();
+
+		/** @name Flat profile. Index: address of the instruction. */
+		/**@{*/
+		std::array<uint64_t, 256> cycles;
+		std::array<uint64_t, 256> instructions;
+		/**@}*/
+
+		struct Loop {
+			uint8_t header;       ///< Where the backward jump goes.
+			uint8_t back_edge;    ///< Address of the backward jump.
+			uint64_t iterations;  ///< Times the jump went back.
+			uint64_t cycles;      ///< Spent in the body, header and jump included.
+		};
+
+		/** All the loops seen, the ones that took more cycles first. */
+		std::vector<Loop> loops() const;
+
+		/** Flat profile (hottest addresses first) and loops. The memory is used to show the instructions,
+		    the symbols (if any, see Assembler) to show the labels instead of the bare addresses. */
+		void report(std::ostream& out, const MemoryChip& memory, const SymbolMap& symbols = SymbolMap()) const;
+
+		/** The "folded stacks" format of flamegraph.pl (and speedscope, inferno...): one line per address,
+		    with the loops that contain it as the callers, outermost first, and the cycles as the count. */
+		void folded_stacks(std::ostream& out, const MemoryChip& memory, const SymbolMap& symbols = SymbolMap()) const;
+
+	private:
+		/** Times each backward jump (from, to) was taken. */
+		std::map<std::pair<uint8_t, uint8_t>, uint64_t> back_edges;
+	};
+
+}
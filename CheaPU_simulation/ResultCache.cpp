@@ -0,0 +1,420 @@
+#include "pch.h"
+#include "ResultCache.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace CheaPU {
+
+	namespace {
+
+		constexpr char magic[8] = { 'C', 'H', 'E', 'A', 'P', 'U', 'R', 'C' };
+		constexpr char version = 1;
+		constexpr size_t data_header_bytes = sizeof(magic) + 1;
+		constexpr size_t cpu_bytes = 7;
+		constexpr size_t record_bytes = 8 + 8 + 8 + cpu_bytes + 256;
+
+		/** @name The index, in 64 bit words: a header, then the slots. */
+		/**@{*/
+		constexpr uint64_t index_magic = 0x5849555041454843;  // "CHEAPUIX", if the machine is little endian.
+		constexpr uint64_t index_version = 1;
+		enum HeaderWord { magic_word, version_word, capacity_word, used_word, records_word, hits_word, misses_word, header_words };
+		constexpr size_t slot_words = 3;  // Key low, key high, record + 1 (0 for an empty slot).
+		constexpr uint64_t initial_capacity = 1024;
+		/**@}*/
+
+		/** The "finalizer" of SplitMix64 (as in StateHash). */
+		uint64_t mix(uint64_t x)
+		{
+			x += 0x9E3779B97F4A7C15;
+			x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9;
+			x = (x ^ (x >> 27)) * 0x94D049BB133111EB;
+			return x ^ (x >> 31);
+		}
+
+		void put64(uint8_t* bytes, const uint64_t value)
+		{
+			for (size_t i = 0; i < 8; ++i)
+				bytes[i] = uint8_t(value >> (8 * i));
+		}
+
+		uint64_t get64(const uint8_t* bytes)
+		{
+			uint64_t value = 0;
+			for (size_t i = 0; i < 8; ++i)
+				value |= uint64_t(bytes[i]) << (8 * i);
+			return value;
+		}
+
+		size_t index_bytes(const uint64_t capacity)
+		{
+			return (header_words + slot_words * capacity) * sizeof(uint64_t);
+		}
+	}
+
+	/** A file mapped in memory, for reading and writing. The operating system writes the changes
+	    back to the file when it sees fit (at the latest when it is unmapped, or the program ends). */
+	class ResultCache::MappedFile {
+	public:
+		/** Creates the file if it is not there. */
+		explicit MappedFile(const std::string& path)
+		{
+#ifdef _WIN32
+			file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file == INVALID_HANDLE_VALUE)
+				throw std::runtime_error("Can't open " + path);
+			LARGE_INTEGER size;
+			GetFileSizeEx(file, &size);
+			length = static_cast<size_t>(size.QuadPart);
+#else
+			file = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+			if (file < 0)
+				throw std::runtime_error("Can't open " + path);
+			struct stat status;
+			fstat(file, &status);
+			length = static_cast<size_t>(status.st_size);
+#endif
+			map();
+		}
+
+		~MappedFile()
+		{
+			unmap();
+#ifdef _WIN32
+			CloseHandle(file);
+#else
+			close(file);
+#endif
+		}
+
+		/** Changes the size of the file and maps it again: the pointers to the old view are no good anymore. */
+		void resize(const size_t size)
+		{
+			unmap();
+#ifdef _WIN32
+			LARGE_INTEGER end;
+			end.QuadPart = size;
+			const bool ok = SetFilePointerEx(file, end, nullptr, FILE_BEGIN) && SetEndOfFile(file);
+#else
+			const bool ok = ftruncate(file, static_cast<off_t>(size)) == 0;
+#endif
+			if (!ok)
+				throw std::runtime_error("Can't resize the index of the cache.");
+			length = size;
+			map();
+		}
+
+		uint64_t* words()
+		{
+			return static_cast<uint64_t*>(view);
+		}
+
+		size_t size() const
+		{
+			return length;
+		}
+
+	private:
+#ifdef _WIN32
+		HANDLE file;
+		HANDLE mapping = nullptr;
+#else
+		int file;
+#endif
+		void* view = nullptr;
+		size_t length;
+
+		void map()
+		{
+			if (length == 0)
+				return;  // Can't map nothing.
+#ifdef _WIN32
+			mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+			view = mapping ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0) : nullptr;
+#else
+			view = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+			if (view == MAP_FAILED)
+				view = nullptr;
+#endif
+			if (!view)
+				throw std::runtime_error("Can't map the index of the cache in memory.");
+		}
+
+		void unmap()
+		{
+#ifdef _WIN32
+			if (view)
+				UnmapViewOfFile(view);
+			if (mapping)
+				CloseHandle(mapping);
+			mapping = nullptr;
+#else
+			if (view)
+				munmap(view, length);
+#endif
+			view = nullptr;
+		}
+	};
+
+	ResultCache::ResultCache(const std::string& path) :
+		last_was_hit(false),
+		records(0)
+	{
+		const std::string data_path = path + ".data";
+		if (!std::filesystem::exists(data_path)) {
+			std::ofstream create(data_path, std::ios::binary);
+			create.write(magic, sizeof(magic));
+			create.put(version);
+			if (!create)
+				throw std::runtime_error("Can't create " + data_path);
+		}
+
+		// Half a record at the end: the program died while writing it. It never got in the index, forget it.
+		const uint64_t data_bytes = std::filesystem::file_size(data_path);
+		if (data_bytes >= data_header_bytes) {
+			records = (data_bytes - data_header_bytes) / record_bytes;
+			if (data_header_bytes + records * record_bytes != data_bytes)
+				std::filesystem::resize_file(data_path, data_header_bytes + records * record_bytes);
+		}
+
+		data.open(data_path, std::ios::in | std::ios::out | std::ios::binary);
+		char start[data_header_bytes];
+		data.read(start, sizeof(start));
+		if (!data || !std::equal(magic, magic + sizeof(magic), start) || start[sizeof(magic)] != version)
+			throw std::runtime_error(data_path + " is not a CheaPU result cache (or a different version).");
+
+		index = std::make_unique<MappedFile>(path + ".index");
+		const uint64_t* h = header();
+		const bool valid = index->size() >= index_bytes(0) &&
+			h[magic_word] == index_magic &&
+			h[version_word] == index_version &&
+			std::has_single_bit(h[capacity_word]) &&
+			index->size() == index_bytes(h[capacity_word]) &&
+			h[records_word] <= records;
+
+		if (!valid) {
+			uint64_t capacity = initial_capacity;
+			while (capacity < 2 * records)
+				capacity *= 2;
+			build_index(capacity);
+		}
+		index_records();
+	}
+
+	ResultCache::~ResultCache() = default;
+
+	uint64_t ResultCache::run(CPU& cpu, MemoryChip& memory, const uint64_t max_cycles)
+	{
+		last_was_hit = false;
+
+		CPUState start;
+		try {
+			start = cpu.save_state();
+		}
+		catch (const std::logic_error&) {
+			return cpu.run_cycles(memory, max_cycles);
+		}
+
+		const Hash128 run_key = key(start, memory, max_cycles);
+		const uint64_t found = find(run_key);
+		if (found != UINT64_MAX) {
+			const Record r = read_record(found);
+			try {
+				cpu.restore_state(r.cpu);  // First: it may throw, better not to leave the memory changed.
+				memory.load(0, r.memory.data(), r.memory.size());
+				++header()[hits_word];
+				last_was_hit = true;
+				return r.cycles;
+			}
+			catch (const std::logic_error&) {
+				// A coroutine can't go back to the middle of an instruction: run it.
+			}
+		}
+
+		++header()[misses_word];
+
+		Record r;
+		r.key = run_key;
+		r.cycles = cpu.run_cycles(memory, max_cycles);
+		try {
+			r.cpu = cpu.save_state();
+		}
+		catch (const std::logic_error&) {
+			return r.cycles;
+		}
+		std::copy_n(memory.storage.begin(), r.memory.size(), r.memory.begin());
+
+		append(r);
+		return r.cycles;
+	}
+
+	Hash128 ResultCache::key(const CPUState& cpu, const MemoryChip& memory, const uint64_t max_cycles)
+	{
+		// Two lanes, with different multipliers and rotations, mixed together at the end.
+		uint64_t a = 0x243F6A8885A308D3;  // Digits of pi: nothing up my sleeve.
+		uint64_t b = 0x13198A2E03707344;
+		const auto add = [&a, &b](const uint64_t word) {
+			a = std::rotl((a ^ word) * 0x9E3779B97F4A7C15, 31);
+			b = std::rotl((b + word) * 0xC2B2AE3D27D4EB4F, 29);
+		};
+
+		for (size_t i = 0; i < memory.storage.size(); i += sizeof(uint64_t)) {
+			uint64_t word;
+			std::memcpy(&word, memory.storage.data() + i, sizeof(word));
+			add(word);
+		}
+
+		add(uint64_t(cpu.program_counter) |
+			uint64_t(cpu.accumulator) << 8 |
+			uint64_t(cpu.overflow) << 16 |
+			uint64_t(cpu.zero) << 24 |
+			uint64_t(cpu.error) << 32 |
+			uint64_t(cpu.micro_pc) << 40 |
+			uint64_t(cpu.operand) << 48);
+		add(max_cycles);
+
+		return { mix(a ^ std::rotl(b, 32)), mix(b + a) };
+	}
+
+	uint64_t ResultCache::size() const
+	{
+		return records;
+	}
+
+	uint64_t ResultCache::hits() const
+	{
+		return index->words()[hits_word];
+	}
+
+	uint64_t ResultCache::misses() const
+	{
+		return index->words()[misses_word];
+	}
+
+	double ResultCache::hit_rate() const
+	{
+		const uint64_t lookups = hits() + misses();
+		return lookups == 0 ? 0 : double(hits()) / lookups;
+	}
+
+	uint64_t* ResultCache::header()
+	{
+		return index->words();
+	}
+
+	uint64_t* ResultCache::slots()
+	{
+		return index->words() + header_words;
+	}
+
+	void ResultCache::build_index(const uint64_t capacity)
+	{
+		index->resize(index_bytes(capacity));
+		std::fill_n(index->words(), index->size() / sizeof(uint64_t), uint64_t(0));
+
+		uint64_t* h = header();
+		h[magic_word] = index_magic;
+		h[version_word] = index_version;
+		h[capacity_word] = capacity;
+	}
+
+	void ResultCache::index_records()
+	{
+		while (header()[records_word] < records) {
+			// At most half full, or the look ups get long.
+			if ((header()[used_word] + 1) * 2 > header()[capacity_word]) {
+				const uint64_t hits = header()[hits_word];
+				const uint64_t misses = header()[misses_word];
+				build_index(header()[capacity_word] * 2);
+				header()[hits_word] = hits;
+				header()[misses_word] = misses;
+				continue;  // From the 1st record again.
+			}
+
+			const uint64_t record = header()[records_word];
+			insert(read_record(record).key, record);
+			++header()[records_word];
+		}
+	}
+
+	void ResultCache::insert(const Hash128& key, const uint64_t record)
+	{
+		const uint64_t mask = header()[capacity_word] - 1;
+		for (uint64_t i = key.low & mask; ; i = (i + 1) & mask) {
+			uint64_t* slot = slots() + i * slot_words;
+			if (slot[2] == 0) {
+				slot[0] = key.low;
+				slot[1] = key.high;
+				slot[2] = record + 1;
+				++header()[used_word];
+				return;
+			}
+		}
+	}
+
+	uint64_t ResultCache::find(const Hash128& key)
+	{
+		const uint64_t mask = header()[capacity_word] - 1;
+		for (uint64_t i = key.low & mask; ; i = (i + 1) & mask) {
+			const uint64_t* slot = slots() + i * slot_words;
+			if (slot[2] == 0)
+				return UINT64_MAX;
+			if (slot[0] == key.low && slot[1] == key.high)
+				return slot[2] - 1;
+		}
+	}
+
+	ResultCache::Record ResultCache::read_record(const uint64_t record)
+	{
+		uint8_t bytes[record_bytes];
+		data.clear();
+		data.seekg(data_header_bytes + record * record_bytes);
+		data.read(reinterpret_cast<char*>(bytes), sizeof(bytes));
+		if (!data)
+			throw std::runtime_error("Can't read the data of the cache.");
+
+		Record r;
+		r.key = { get64(bytes), get64(bytes + 8) };
+		r.cycles = get64(bytes + 16);
+		const uint8_t* cpu = bytes + 24;
+		r.cpu = { cpu[0], cpu[1], cpu[2], cpu[3], cpu[4], cpu[5], cpu[6] };
+		std::copy_n(bytes + 24 + cpu_bytes, r.memory.size(), r.memory.begin());
+		return r;
+	}
+
+	void ResultCache::append(const Record& r)
+	{
+		uint8_t bytes[record_bytes];
+		put64(bytes, r.key.low);
+		put64(bytes + 8, r.key.high);
+		put64(bytes + 16, r.cycles);
+		const CPUState& c = r.cpu;
+		const uint8_t cpu[cpu_bytes] = { c.program_counter, c.accumulator, c.overflow, c.zero, c.error, c.micro_pc, c.operand };
+		std::copy_n(cpu, cpu_bytes, bytes + 24);
+		std::copy_n(r.memory.begin(), r.memory.size(), bytes + 24 + cpu_bytes);
+
+		// The data first: if the program dies in between, the index is behind, and catches up the next time.
+		data.clear();
+		data.seekp(0, std::ios::end);
+		data.write(reinterpret_cast<const char*>(bytes), sizeof(bytes));
+		data.flush();
+		if (!data)
+			throw std::runtime_error("Can't write the data of the cache.");
+
+		++records;
+		index_records();
+	}
+
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "CPU.h"
+#include "MemoryChip.h"
+
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+
+namespace CheaPU {
+
+	/** 128 bit hash. Not cryptographic: two different runs with the same one are as good as impossible
+	    by chance, but someone could build them on purpose. Don't share a cache with people you don't trust. */
+	struct Hash128 {
+		uint64_t low;
+		uint64_t high;
+
+		bool operator==(const Hash128& other) const = default;
+	};
+
+	/** Remembers how the runs ended, on disk, so that running the same program again costs nothing.
+
+		A run is identified by a Hash128 of the whole memory, the CPUState at the start and the max_cycles:
+		the machine is deterministic, if they are the same the result is the same.
+		The result is the CPUState at the end, the cycles and the 1st 256 bytes of the memory
+		(the operand of ST is a single byte: the rest can't change).
+
+		Two files:
+		- path.data has all the results one after the other, in the order they were added. Only appended, never changed.
+		  The "CHEAPURC" magic, a version byte, then the records: the key (low, high), the cycles (all little endian),
+		  the CPUState fields in the order of the struct, the 256 bytes.
+		- path.index is a hash table from the key to the position of the record, in the native byte order.
+		  It is mapped in memory: a look up reads a couple of its pages, not the whole file.
+		  It can always be built again from the data: it is, if it is missing, damaged or behind the data
+		  (a crash between the two writes).
+		The index also keeps the count of the hits and misses, over all the runs of all the programs that used the cache.
+
+		Only one program at a time can use the same cache. */
+	class ResultCache {
+	public:
+		/** Opens the cache, creates it if it is not there.
+		    Throws std::runtime_error if the files can't be opened or the data is not a cache. */
+		explicit ResultCache(const std::string& path);
+		~ResultCache();
+
+		/** Runs like CPU::run_cycles(), unless the result is already in the cache: then it puts the result
+		    in the CPU and in the memory, without running anything. Either way, next time it is in the cache.
+
+			The runs that can't be saved are simply run: a CPU with the Engine::coroutines in the middle of
+			an instruction (see CPU::save_state()), at the start or at the end.
+			The performance counters and CPU::idle() are not part of the result. */
+		uint64_t run(CPU& cpu, MemoryChip& memory, const uint64_t max_cycles);
+
+		/** The key of a run. */
+		static Hash128 key(const CPUState& cpu, const MemoryChip& memory, const uint64_t max_cycles);
+
+		/** Results in the cache. */
+		uint64_t size() const;
+
+		/** @name Look ups, since the cache was created (or its index was rebuilt). */
+		/**@{*/
+		uint64_t hits() const;
+		uint64_t misses() const;
+		double hit_rate() const;  ///< 0 if there were no look ups.
+		/**@}*/
+
+		/** True if the last run() found the result in the cache. */
+		bool last_was_hit;
+
+	private:
+		struct Record {
+			Hash128 key;
+			uint64_t cycles;
+			CPUState cpu;
+			std::array<uint8_t, 256> memory;
+		};
+
+		class MappedFile;
+
+		std::fstream data;
+		std::unique_ptr<MappedFile> index;
+		uint64_t records;
+
+		/** @name The index. */
+		/**@{*/
+		uint64_t* header();
+		uint64_t* slots();
+		void build_index(const uint64_t capacity);
+		/** The records from the one after the last indexed to the end of the data. */
+		void index_records();
+		void insert(const Hash128& key, const uint64_t record);
+		/** The record with the key, or UINT64_MAX. */
+		uint64_t find(const Hash128& key);
+		/**@}*/
+
+		Record read_record(const uint64_t record);
+		void append(const Record& record);
+
+		ResultCache(const ResultCache&) = delete;
+		void operator=(const ResultCache&) = delete;
+	};
+
+}
@@ -0,0 +1,64 @@
+#include "pch.h"
+#include "Snapshot.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace CheaPU {
+
+	namespace {
+
+		constexpr char magic[8] = { 'C', 'H', 'E', 'A', 'P', 'U', 'S', 'S' };
+		constexpr char version = 1;
+		constexpr size_t cpu_bytes = 7;
+	}
+
+	Snapshot take_snapshot(CPU& cpu, const MemoryChip& memory)
+	{
+		return { cpu.save_state(), memory.storage };
+	}
+
+	void restore_snapshot(const Snapshot& snapshot, CPU& cpu, MemoryChip& memory)
+	{
+		cpu.restore_state(snapshot.cpu);  // First: it may throw, better not to leave the memory changed.
+		memory.restore(snapshot.memory);
+	}
+
+	void write_snapshot(std::ostream& out, const Snapshot& snapshot)
+	{
+		const CPUState& c = snapshot.cpu;
+		const char cpu[cpu_bytes] = {
+			char(c.program_counter), char(c.accumulator),
+			char(c.overflow), char(c.zero), char(c.error),
+			char(c.micro_pc), char(c.operand)
+		};
+
+		out.write(magic, sizeof(magic));
+		out.put(version);
+		out.write(cpu, sizeof(cpu));
+		out.write(reinterpret_cast<const char*>(snapshot.memory.data()), snapshot.memory.size());
+		if (!out)
+			throw std::runtime_error("Can't write the snapshot.");
+	}
+
+	Snapshot read_snapshot(std::istream& in)
+	{
+		char start[sizeof(magic) + 1];
+		in.read(start, sizeof(start));
+		if (!in || !std::equal(magic, magic + sizeof(magic), start) || start[sizeof(magic)] != version)
+			throw std::runtime_error("Not a CheaPU snapshot (or a different version).");
+
+		uint8_t cpu[cpu_bytes];
+		Snapshot snapshot;
+		in.read(reinterpret_cast<char*>(cpu), sizeof(cpu));
+		in.read(reinterpret_cast<char*>(snapshot.memory.data()), snapshot.memory.size());
+		if (!in)
+			throw std::runtime_error("The snapshot is truncated.");
+
+		snapshot.cpu = { cpu[0], cpu[1], cpu[2], cpu[3], cpu[4], cpu[5], cpu[6] };
+		if (snapshot.cpu.overflow > 1 || snapshot.cpu.zero > 1 || snapshot.cpu.error > 1)
+			throw std::invalid_argument("The snapshot is corrupted: the flags are 0 or 1.");
+		return snapshot;
+	}
+
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "CPU.h"
+#include "MemoryChip.h"
+
+#include <array>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+
+namespace CheaPU {
+
+	/** The whole machine at one moment: CPU (instruction in progress included) and memory.
+	    Plain bytes, no pointers: restoring it is a copy of a bit more than 8K, so it can be
+		done many thousands of times per second (to try many ways from the same point, to go back...).
+
+		Take it with the Engine::microcode to be able to save in the middle of an instruction.
+		@see CPU::save_state(). */
+	struct Snapshot {
+		CPUState cpu;
+		alignas(64) std::array<uint8_t, MemoryChip::size> memory;  ///< Aligned like the MemoryChip::storage, for a fast copy.
+	};
+
+	Snapshot take_snapshot(CPU& cpu, const MemoryChip& memory);
+
+	/** The next cycle() continues exactly from where the snapshot was taken. */
+	void restore_snapshot(const Snapshot& snapshot, CPU& cpu, MemoryChip& memory);
+
+	/** @name Save states on file.
+	    The "CHEAPUSS" magic, a version byte, the CPUState fields in the order of the struct, the memory. */
+	/**@{*/
+	/** Throws std::runtime_error if the stream fails. */
+	void write_snapshot(std::ostream& out, const Snapshot& snapshot);
+
+	/** Throws std::runtime_error if the stream does not contain a snapshot,
+	    std::invalid_argument if it does but a flag is not 0 or 1. */
+	Snapshot read_snapshot(std::istream& in);
+	/**@}*/
+}
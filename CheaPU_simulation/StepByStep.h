@@ -7,6 +7,7 @@
 
 #include <coroutine>
 #include <exception>
+#include <functional>
 
 namespace CheaPU
 {
@@ -151,7 +152,7 @@ namespace CheaPU
 		not run to the end, there was no call to co_return yet). */
 		bool completed() noexcept
 		{
-			return m_coroutine.done();
+			return !m_coroutine || m_coroutine.done();  // An empty StepByStep has nothing left to do.
 		}
 
 	private:
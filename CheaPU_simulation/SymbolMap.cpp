@@ -0,0 +1,56 @@
+#include "pch.h"
+#include "SymbolMap.h"
+
+#include <cstdlib>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+namespace CheaPU {
+
+	std::string SymbolMap::label_at(const size_t address) const
+	{
+		for (const auto& [name, value] : labels)
+			if (value == address)
+				return name;
+		return {};
+	}
+
+	void SymbolMap::write(std::ostream& out) const
+	{
+		out << std::hex << std::setfill('0') << std::uppercase;
+		for (const auto& [name, value] : labels)
+			out << "label " << name << " 0x" << std::setw(4) << value << "\n";
+		for (const auto& [name, value] : constants)
+			out << "constant " << name << (value < 0 ? " -0x" : " 0x") << std::setw(4) << std::abs(int64_t(value)) << "\n";
+		out << std::dec << std::setfill(' ') << std::nouppercase;
+	}
+
+	SymbolMap SymbolMap::read(std::istream& in)
+	{
+		SymbolMap symbols;
+		std::string line;
+		while (std::getline(in, line)) {
+			std::istringstream words(line);
+			std::string kind, name, value;
+			if (!(words >> kind))
+				continue;  // Empty line.
+			if (!(words >> name >> value))
+				throw std::runtime_error("Not a symbol map line: " + line);
+
+			char* end;
+			const long number = std::strtol(value.c_str(), &end, 0);
+			if (*end != '\0')
+				throw std::runtime_error("Not a symbol map line: " + line);
+
+			if (kind == "label")
+				symbols.labels[name] = static_cast<uint16_t>(number);
+			else if (kind == "constant")
+				symbols.constants[name] = number;
+			else
+				throw std::runtime_error("Not a symbol map line: " + line);
+		}
+		return symbols;
+	}
+
+}
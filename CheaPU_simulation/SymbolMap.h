@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <string>
+
+namespace CheaPU {
+
+	/** The names in a program: where the labels are and what the constants are worth.
+	    Written by the Assembler, used by whoever shows addresses to humans (Profiler, CheaPU_tracedump...).
+
+		On file, one symbol per line: "label loop 0x0000" or "constant one 0x0001" (or "constant minus_one -0x0001"). */
+	struct SymbolMap {
+		std::map<std::string, uint16_t> labels;
+		std::map<std::string, int32_t> constants;  ///< Signed: a constant can be negative.
+
+		/** The 1st label (in alphabetical order) at the address, or empty. */
+		std::string label_at(const size_t address) const;
+
+		void write(std::ostream& out) const;
+
+		/** Throws std::runtime_error if the stream is not a symbol map. */
+		static SymbolMap read(std::istream& in);
+	};
+
+}
@@ -0,0 +1,261 @@
+#include "pch.h"
+#include "Trace.h"
+
+#include "CPU.h"
+#include "MemoryChip.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace CheaPU {
+
+	namespace {
+
+		constexpr char magic[8] = { 'C', 'H', 'E', 'A', 'P', 'U', 'T', 'R' };
+		constexpr uint8_t version = 1;
+
+		/** @name Bits of the header byte of a record. */
+		/**@{*/
+		constexpr uint8_t opcode_bits = 0x07;
+		constexpr uint8_t illegal_bit = 0x08;
+		constexpr uint8_t program_counter_bit = 0x10;
+		constexpr uint8_t accumulator_bit = 0x20;
+		constexpr uint8_t flags_bit = 0x40;
+		/**@}*/
+
+		bool is_legal(const uint8_t opcode)
+		{
+			return opcode <= to_word(Opcode::SUB);
+		}
+
+		bool has_operand(const uint8_t opcode)
+		{
+			switch (static_cast<Opcode>(opcode)) {
+			case Opcode::LD:
+			case Opcode::ST:
+			case Opcode::ADD:
+			case Opcode::JMP:
+			case Opcode::JZE:
+			case Opcode::SUB:
+				return true;
+			default:
+				return false;
+			}
+		}
+
+		/** Where the next instruction is, if this one does not jump.
+		    HALT and illegal opcodes stay where they are. */
+		uint8_t fall_through(const TraceRecord& r)
+		{
+			if (r.opcode == to_word(Opcode::NOP))
+				return r.program_counter + 1;
+			if (has_operand(r.opcode))
+				return r.program_counter + 2;
+			return r.program_counter;
+		}
+
+		uint8_t flags_of(const CPU& cpu)
+		{
+			return cpu.overflow() | (cpu.zero() << 1) | (cpu.error << 2);
+		}
+	}
+
+	TraceWriter::TraceWriter(std::ostream& out, const size_t buffer_size, const size_t buffers) :
+		out(out),
+		buffer_size(buffer_size),
+		writing(false),
+		stopping(false),
+		failed(false)
+	{
+		current.reserve(buffer_size);
+		for (size_t i = 1; i < buffers; ++i) {
+			free_buffers.emplace_back();
+			free_buffers.back().reserve(buffer_size);
+		}
+
+		writer = std::thread(&TraceWriter::write_buffers, this);
+	}
+
+	TraceWriter::~TraceWriter()
+	{
+		flush();
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+		changed.notify_all();
+		writer.join();
+	}
+
+	void TraceWriter::submit()
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		full_buffers.push_back(std::move(current));
+		changed.notify_all();
+
+		changed.wait(guard, [this]() { return !free_buffers.empty(); });
+		current = std::move(free_buffers.back());
+		free_buffers.pop_back();
+	}
+
+	void TraceWriter::flush()
+	{
+		if (!current.empty())
+			submit();
+
+		std::unique_lock<std::mutex> guard(lock);
+		changed.wait(guard, [this]() { return full_buffers.empty() && !writing; });
+		out.flush();
+		failed = failed || !out;
+	}
+
+	bool TraceWriter::good() const
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		return !failed;
+	}
+
+	void TraceWriter::write_buffers()
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		while (true) {
+			changed.wait(guard, [this]() { return stopping || !full_buffers.empty(); });
+			if (full_buffers.empty())
+				return;  // Stopping, with nothing left to do.
+
+			std::vector<uint8_t> buffer = std::move(full_buffers.front());
+			full_buffers.pop_front();
+			writing = true;
+
+			// The slow part, without holding the lock.
+			guard.unlock();
+			out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+			const bool ok = !!out;
+			guard.lock();
+
+			failed = failed || !ok;
+			buffer.clear();
+			free_buffers.push_back(std::move(buffer));
+			writing = false;
+			changed.notify_all();
+		}
+	}
+
+	TraceRecorder::TraceRecorder(std::ostream& out) :
+		writer(out),
+		last{ 0, 0, 0, 0, 0 },
+		next_program_counter(0),
+		record_count(0)
+	{
+		writer.write(reinterpret_cast<const uint8_t*>(magic), sizeof(magic));
+		writer.write(&version, 1);
+	}
+
+	uint64_t TraceRecorder::run(CPU& cpu, MemoryChip& memory, const uint64_t max_cycles)
+	{
+		uint64_t total = 0;
+		while (!cpu.error && total < max_cycles) {
+			TraceRecord r;
+			r.program_counter = cpu.program_counter;
+			r.opcode = memory.read(r.program_counter);
+			r.operand = has_operand(r.opcode) ? memory.read(r.program_counter + 1) : 0;  // Before a ST can change it.
+
+			total += cpu.step_instruction(memory, max_cycles - total);
+
+			if (cpu.instruction_completed()) {
+				r.accumulator = cpu.accumulator;
+				r.flags = flags_of(cpu);
+				record(r);
+			}
+		}
+
+		return total;
+	}
+
+	void TraceRecorder::flush()
+	{
+		writer.flush();
+	}
+
+	uint64_t TraceRecorder::records() const
+	{
+		return record_count;
+	}
+
+	void TraceRecorder::record(const TraceRecord& r)
+	{
+		uint8_t bytes[5];
+		size_t size = 1;
+
+		uint8_t header = 0;
+		if (is_legal(r.opcode))
+			header |= r.opcode;
+		else {
+			header |= illegal_bit;
+			bytes[size++] = r.opcode;
+		}
+
+		if (r.program_counter != next_program_counter) {
+			header |= program_counter_bit;
+			bytes[size++] = r.program_counter;
+		}
+
+		if (r.accumulator != last.accumulator) {
+			header |= accumulator_bit;
+			bytes[size++] = r.accumulator;
+		}
+
+		if (r.flags != last.flags) {
+			header |= flags_bit;
+			bytes[size++] = r.flags;
+		}
+
+		if (has_operand(r.opcode))
+			bytes[size++] = r.operand;
+
+		bytes[0] = header;
+		writer.write(bytes, size);
+
+		last = r;
+		next_program_counter = fall_through(r);
+		++record_count;
+	}
+
+	TraceReader::TraceReader(std::istream& in) :
+		in(in),
+		last{ 0, 0, 0, 0, 0 },
+		next_program_counter(0)
+	{
+		char start[sizeof(magic) + 1];
+		in.read(start, sizeof(start));
+		if (!in || !std::equal(magic, magic + sizeof(magic), start) || start[sizeof(magic)] != version)
+			throw std::runtime_error("Not a CheaPU trace (or a different version).");
+	}
+
+	bool TraceReader::next(TraceRecord& r)
+	{
+		const int header = in.get();
+		if (header == std::istream::traits_type::eof())
+			return false;
+
+		r.opcode = (header & illegal_bit) ? read_byte() : (header & opcode_bits);
+		r.program_counter = (header & program_counter_bit) ? read_byte() : next_program_counter;
+		r.accumulator = (header & accumulator_bit) ? read_byte() : last.accumulator;
+		r.flags = (header & flags_bit) ? read_byte() : last.flags;
+		r.operand = has_operand(r.opcode) ? read_byte() : 0;
+
+		last = r;
+		next_program_counter = fall_through(r);
+		return true;
+	}
+
+	uint8_t TraceReader::read_byte()
+	{
+		const int byte = in.get();
+		if (byte == std::istream::traits_type::eof())
+			throw std::runtime_error("The trace ends in the middle of a record.");
+		return static_cast<uint8_t>(byte);
+	}
+
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <istream>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+namespace CheaPU {
+
+	class CPU;
+	class MemoryChip;
+
+	/** What the trace knows of an instruction, once it is done. */
+	struct TraceRecord {
+		uint8_t program_counter;  ///< Where the instruction is.
+		uint8_t opcode;
+		uint8_t operand;          ///< 0 for the instructions without one.
+		uint8_t accumulator;      ///< After the instruction.
+		uint8_t flags;            ///< After the instruction: overflow, zero and error in the bits 0, 1, 2.
+
+		bool operator==(const TraceRecord& other) const = default;
+	};
+
+	/** Writes bytes to a stream from a background thread, so that whoever produces them never waits for the disk
+	    (unless the disk is slower than the producer for a long time: there are only so many buffers,
+		then the producer has to wait, rather than eating up all the memory). */
+	class TraceWriter {
+	public:
+		explicit TraceWriter(std::ostream& out, const size_t buffer_size = 64 * 1024, const size_t buffers = 4);
+
+		/** Writes whatever is left. */
+		~TraceWriter();
+
+		void write(const uint8_t* data, const size_t size)
+		{
+			if (current.size() + size > buffer_size)
+				submit();
+			current.insert(current.end(), data, data + size);
+		}
+
+		/** Waits until everything written so far is in the stream. */
+		void flush();
+
+		/** False if the stream failed. */
+		bool good() const;
+
+	private:
+		std::ostream& out;
+		const size_t buffer_size;
+		std::vector<uint8_t> current;
+
+		/** @name Shared with the background thread. */
+		/**@{*/
+		mutable std::mutex lock;
+		std::condition_variable changed;
+		std::deque<std::vector<uint8_t>> full_buffers;
+		std::vector<std::vector<uint8_t>> free_buffers;
+		bool writing;
+		bool stopping;
+		bool failed;
+		/**@}*/
+
+		std::thread writer;
+
+		/** Gives the current buffer to the writer, takes an empty one. */
+		void submit();
+		void write_buffers();
+
+		TraceWriter(const TraceWriter&) = delete;
+		void operator=(const TraceWriter&) = delete;
+	};
+
+	/** Runs the CPU and records every instruction in a compact binary stream.
+
+		The stream starts with the "CHEAPUTR" magic and a version byte. Then, for every instruction,
+		a header byte:
+		- bits 0-2: the opcode (if legal),
+		- bit 3: illegal opcode, the opcode byte follows,
+		- bit 4: the program counter follows (it is not right after the previous instruction: a jump),
+		- bit 5: the accumulator follows (it changed),
+		- bit 6: the flags follow (they changed).
+		Then those bytes, in that order, and the operand (for the instructions that have one).
+		Most instructions take 2 bytes, NOP 1. */
+	class TraceRecorder {
+	public:
+		/** Writes the magic and version right away. */
+		explicit TraceRecorder(std::ostream& out);
+
+		/** Runs like CPU::run_cycles(). Only the instructions that complete are recorded. */
+		uint64_t run(CPU& cpu, MemoryChip& memory, const uint64_t max_cycles);
+
+		/** Waits until the stream has everything. */
+		void flush();
+
+		uint64_t records() const;
+
+	private:
+		TraceWriter writer;
+		TraceRecord last;
+		uint8_t next_program_counter;   ///< Where the instruction after the last one would be, without jumps.
+		uint64_t record_count;
+
+		void record(const TraceRecord& r);
+	};
+
+	/** Decodes what the TraceRecorder wrote. */
+	class TraceReader {
+	public:
+		/** Throws std::runtime_error if the stream does not start like a trace. */
+		explicit TraceReader(std::istream& in);
+
+		/** False at the end of the stream. Throws std::runtime_error if the stream ends in the middle of a record. */
+		bool next(TraceRecord& r);
+
+	private:
+		std::istream& in;
+		TraceRecord last;
+		uint8_t next_program_counter;
+
+		uint8_t read_byte();
+	};
+
+}
@@ -0,0 +1,126 @@
+#include "CPU.h"
+#include "SymbolMap.h"
+#include "Trace.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+/** Prints a trace written by the TraceRecorder (CheaPU_headless --trace), one instruction per line.
+
+	Usage: CheaPU_tracedump <trace file> [--skip N] [--count N] [--symbols <map>]
+
+	--skip N jumps over the 1st N instructions, --count N stops after printing N.
+	--symbols <map> shows the labels of the symbol map written by CheaPU_assembler, for the addresses that have one.
+	The trace is read as it is printed: it can be much bigger than the memory. */
+
+namespace {
+
+	struct Options {
+		std::string trace;
+		uint64_t skip = 0;
+		uint64_t count = UINT64_MAX;
+		std::string symbols;
+	};
+
+	bool parse_arguments(const int argc, char* argv[], Options& options)
+	{
+		for (int i = 1; i < argc; ++i) {
+			const std::string argument = argv[i];
+			if (argument == "--skip" && i + 1 < argc)
+				options.skip = std::strtoull(argv[++i], nullptr, 10);
+			else if (argument == "--count" && i + 1 < argc)
+				options.count = std::strtoull(argv[++i], nullptr, 10);
+			else if (argument == "--symbols" && i + 1 < argc)
+				options.symbols = argv[++i];
+			else if (options.trace.empty() && argument.rfind("--", 0) != 0)
+				options.trace = argument;
+			else
+				return false;
+		}
+
+		return !options.trace.empty();
+	}
+
+	void print_record(std::ostream& out, const uint64_t index, const CheaPU::TraceRecord& r, const CheaPU::SymbolMap& symbols)
+	{
+		static constexpr const char* names[] = { "NOP", "LD", "ST", "ADD", "HALT", "JMP", "JZE", "SUB" };
+
+		out << std::setw(12) << index << std::hex << std::setfill('0') << std::uppercase
+			<< "  0x" << std::setw(2) << +r.program_counter << "  ";
+		if (!symbols.labels.empty())
+			out << std::left << std::setfill(' ') << std::setw(12) << symbols.label_at(r.program_counter) << std::right;
+
+		if (r.opcode >= std::size(names))
+			out << "ILLEGAL 0x" << std::setfill('0') << std::setw(2) << +r.opcode;
+		else if (r.opcode == CheaPU::to_word(CheaPU::Opcode::NOP) || r.opcode == CheaPU::to_word(CheaPU::Opcode::HALT))
+			out << std::left << std::setfill(' ') << std::setw(12) << names[r.opcode] << std::right;
+		else {
+			out << std::left << std::setfill(' ') << std::setw(5) << names[r.opcode] << std::right;
+			const std::string label = symbols.label_at(r.operand);
+			if (label.empty())
+				out << "0x" << std::setfill('0') << std::setw(2) << +r.operand << "   ";
+			else
+				out << std::left << std::setw(7) << label << std::right;
+		}
+
+		out << "  ACC 0x" << std::setfill('0') << std::setw(2) << +r.accumulator
+			<< std::dec
+			<< "  OVER " << (r.flags & 1)
+			<< "  ZERO " << ((r.flags >> 1) & 1)
+			<< "  ERROR " << ((r.flags >> 2) & 1) << "\n"
+			<< std::setfill(' ') << std::nouppercase;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	Options options;
+	if (!parse_arguments(argc, argv, options)) {
+		std::cerr << "Usage: CheaPU_tracedump <trace file> [--skip N] [--count N] [--symbols <map>]\n";
+		return 2;
+	}
+
+	CheaPU::SymbolMap symbols;
+	if (!options.symbols.empty()) {
+		std::ifstream file(options.symbols);
+		try {
+			if (!file)
+				throw std::runtime_error("Can't open it.");
+			symbols = CheaPU::SymbolMap::read(file);
+		}
+		catch (const std::runtime_error& e) {
+			std::cerr << options.symbols << ": " << e.what() << "\n";
+			return 1;
+		}
+	}
+
+	std::ifstream file(options.trace, std::ios::binary);
+	if (!file) {
+		std::cerr << "Can't read " << options.trace << "\n";
+		return 1;
+	}
+
+	uint64_t index = 0;
+	uint64_t printed = 0;
+	try {
+		CheaPU::TraceReader reader(file);
+		CheaPU::TraceRecord r;
+		while (printed < options.count && reader.next(r)) {
+			if (index >= options.skip) {
+				print_record(std::cout, index, r, symbols);
+				++printed;
+			}
+			++index;
+		}
+	}
+	catch (const std::runtime_error& e) {
+		std::cerr << options.trace << ": " << e.what() << "\n";
+		return 1;
+	}
+
+	return 0;
+}